@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "malloc.h"
+
+/*
+ *  Large buffer churn.
+ *
+ *  Given count and size it mallocs, touches (one byte a page) and frees
+ *  count buffers of between size and twice size bytes, keeping a few
+ *  alive at a time, as a program building and throwing away big
+ *  temporary arrays would. Every one of them is mmapped, so this
+ *  measures what the mmap cache (MALLOC_MMAP_CACHE_MAX) saves.
+ *
+ *  The wall clock time is reported, followed by malloc_stats.
+ *
+ */
+
+#define LIVE      4
+#define PAGE      4096
+
+int main(int argc, char* argv[]){
+  size_t count, size, bytes, i, j;
+  char* live[LIVE] = { NULL };
+  struct timespec start, end;
+
+  if (argc != 3) {
+    fprintf(stdout, "Usage: %s <count> <size>\n", argv[0]);
+    return 1;
+  }
+
+  count = strtoul(argv[1], NULL, 0);
+  size = strtoul(argv[2], NULL, 0);
+
+  /* stop the dynamic threshold from moving these into the heap */
+  mallopt(M_MMAP_THRESHOLD, size);
+
+  srandom(0);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for(i = 0; i < count; i++){
+    free(live[i % LIVE]);
+    bytes = size + (size_t)random() % size;
+    live[i % LIVE] = malloc(bytes);
+    if(live[i % LIVE] == NULL){
+      fprintf(stderr, "malloc(%zu) failed\n", bytes);
+      exit(1);
+    }
+    for(j = 0; j < bytes; j += PAGE){
+      live[i % LIVE][j] = 1;
+    }
+  }
+
+  for(i = 0; i < LIVE; i++){
+    free(live[i]);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  fprintf(stdout, "%zu buffers of %zu to %zu bytes in %.3f secs\n",
+          count, size, 2 * size,
+          (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9);
+
+  malloc_stats();
+
+  return 0;
+}
@@ -0,0 +1 @@
+../replay/latency.c
\ No newline at end of file
@@ -0,0 +1 @@
+../replay/latency.h
\ No newline at end of file
@@ -0,0 +1 @@
+../replay/replayops.c
\ No newline at end of file
@@ -0,0 +1 @@
+../replay/replayops.h
\ No newline at end of file
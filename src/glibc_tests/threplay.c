@@ -0,0 +1 @@
+../replay/threplay.c
\ No newline at end of file
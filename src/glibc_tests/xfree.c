@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "malloc.h"
+
+/*
+ *  Cross-arena frees.
+ *
+ *  Given npairs, it creates npairs producer/consumer pairs. Each producer
+ *  mallocs count blocks and hands them, through a ring, to its consumer,
+ *  which frees them (into the producer's arena) in between mallocs and
+ *  frees of its own. So every arena sees its owner and a stranger
+ *  taking turns on its lock and on the lines around it.
+ *
+ *  The wall clock time from the first pthread_create to the last
+ *  pthread_join is reported, so different layouts of struct malloc_state
+ *  can be compared.
+ *
+ */
+
+#define MAX_PAIRS    512
+#define RING_SIZE    1024
+
+typedef struct ring {
+  void* slots[RING_SIZE];
+  volatile size_t head __attribute__ ((aligned (64)));   /* written by the producer */
+  volatile size_t tail __attribute__ ((aligned (64)));   /* written by the consumer */
+} ring_t;
+
+typedef struct pair {
+  ring_t ring;
+  size_t count;
+  size_t size;
+} pair_t;
+
+static pair_t pairs[MAX_PAIRS];
+
+
+static void* producer(void* arg){
+  pair_t* p = (pair_t*)arg;
+  ring_t* r = &p->ring;
+  size_t i;
+  void* ptr;
+
+  for(i = 0; i < p->count; i++){
+    ptr = malloc(p->size);
+    if(ptr == NULL){
+      fprintf(stderr, "malloc(%zu) failed\n", p->size);
+      exit(1);
+    }
+    *(char*)ptr = 1;
+    while(r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING_SIZE){
+      sched_yield();
+    }
+    r->slots[r->head % RING_SIZE] = ptr;
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static void* consumer(void* arg){
+  pair_t* p = (pair_t*)arg;
+  ring_t* r = &p->ring;
+  size_t i;
+  void* mine;
+
+  for(i = 0; i < p->count; i++){
+    while(__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == r->tail){
+      sched_yield();
+    }
+    free(r->slots[r->tail % RING_SIZE]);
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+    mine = malloc(p->size);
+    free(mine);
+  }
+  return NULL;
+}
+
+
+int main(int argc, char* argv[]){
+  int npairs;
+  int rc;
+  int i;
+  size_t count, size;
+  pthread_t threads[2 * MAX_PAIRS];
+  struct timespec start, end;
+
+  if (argc < 3 || argc > 4) {
+    fprintf(stdout, "Usage: %s <npairs> <count> [size]\n", argv[0]);
+    return 1;
+  }
+
+  npairs = atoi(argv[1]);
+  count = strtoul(argv[2], NULL, 0);
+  size = argc == 4 ? strtoul(argv[3], NULL, 0) : 64;
+
+  if(npairs <= 0 || npairs > MAX_PAIRS){
+    fprintf(stdout, "npairs must be between 1 and %d\n", MAX_PAIRS);
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for(i = 0; i < npairs; i++){
+    pairs[i].count = count;
+    pairs[i].size = size;
+    rc = pthread_create(&threads[2 * i], NULL, producer, &pairs[i]);
+    if(rc == 0){
+      rc = pthread_create(&threads[2 * i + 1], NULL, consumer, &pairs[i]);
+    }
+    if (rc){
+      fprintf(stderr, "return code from pthread_create() is %d\n", rc);
+      exit(-1);
+    }
+  }
+
+  for(i = 0; i < 2 * npairs; i++){
+    rc = pthread_join(threads[i], NULL);
+    if (rc){
+      fprintf(stderr, "return code from pthread_join() is %d\n", rc);
+      exit(-1);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  fprintf(stdout, "%d pairs, %zu cross-arena frees of %zu bytes in %.3f secs\n",
+          npairs, npairs * count, size,
+          (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9);
+
+  malloc_stats();
+
+  return 0;
+}
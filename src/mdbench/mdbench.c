@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2016  SRI International
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Replays a mhook trace against the metadata hashtable alone (i.e. no malloc),
+ * so that changes to metadata.c, memcxt.c and the flags in sri.h can be 
+ * measured outside of a glibc build. The recorded pointers are used as the 
+ * keys, so the table sees the same addresses the real allocator did.
+ *
+ *  malloc, calloc:  metadata_insert_chunk
+ *  free:            metadata_lookup followed by metadata_delete  (as in __libc_free)
+ *  realloc:         metadata_lookup, and if it moved metadata_delete & metadata_insert_chunk
+ *
+ * With -B the frees are queued, and handed to metadata_lookup_batch and
+ * metadata_delete_batch METADATA_BATCH_LENGTH at a time, as the coalescing
+ * loops in malloc do. (A pointer that is freed and then reused before its
+ * batch is flushed deletes the newer bucket, but with the same key, so the
+ * table ends up the same.)
+ *
+ * With -H the metadata pools are mapped with sri_hugepages set. When the
+ * kernel lets us, the dTLB load misses of the whole replay are reported too.
+ *
+ * With -S <bytes> mallocs of at most that many bytes are left out of the
+ * table, as they would be served by the slab runs (SRI_SLAB in sri.h), and 
+ * so are their frees, and reallocs that stay within the slot.
+ *
+ * With -M each add is preceded by a memcxt_refill, as malloc does before it
+ * takes the arena lock, so the add is served from the thread's magazine; the
+ * refills are timed separately, since malloc does not hold the lock for them.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/limits.h>
+#include <linux/perf_event.h>
+
+#include "mhook.h"
+
+#include "metadata.h"
+#include "utils.h"
+
+#define BZCAT "bzcat"
+
+#define BUFFERSZ 1024
+
+typedef struct mdbench_stats_s {
+  size_t lines;
+  size_t add_count;
+  uint64_t add_nsecs;
+  size_t refill_count;
+  uint64_t refill_nsecs;
+  size_t lookup_count;
+  size_t lookup_failures;
+  uint64_t lookup_nsecs;
+  size_t delete_count;
+  uint64_t delete_nsecs;
+  size_t slab_mallocs;
+  size_t slab_frees;
+} mdbench_stats_t;
+
+
+static bool batching = false;
+
+static bool magazine = false;
+
+static const void* batch[METADATA_BATCH_LENGTH];
+static chunkinfoptr batch_values[METADATA_BATCH_LENGTH];
+static size_t batch_count = 0;
+
+static size_t slab_max = 0;
+static memcxt_t slab_memcxt;
+static metadata_t slab_htbl;  /* the slots; not timed */
+
+static inline uint64_t now_nsecs(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline double per_call(uint64_t nsecs, size_t count){
+  return count == 0 ? 0.0 : (double)nsecs / count;
+}
+
+static bool bench_add(metadata_t* htbl, mdbench_stats_t* statsp, uintptr_t ptr){
+  uint64_t start;
+  bool success;
+  
+  if(ptr == 0){ return true; }
+
+  if(magazine){
+    start = now_nsecs();
+    memcxt_refill(htbl->cfg.memcxt);
+    statsp->refill_nsecs += now_nsecs() - start;
+    statsp->refill_count++;
+  }
+
+  start = now_nsecs();
+  success = metadata_insert_chunk(htbl, (void*)ptr);
+  statsp->add_nsecs += now_nsecs() - start;
+  statsp->add_count++;
+  
+  return success;
+}
+
+static void bench_lookup(metadata_t* htbl, mdbench_stats_t* statsp, uintptr_t ptr){
+  uint64_t start;
+  chunkinfoptr ci;
+
+  start = now_nsecs();
+  ci = metadata_lookup(htbl, (void*)ptr);
+  statsp->lookup_nsecs += now_nsecs() - start;
+  statsp->lookup_count++;
+  if(ci == NULL){ statsp->lookup_failures++; }
+}
+
+static void bench_delete(metadata_t* htbl, mdbench_stats_t* statsp, uintptr_t ptr){
+  uint64_t start;
+
+  start = now_nsecs();
+  metadata_delete(htbl, (void*)ptr);
+  statsp->delete_nsecs += now_nsecs() - start;
+  statsp->delete_count++;
+}
+
+static void bench_flush(metadata_t* htbl, mdbench_stats_t* statsp){
+  uint64_t start;
+  size_t found;
+
+  if(batch_count == 0){ return; }
+
+  start = now_nsecs();
+  found = metadata_lookup_batch(htbl, batch, batch_values, batch_count);
+  statsp->lookup_nsecs += now_nsecs() - start;
+  statsp->lookup_count += batch_count;
+  statsp->lookup_failures += batch_count - found;
+
+  start = now_nsecs();
+  metadata_delete_batch(htbl, batch, batch_count);
+  statsp->delete_nsecs += now_nsecs() - start;
+  statsp->delete_count += batch_count;
+
+  batch_count = 0;
+}
+
+static void bench_free(metadata_t* htbl, mdbench_stats_t* statsp, uintptr_t ptr){
+  if(batching){
+    batch[batch_count++] = (void*)ptr;
+    if(batch_count == METADATA_BATCH_LENGTH){
+      bench_flush(htbl, statsp);
+    }
+  } else {
+    bench_lookup(htbl, statsp, ptr);
+    bench_delete(htbl, statsp, ptr);
+  }
+}
+
+static bool bench_malloc(metadata_t* htbl, mdbench_stats_t* statsp, size_t size, uintptr_t ptr){
+  if(ptr != 0 && slab_max != 0 && size <= slab_max){
+    statsp->slab_mallocs++;
+    return metadata_insert_chunk(&slab_htbl, (void*)ptr);
+  }
+  return bench_add(htbl, statsp, ptr);
+}
+
+/* returns true if ptr was a slot, which it no longer is */
+static bool bench_slab_free(mdbench_stats_t* statsp, uintptr_t ptr){
+  if(slab_max == 0 || metadata_lookup(&slab_htbl, (void*)ptr) == NULL){
+    return false;
+  }
+  metadata_delete(&slab_htbl, (void*)ptr);
+  statsp->slab_frees++;
+  return true;
+}
+
+/* parses the hex fields that follow the opcode; as in replaylib's dirtywork */
+static bool parse_fields(uintptr_t fields[], size_t len, const char* buffer){
+  const char* cursor;
+  char* end;
+  size_t index;
+
+  cursor = buffer + 1;
+  for(index = 0; index < len; index++){
+    errno = 0;
+    fields[index] = (uintptr_t)strtoull(cursor, &end, 16);
+    if(errno != 0 || end == cursor){
+      return false;
+    }
+    cursor = end;
+  }
+  return true;
+}
+
+static bool bench_line(metadata_t* htbl, mdbench_stats_t* statsp, const char* buffer){
+  uintptr_t fields[REALLOCARGS];
+
+  switch(buffer[0]){
+  case 'm':
+    return parse_fields(fields, MALLOCARGS, buffer) && bench_malloc(htbl, statsp, fields[0], fields[1]);
+  case 'c':
+    return parse_fields(fields, CALLOCARGS, buffer) && bench_add(htbl, statsp, fields[2]);
+  case 'f':
+    if(!parse_fields(fields, FREEARGS, buffer)){ return false; }
+    if(fields[0] != 0 && !bench_slab_free(statsp, fields[0])){
+      bench_free(htbl, statsp, fields[0]);
+    }
+    return true;
+  case 'r':
+    if(!parse_fields(fields, REALLOCARGS, buffer)){ return false; }
+    if(fields[0] == 0){
+      return bench_malloc(htbl, statsp, fields[1], fields[2]);
+    }
+    if(slab_max != 0 && metadata_lookup(&slab_htbl, (void*)fields[0]) != NULL){
+      /* a slot is only ever moved to a fresh malloc */
+      if(fields[0] == fields[2]){ return true; }
+      bench_slab_free(statsp, fields[0]);
+      return bench_malloc(htbl, statsp, fields[1], fields[2]);
+    }
+    bench_lookup(htbl, statsp, fields[0]);
+    if(fields[0] == fields[2]){ return true; }
+    bench_delete(htbl, statsp, fields[0]);
+    return bench_add(htbl, statsp, fields[2]);
+  case 'i':
+  case 'e':
+    return true;
+  default:
+    return false;
+  }
+}
+
+/* returns a started counter of user space dTLB load misses, or -1 if perf is not available */
+static int dtlb_counter(void){
+  struct perf_event_attr attr;
+  int fd;
+
+  memset(&attr, 0, sizeof(struct perf_event_attr));
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.size = sizeof(struct perf_event_attr);
+  attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  if(fd != -1){
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  return fd;
+}
+
+static void dump_stats(FILE* fp, const char* filename, mdbench_stats_t* statsp){
+  fprintf(fp, "%s: %zu lines\n", filename, statsp->lines);
+  fprintf(fp, "add      %10zu  %8.2f nsecs per call\n", statsp->add_count, per_call(statsp->add_nsecs, statsp->add_count));
+  fprintf(fp, "lookup   %10zu  %8.2f nsecs per call  (%zu not found)\n",
+	  statsp->lookup_count, per_call(statsp->lookup_nsecs, statsp->lookup_count), statsp->lookup_failures);
+  fprintf(fp, "delete   %10zu  %8.2f nsecs per call\n", statsp->delete_count, per_call(statsp->delete_nsecs, statsp->delete_count));
+  if(magazine){
+    fprintf(fp, "refill   %10zu  %8.2f nsecs per call  (outside the lock)\n",
+	    statsp->refill_count, per_call(statsp->refill_nsecs, statsp->refill_count));
+  }
+  if(slab_max != 0){
+    fprintf(fp, "slab     %10zu  mallocs and %zu frees of at most %zu bytes kept out of the table\n",
+	    statsp->slab_mallocs, statsp->slab_frees, slab_max);
+  }
+}
+
+int main(int argc, char* argv[]){
+  char buffer[BUFFERSZ];
+  char pathbuf[PATH_MAX+sizeof(BZCAT)+2] = {0};
+  const char* filename;
+  bool compressed;
+  memcxt_t memcxt;
+  metadata_t htbl;
+  mdbench_stats_t stats;
+  FILE* fp;
+  int code;
+
+  int dtlbfd;
+  uint64_t dtlb_misses;
+
+  int opt;
+
+  while((opt = getopt(argc, argv, "BHMS:")) != -1){
+    switch(opt){
+    case 'B': batching = true; break;
+    case 'M': magazine = true; break;
+    case 'H': sri_hugepages = true; break;
+    case 'S': slab_max = strtoul(optarg, NULL, 0); break;
+    default:
+      fprintf(stderr, "Usage: %s [-B] [-H] [-M] [-S bytes] <mhook output file>\n", argv[0]);
+      return 1;
+    }
+  }
+  if(optind != argc - 1){
+    fprintf(stderr, "Usage: %s [-B] [-H] [-M] [-S bytes] <mhook output file>\n", argv[0]);
+    return 1;
+  }
+
+  filename = argv[optind];
+  compressed = strlen(filename) > 4 && !strcmp(".bz2", filename + strlen(filename) - 4);
+  code = 0;
+  memset(&stats, 0, sizeof(mdbench_stats_t));
+
+  if(!init_memcxt(&memcxt) || !init_metadata(&htbl, &memcxt) ||
+     !init_memcxt(&slab_memcxt) || !init_metadata(&slab_htbl, &slab_memcxt)){
+    fprintf(stderr, "Could not initialize the metadata: %s\n", strerror(errno));
+    return 1;
+  }
+
+  if(compressed){
+    snprintf(pathbuf, sizeof(pathbuf), "%s %s", BZCAT, filename);
+    fp = popen(pathbuf, "r");
+  } else {
+    fp = fopen(filename, "r");
+  }
+  if(fp == NULL){
+    fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+    return 1;
+  }
+
+  dtlbfd = dtlb_counter();
+
+  while(fgets(buffer, BUFFERSZ, fp) != NULL){
+    if(!bench_line(&htbl, &stats, buffer)){
+      fprintf(stderr, "Replaying line %zu failed: %s\n", stats.lines, buffer);
+      code = 1;
+      break;
+    }
+    stats.lines++;
+  }
+
+  bench_flush(&htbl, &stats);
+
+  if(compressed){
+    pclose(fp);
+  } else {
+    fclose(fp);
+  }
+
+  dump_stats(stdout, filename, &stats);
+  fprintf(stdout, "hugepages %s\n", sri_hugepages ? "on" : "off");
+  if(dtlbfd != -1 && read(dtlbfd, &dtlb_misses, sizeof(uint64_t)) == sizeof(uint64_t)){
+    fprintf(stdout, "dTLB load misses %" PRIu64 "\n", dtlb_misses);
+    close(dtlbfd);
+  } else {
+    fprintf(stdout, "dTLB load misses unavailable\n");
+  }
+  dump_metadata(stdout, &htbl, false);
+
+  delete_metadata(&htbl);
+  delete_memcxt(&memcxt);
+  delete_metadata(&slab_htbl);
+  delete_memcxt(&slab_memcxt);
+
+  return code;
+}
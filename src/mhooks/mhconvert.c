@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mhook.h"
+#include "replayops.h"
+
+/*
+ *  Converts mhook output between the binary format (MHOOK_FORMAT=binary)
+ *  and the text one, in whichever direction the input calls for, so that
+ *  replay, mdbench and analysis/parse_data work on either.
+ *
+ *  The binary records of each thread are in order, but the threads are
+ *  interleaved block by block, so the text is produced by merging the
+ *  threads in mhook_order (see mhook.h), with replayops' merge_trace.
+ *  Text has no threads or timestamps: converted to binary it all goes
+ *  to thread 0, with the line number as its sequence number and
+ *  timestamp.
+ *
+ *  An output of - is stdout.
+ *
+ */
+
+#define BUFFERSZ 1024
+
+static bool is_binary(const char* filename){
+  char magic[sizeof(((mhook_header_t*)0)->magic)];
+  FILE* fp;
+  bool retval;
+
+  fp = fopen(filename, "r");
+  if(fp == NULL){
+    return false;
+  }
+  retval = fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, MHOOK_MAGIC, sizeof(magic)) == 0;
+  fclose(fp);
+  return retval;
+}
+
+static void write_text(FILE* out, const mhook_record_t* r){
+  switch(r->op){
+  case 'm':
+    fprintf(out, "m 0x%016" PRIX64 " 0x%016" PRIX64 " 0x%016" PRIX64 "\n", r->size, r->ptr, r->caller);
+    break;
+  case 'f':
+    fprintf(out, "f 0x%016" PRIX64 " 0x%016" PRIX64 "\n", r->ptr, r->caller);
+    break;
+  case 'c':
+    fprintf(out, "c 0x%016" PRIX64 " 0x%016" PRIX64 " 0x%016" PRIX64 " 0x%016" PRIX64 "\n",
+            r->size, r->size2, r->ptr, r->caller);
+    break;
+  case 'r':
+    fprintf(out, "r 0x%016" PRIX64 " 0x%016" PRIX64 " 0x%016" PRIX64 " 0x%016" PRIX64 "\n",
+            r->ptr, r->size, r->ptr2, r->caller);
+    break;
+  default:
+    fprintf(out, "%c 0x0\n", r->op);
+    break;
+  }
+}
+
+/* merge_trace's call */
+static void write_call(const mhook_record_t* r, uint32_t thread, void* out){
+  write_text(out, r);
+}
+
+static int binary_to_text(const char* input, FILE* out){
+  mhook_record_t* records;
+  struct stat sb;
+  size_t count;
+  void* map;
+  int fd, code;
+
+  fd = open(input, O_RDONLY);
+  if(fd < 0 || fstat(fd, &sb) != 0){
+    fprintf(stderr, "Could not open %s: %s\n", input, strerror(errno));
+    return 1;
+  }
+  if(sb.st_size < (off_t)sizeof(mhook_header_t)){
+    fprintf(stderr, "%s is truncated\n", input);
+    close(fd);
+    return 1;
+  }
+  map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED){
+    fprintf(stderr, "Could not map %s: %s\n", input, strerror(errno));
+    return 1;
+  }
+
+  records = decode_trace(input, map, sb.st_size, &count);
+  munmap(map, sb.st_size);
+  if(records == NULL){
+    return 1;
+  }
+
+  code = merge_trace(records, count, write_call, out) ? 0 : 1;
+
+  delete_records(records, count);
+  return code;
+}
+
+/* the one thread's block */
+static mhook_writer_t writer;
+
+static int text_to_binary(const char* input, FILE* out){
+  char buffer[BUFFERSZ];
+  uint64_t fields[4];
+  mhook_header_t header;
+  mhook_record_t r;
+  size_t linecount, nfields, index;
+  char *data, *rest;
+  FILE* fp;
+  int code;
+
+  fp = fopen(input, "r");
+  if(fp == NULL){
+    fprintf(stderr, "Could not open %s: %s\n", input, strerror(errno));
+    return 1;
+  }
+
+  memcpy(header.magic, MHOOK_MAGIC, sizeof(header.magic));
+  header.version = MHOOK_VERSION;
+  header.record_size = sizeof(mhook_record_t);
+  fwrite(&header, sizeof(header), 1, out);
+  mhook_start(&writer, 0, 0);
+
+  code = 0;
+  linecount = 0;
+  while(fgets(buffer, BUFFERSZ, fp) != NULL){
+    memset(&r, 0, sizeof(r));
+    memset(fields, 0, sizeof(fields));
+    r.op = buffer[0];
+    r.seq = linecount;
+    r.timestamp = linecount++;
+
+    switch(r.op){
+    case 'm': nfields = MALLOCARGS; break;
+    case 'f': nfields = FREEARGS; break;
+    case 'c': nfields = CALLOCARGS; break;
+    case 'r': nfields = REALLOCARGS; break;
+    case 'i':
+    case 'e': nfields = 0; break;
+    default:
+      fprintf(stderr, "Converting line %zu failed: %s", linecount, buffer);
+      code = 1;
+      goto exit;
+    }
+
+    data = &buffer[1];
+    for(index = 0; index < nfields; index++){
+      fields[index] = strtoull(data, &rest, 16);
+      if(data == rest){
+        fprintf(stderr, "Converting line %zu failed: %s", linecount, buffer);
+        code = 1;
+        goto exit;
+      }
+      data = rest;
+    }
+
+    switch(r.op){
+    case 'm':
+      r.size = fields[0]; r.ptr = fields[1]; r.caller = fields[2];
+      break;
+    case 'f':
+      r.ptr = fields[0]; r.caller = fields[1];
+      break;
+    case 'c':
+      r.size = fields[0]; r.size2 = fields[1]; r.ptr = fields[2]; r.caller = fields[3];
+      break;
+    case 'r':
+      r.ptr = fields[0]; r.size = fields[1]; r.ptr2 = fields[2]; r.caller = fields[3];
+      break;
+    }
+    if(mhook_append(&writer, &r)){
+      fwrite(&writer.block, mhook_block_size(&writer), 1, out);
+      mhook_flushed(&writer);
+    }
+  }
+
+ exit:
+  if(writer.block.count > 0){
+    fwrite(&writer.block, mhook_block_size(&writer), 1, out);
+  }
+  fclose(fp);
+  return code;
+}
+
+int main(int argc, char* argv[]){
+  FILE* out;
+  int code;
+
+  if (argc != 3) {
+    fprintf(stdout, "Usage: %s <mhook output file> <converted file>\n", argv[0]);
+    return 1;
+  }
+
+  out = strcmp(argv[2], "-") == 0 ? stdout : fopen(argv[2], "w");
+  if(out == NULL){
+    fprintf(stderr, "Could not open %s: %s\n", argv[2], strerror(errno));
+    return 1;
+  }
+
+  if(is_binary(argv[1])){
+    code = binary_to_text(argv[1], out);
+  } else {
+    code = text_to_binary(argv[1], out);
+  }
+
+  if(fclose(out) != 0){
+    fprintf(stderr, "Could not write %s: %s\n", argv[2], strerror(errno));
+    code = 1;
+  }
+  return code;
+}
@@ -10,7 +10,12 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 
 #include "mhook.h"
@@ -25,6 +30,7 @@ static __thread int malloc_hook_active = 1;
 
 static int logfd = -1;
 static bool ourfd = false;
+static bool binary = false;
 
 static const char hex[16] = "0123456789ABCDEF";
 
@@ -42,7 +48,252 @@ static void storehexstring(char *buf, uintptr_t val)
   }
 }
 
-static void _writelogentry(char func, size_t size1, size_t size2, void *p, void *q, void *caller)
+static void _writebytes(const void *bytes, size_t count)
+{
+  const char *cursor = bytes;
+  ssize_t rcode;
+
+  while(count > 0) {
+    rcode = write(logfd, cursor, count);
+    if(rcode <= 0) {
+      if(rcode < 0){
+        if(errno == EINTR){
+          exit(3);
+        } else if(errno == EBADF){
+          exit(5);
+        } else {
+          exit(errno);
+        }
+      } else  {
+        exit(7);
+      }
+    }
+    cursor += rcode;
+    count -= rcode;
+  }
+}
+
+/*
+ * The binary format (see mhook.h).
+ *
+ * Each thread encodes its records into its own mhook_buffer_t, mmapped
+ * the first time it logs something (we cannot very well malloc it), and
+ * writes the buffer out as a block with one write() when it is full. The buffers
+ * are kept on a list so that mhook_fini can flush those of the threads
+ * that are still running; each has a lock, taken by its owner and by
+ * whoever flushes it. A thread's buffer is also flushed when it exits,
+ * if the program uses pthreads, and left on the list, idle, for the
+ * next new thread to take over (buffers are never unmapped, so there
+ * are only as many as there were threads at once). It is also flushed
+ * before a fork, so that the child does not write the same records
+ * again; after mhook_fini records are written out one by one.
+ *
+ * Threads get their numbers from a counter in a shared mapping, so
+ * that those of a forked child, which writes to the same file, are
+ * not the numbers of its parent's threads.
+ */
+
+typedef struct mhook_buffer {
+  volatile int lock;
+  volatile int idle;           /* its thread has exited */
+  bool direct;                 /* write each record out at once */
+  struct mhook_buffer *next;
+  mhook_writer_t writer;
+} mhook_buffer_t;
+
+static __thread mhook_buffer_t *buffer = NULL;
+static __thread bool exited = false;      /* the thread gave its buffer up */
+static __thread uint32_t exited_thread;   /* and went on as this thread */
+static __thread uint32_t exited_tid;
+static __thread uint64_t exited_seq;
+static mhook_buffer_t *buffers = NULL;
+static uint32_t *thread_count = NULL;  /* shared with forked children */
+static bool finished = false;
+
+#pragma weak pthread_key_create
+#pragma weak pthread_setspecific
+
+static pthread_key_t buffer_key;
+static bool have_buffer_key = false;
+
+static inline void _lockbuffer(mhook_buffer_t *b)
+{
+  while(__atomic_exchange_n(&b->lock, 1, __ATOMIC_ACQUIRE)) {
+    while(__atomic_load_n(&b->lock, __ATOMIC_RELAXED)) { }
+  }
+}
+
+static inline void _unlockbuffer(mhook_buffer_t *b)
+{
+  __atomic_store_n(&b->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* the caller holds b's lock */
+static void _flushbuffer(mhook_buffer_t *b)
+{
+  if(b->writer.block.count > 0) {
+    _writebytes(&b->writer.block, mhook_block_size(&b->writer));
+    mhook_flushed(&b->writer);
+  }
+}
+
+/* gives b (empty) to the calling thread, as a new thread */
+static void _startbuffer(mhook_buffer_t *b)
+{
+  mhook_start(&b->writer, __atomic_fetch_add(thread_count, 1, __ATOMIC_RELAXED), syscall(SYS_gettid));
+  b->direct = __atomic_load_n(&finished, __ATOMIC_RELAXED);
+}
+
+static mhook_buffer_t *_threadbuffer(void)
+{
+  mhook_buffer_t *b = buffer;
+  int idle;
+
+  if(b == NULL) {
+    /* the buffer of a thread that has exited, if any */
+    for(b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b != NULL; b = b->next) {
+      idle = 1;
+      if(__atomic_load_n(&b->idle, __ATOMIC_RELAXED) &&
+         __atomic_compare_exchange_n(&b->idle, &idle, 0, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        break;
+      }
+    }
+    if(b != NULL) {
+      _lockbuffer(b);
+      _startbuffer(b);
+      _unlockbuffer(b);
+    } else {
+      b = mmap(NULL, sizeof(mhook_buffer_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(b == MAP_FAILED) {
+        exit(9);
+      }
+      _startbuffer(b);
+      b->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+      while(!__atomic_compare_exchange_n(&buffers, &b->next, b, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) { }
+    }
+    buffer = b;
+    if(have_buffer_key) {
+      pthread_setspecific(buffer_key, b);
+    }
+  }
+  return b;
+}
+
+/* the pthread_key_create destructor; what the thread logs from now on
+   (later destructors free things) is written out at once, without a buffer */
+static void _threadexit(void *arg)
+{
+  mhook_buffer_t *b = arg;
+
+  _lockbuffer(b);
+  _flushbuffer(b);
+  exited_thread = b->writer.block.thread;
+  exited_tid = b->writer.block.tid;
+  exited_seq = b->writer.block.seq;
+  _unlockbuffer(b);
+  exited = true;
+  buffer = NULL;
+  __atomic_store_n(&b->idle, 1, __ATOMIC_RELEASE);
+}
+
+static void _forkprepare(void)
+{
+  if(binary && logfd >= 0) {
+    mhook_buffer_t *b = _threadbuffer();
+    _lockbuffer(b);
+    _flushbuffer(b);
+  }
+}
+
+static void _forkparent(void)
+{
+  if(binary && logfd >= 0) {
+    _unlockbuffer(buffer);
+  }
+}
+
+/* the other threads stayed behind, so their buffers are idle (what
+   is left in them is the parent's to write); the child is a new thread */
+static void _forkchild(void)
+{
+  mhook_buffer_t *b;
+
+  if(binary && logfd >= 0) {
+    for(b = buffers; b != NULL; b = b->next) {
+      if(b != buffer) {
+        b->lock = 0;
+        b->writer.block.count = 0;
+        mhook_flushed(&b->writer);
+        b->idle = 1;
+      }
+    }
+    _startbuffer(buffer);
+    _unlockbuffer(buffer);
+  }
+}
+
+/* the timestamps of the binary format; 0 when we write text */
+static inline uint64_t _now(void)
+{
+  struct timespec now;
+
+  if(!binary) {
+    return 0;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void _fillrecord(mhook_record_t *r, char func, size_t size1, size_t size2, void *p, void *q, void *caller, uint64_t start, uint64_t end)
+{
+  memset(r, 0, sizeof(mhook_record_t));
+  r->op = func;
+  r->timestamp = start;
+  r->duration = end - start > UINT32_MAX ? UINT32_MAX : end - start;
+  r->size = size1;
+  r->size2 = size2;
+  r->ptr = (uintptr_t)p;
+  r->ptr2 = (uintptr_t)q;
+  r->caller = (uintptr_t)caller;
+}
+
+static void _writerecord(char func, size_t size1, size_t size2, void *p, void *q, void *caller, uint64_t start)
+{
+  struct {
+    mhook_block_t block;
+    uint8_t data[MHOOK_ENCODED_MAX];
+  } single;
+  mhook_buffer_t *b;
+  mhook_record_t r, prev;
+  uint64_t end;
+
+  if(logfd < 0){
+    return;
+  }
+
+  end = _now();
+  _fillrecord(&r, func, size1, size2, p, q, caller, start, end);
+  if(exited) {
+    /* a block of its own */
+    memset(&prev, 0, sizeof(prev));
+    single.block.thread = exited_thread;
+    single.block.tid = exited_tid;
+    single.block.seq = exited_seq++;
+    single.block.count = 1;
+    single.block.bytes = mhook_encode(single.data, &r, &prev) - single.data;
+    _writebytes(&single, sizeof(mhook_block_t) + single.block.bytes);
+    return;
+  }
+  b = _threadbuffer();
+
+  _lockbuffer(b);
+  if(mhook_append(&b->writer, &r) || b->direct) {
+    _flushbuffer(b);
+  }
+  _unlockbuffer(b);
+}
+
+static void _writelogentry(char func, size_t size1, size_t size2, void *p, void *q, void *caller, uint64_t start)
 {
   char buffer[] = { ' ', ' ', '0', 'x', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', 
 		         ' ', '0', 'x', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0',
@@ -51,7 +302,10 @@ static void _writelogentry(char func, size_t size1, size_t size2, void *p, void
 		         ' ', '0', 'x', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0',
 		    '\n' };
   int sz = sizeof(buffer) - 1;
-  int rcode;
+  if(binary) {
+    _writerecord(func, size1, size2, p, q, caller, start);
+    return;
+  }
   buffer[0] = func;
   switch (func) {
   case 'm':
@@ -93,20 +347,7 @@ static void _writelogentry(char func, size_t size1, size_t size2, void *p, void
   if(logfd < 0){
     return;
   }
-  rcode = write(logfd, buffer, sz+1);
-  if(rcode != sz+1) {
-    if(rcode < 0){
-      if(errno == EINTR){
-	exit(3);
-      } else if(errno == EBADF){
-	exit(5);
-      } else {
-	exit(errno);
-      }
-    } else  {
-      exit(7);
-    }
-  }
+  _writebytes(buffer, sz+1);
 }
 
 
@@ -114,14 +355,16 @@ static void*
 my_calloc_hook (size_t nemb, size_t size, void *caller)
 {
   void *result;
+  uint64_t start;
 
   // deactivate hooks for logging
   malloc_hook_active = 0;
 
+  start = _now();
   result = calloc(nemb, size);
 
   // do logging
-  _writelogentry('c', nemb, size, result, NULL, caller);
+  _writelogentry('c', nemb, size, result, NULL, caller, start);
 
   // reactivate hooks
   malloc_hook_active = 1;
@@ -132,14 +375,16 @@ my_calloc_hook (size_t nemb, size_t size, void *caller)
 static void* my_realloc_hook (void *p, size_t size, void *caller)
 {
   void *result;
+  uint64_t start;
 
   // deactivate hooks for logging
   malloc_hook_active = 0;
 
+  start = _now();
   result = realloc(p, size);
 
   // do logging
-  _writelogentry('r', size, 0, p, result, caller);
+  _writelogentry('r', size, 0, p, result, caller, start);
 
   // reactivate hooks
   malloc_hook_active = 1;
@@ -150,14 +395,16 @@ static void* my_realloc_hook (void *p, size_t size, void *caller)
 static void* my_malloc_hook (size_t size, void *caller)
 {
   void *result;
+  uint64_t start;
 
   // deactivate hooks for logging
   malloc_hook_active = 0;
 
+  start = _now();
   result = malloc(size);
 
   // do logging
-  _writelogentry('m', size, 0, result, NULL, caller);
+  _writelogentry('m', size, 0, result, NULL, caller, start);
 
   // reactivate hooks
   malloc_hook_active = 1;
@@ -167,13 +414,16 @@ static void* my_malloc_hook (size_t size, void *caller)
 
 static void my_free_hook(void *p, void *caller)
 {
+  uint64_t start;
+
   // deactivate hooks for logging
   malloc_hook_active = 0;
 
+  start = _now();
   free(p);
 
   // do logging
-  _writelogentry('f', 0, 0, p, NULL, caller);
+  _writelogentry('f', 0, 0, p, NULL, caller, start);
 
   // reactivate hooks
   malloc_hook_active = 1;
@@ -229,12 +479,29 @@ static void mhook_init (void)
 
   int fd;
   char *envname = secure_getenv("MHOOK");
+  char *format = secure_getenv("MHOOK_FORMAT");
+  mhook_header_t header;
   if (envname != NULL) {
     fd = open(envname, O_WRONLY | O_EXCL | O_CREAT | O_APPEND, 0600);
     if (fd > 0) {
       logfd = fd;
       ourfd = true;
-      _writelogentry('i', 0, 0, (void *)0, (void *)0, (void *)0);
+      if (format != NULL && strcmp(format, "binary") == 0) {
+        thread_count = mmap(NULL, sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (thread_count == MAP_FAILED) {
+          exit(9);
+        }
+        binary = true;
+        memcpy(header.magic, MHOOK_MAGIC, sizeof(header.magic));
+        header.version = MHOOK_VERSION;
+        header.record_size = sizeof(mhook_record_t);
+        _writebytes(&header, sizeof(header));
+        if (pthread_key_create != NULL && pthread_setspecific != NULL) {
+          have_buffer_key = pthread_key_create(&buffer_key, _threadexit) == 0;
+        }
+        pthread_atfork(_forkprepare, _forkparent, _forkchild);
+      }
+      _writelogentry('i', 0, 0, (void *)0, (void *)0, (void *)0, _now());
     }
   }
 }
@@ -246,8 +513,8 @@ __attribute__((section(".init_array"))) typeof(mhook_init) *__init = mhook_init;
    we want to keep the log file open until the exiting program
    finally returns to the kernel, which will clean up after us.
    As long as we're unbuffered, this is the right thing to do.
-   If we add buffering, we'll want to flush here, as it's the
-   last chance we'll get. The attribute line 
+   The binary format is buffered, so we flush every thread's
+   buffer here, as it's the last chance we'll get. The attribute line 
    runs later than if we use __attribute ((destructor)) 
    as part of the function definition.
 */
@@ -264,7 +531,19 @@ static void mhook_fini (void)
    can run on multiple inputs, we want to mark an exit call */
 
   if(ourfd > 0) {
-    _writelogentry('e', 0, 0, (void *)0, (void *)0, (void *)0);
+    if(binary) {
+      mhook_buffer_t *b;
+
+      /* the threads still running from now on write their records out at once */
+      __atomic_store_n(&finished, true, __ATOMIC_RELAXED);
+      for(b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b != NULL; b = b->next) {
+        _lockbuffer(b);
+        b->direct = true;
+        _flushbuffer(b);
+        _unlockbuffer(b);
+      }
+    }
+    _writelogentry('e', 0, 0, (void *)0, (void *)0, (void *)0, _now());
   }
 }
 
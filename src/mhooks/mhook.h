@@ -1,8 +1,267 @@
 #ifndef _MHOOK_H_
 #define _MHOOK_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
 enum mhooklen { MALLOCLEN = 58, FREELEN = 39, CALLOCLEN = 77, REALLOCLEN = 77, INITLEN = 5, FINILEN = 5 };
 
 enum mhookargs { MALLOCARGS = 3, FREEARGS  = 2, CALLOCARGS = 4, REALLOCARGS = 4 };
 
+/*
+ * The binary format (MHOOK_FORMAT=binary): an mhook_header_t followed by
+ * blocks. Each thread buffers its own records and writes them out a
+ * block at a time, so the records of different threads are interleaved
+ * block by block; within a thread they are in order (seq). mhconvert
+ * turns the binary format into the text one (merging the threads in
+ * mhook_order) and back.
+ *
+ * A block is an mhook_block_t, with the thread's number and id and the
+ * seq of its first record, followed by its records, each encoded (see
+ * mhook_encode) as its op and then just the fields the op has, as
+ * LEB128 varints: the timestamp, pointers and caller as the difference
+ * from those of the block's previous record (or the realloc's argument,
+ * for its result), which makes a record some 10 bytes rather than the
+ * 60 odd of a line of text. mhook_decode turns the blocks back into
+ * mhook_record_t's.
+ *
+ * The timestamp is taken as the call is made, and again as it returns.
+ * A call frees its argument somewhere in between, and its result only
+ * exists once it has returned, so ordering frees by the first and
+ * allocations (and reallocs) by the second puts every free of a block before whatever
+ * allocation reuses it, and every allocation before the free (in
+ * whatever thread) that gives it back. The exception is the block a
+ * realloc frees, which another thread can be handed before the realloc
+ * returns; the replay's loader sorts that out with the realloc's first
+ * timestamp. This needs no more shared state than the clock, so it is
+ * cheap enough to leave on.
+ */
+
+#define MHOOK_MAGIC    "MHOOKBIN"
+#define MHOOK_VERSION  3
+
+typedef struct mhook_header {
+  char magic[8];               /* MHOOK_MAGIC, without the NUL */
+  uint32_t version;            /* MHOOK_VERSION */
+  uint32_t record_size;        /* sizeof(mhook_record_t), what a record decodes to */
+} mhook_header_t;
+
+typedef struct mhook_block {
+  uint32_t thread;
+  uint32_t tid;
+  uint64_t seq;                /* of the block's first record */
+  uint32_t count;              /* the records */
+  uint32_t bytes;              /* they take, after the block */
+} mhook_block_t;
+
+typedef struct mhook_record {
+  uint8_t op;                  /* 'm', 'f', 'c', 'r', 'i' or 'e', as in the text format */
+  uint8_t pad[3];
+  uint32_t thread;             /* threads are numbered from 0 as they first log something */
+  uint64_t seq;                /* the thread's records are numbered from 0 */
+  uint64_t timestamp;          /* nanoseconds (CLOCK_MONOTONIC) when the call was made */
+  uint32_t duration;           /* nanoseconds until it returned, at most UINT32_MAX */
+  uint32_t tid;                /* the kernel's id of the thread */
+  uint64_t size;               /* malloc and realloc's size, calloc's count */
+  uint64_t size2;              /* calloc's size */
+  uint64_t ptr;                /* free and realloc's argument; malloc and calloc's result */
+  uint64_t ptr2;               /* realloc's result */
+  uint64_t caller;
+} mhook_record_t;
+
+/* the point in time the record is ordered at: frees as they are made, allocations as they return */
+static inline uint64_t mhook_order(const mhook_record_t* r){
+  return r->op == 'f' ? r->timestamp : r->timestamp + r->duration;
+}
+
+/* the most bytes a record is encoded in: its op and seven varints */
+#define MHOOK_ENCODED_MAX  (1 + 7 * 10)
+
+static inline uint8_t* mhook_put(uint8_t* out, uint64_t value){
+  while(value >= 0x80){
+    *out++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (uint8_t)value;
+  return out;
+}
+
+/* a difference, zigzagged so that small negative ones are small too */
+static inline uint8_t* mhook_put_delta(uint8_t* out, uint64_t value, uint64_t base){
+  int64_t delta = (int64_t)(value - base);
+  return mhook_put(out, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+}
+
+/* NULL if the varint runs past end */
+static inline const uint8_t* mhook_get(const uint8_t* in, const uint8_t* end, uint64_t* value){
+  uint64_t v = 0;
+  unsigned shift;
+
+  for(shift = 0; in < end && shift < 64; shift += 7){
+    v |= (uint64_t)(*in & 0x7F) << shift;
+    if((*in++ & 0x80) == 0){
+      *value = v;
+      return in;
+    }
+  }
+  return NULL;
+}
+
+static inline const uint8_t* mhook_get_delta(const uint8_t* in, const uint8_t* end, uint64_t base, uint64_t* value){
+  uint64_t zigzag;
+
+  in = mhook_get(in, end, &zigzag);
+  if(in != NULL){
+    *value = base + (uint64_t)((zigzag >> 1) ^ -(zigzag & 1));
+  }
+  return in;
+}
+
+/*
+ * Encodes r at out, after prev, the block's previous record (zeroed for
+ * the first), which it then becomes; returns the end of the encoding,
+ * at most MHOOK_ENCODED_MAX bytes on. The thread, tid and seq are the
+ * block's.
+ */
+static inline uint8_t* mhook_encode(uint8_t* out, const mhook_record_t* r, mhook_record_t* prev){
+  *out++ = r->op;
+  out = mhook_put_delta(out, r->timestamp, prev->timestamp);
+  out = mhook_put(out, r->duration);
+  switch(r->op){
+  case 'c':
+    out = mhook_put(out, r->size2);
+    /* fall through */
+  case 'm':
+  case 'r':
+    out = mhook_put(out, r->size);
+    /* fall through */
+  case 'f':
+    out = mhook_put_delta(out, r->ptr, prev->ptr);
+    if(r->op == 'r'){
+      out = mhook_put_delta(out, r->ptr2, r->ptr);
+    }
+    out = mhook_put_delta(out, r->caller, prev->caller);
+    prev->ptr = r->ptr;
+    prev->caller = r->caller;
+    break;
+  }
+  prev->timestamp = r->timestamp;
+  return out;
+}
+
+/* decodes a record of block at in, after prev (as in mhook_encode); NULL if it runs past end */
+static inline const uint8_t* mhook_decode(const uint8_t* in, const uint8_t* end, const mhook_block_t* block, uint32_t index,
+                                          mhook_record_t* r, mhook_record_t* prev){
+  uint64_t value = 0;
+
+  memset(r, 0, sizeof(mhook_record_t));
+  if(in == end){
+    return NULL;
+  }
+  r->op = *in++;
+  r->thread = block->thread;
+  r->tid = block->tid;
+  r->seq = block->seq + index;
+  in = mhook_get_delta(in, end, prev->timestamp, &r->timestamp);
+  if(in != NULL && (in = mhook_get(in, end, &value)) != NULL){
+    r->duration = value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+  }
+  switch(r->op){
+  case 'c':
+    if(in != NULL) in = mhook_get(in, end, &r->size2);
+    /* fall through */
+  case 'm':
+  case 'r':
+    if(in != NULL) in = mhook_get(in, end, &r->size);
+    /* fall through */
+  case 'f':
+    if(in != NULL) in = mhook_get_delta(in, end, prev->ptr, &r->ptr);
+    if(in != NULL && r->op == 'r') in = mhook_get_delta(in, end, r->ptr, &r->ptr2);
+    if(in != NULL) in = mhook_get_delta(in, end, prev->caller, &r->caller);
+    prev->ptr = r->ptr;
+    prev->caller = r->caller;
+    break;
+  }
+  prev->timestamp = r->timestamp;
+  return in;
+}
+
+/*
+ * A thread's block, as it is being written: its records are added with
+ * mhook_append, and when it is full (or whenever) the mhook_block_size
+ * bytes from &w->block are written out, and mhook_flushed starts the
+ * next block.
+ */
+#define MHOOK_BLOCK_BYTES  (64 * 1024)
+
+typedef struct mhook_writer {
+  mhook_block_t block;
+  uint8_t data[MHOOK_BLOCK_BYTES];     /* the block's records, encoded right after it */
+  mhook_record_t prev;                 /* for mhook_encode */
+} mhook_writer_t;
+
+static inline void mhook_flushed(mhook_writer_t* w){
+  w->block.seq += w->block.count;
+  w->block.count = 0;
+  w->block.bytes = 0;
+  memset(&w->prev, 0, sizeof(mhook_record_t));
+}
+
+static inline void mhook_start(mhook_writer_t* w, uint32_t thread, uint32_t tid){
+  w->block.thread = thread;
+  w->block.tid = tid;
+  w->block.seq = 0;
+  w->block.count = 0;
+  mhook_flushed(w);
+}
+
+/* true if w's block is full */
+static inline bool mhook_append(mhook_writer_t* w, const mhook_record_t* r){
+  w->block.bytes = mhook_encode(w->data + w->block.bytes, r, &w->prev) - w->data;
+  w->block.count++;
+  return w->block.bytes > MHOOK_BLOCK_BYTES - MHOOK_ENCODED_MAX;
+}
+
+static inline size_t mhook_block_size(const mhook_writer_t* w){
+  return sizeof(mhook_block_t) + w->block.bytes;
+}
+
+/*
+ * The records of the blocks in data (what follows the mhook_header_t)
+ * into records, when it is not NULL; returns how many there are, or
+ * SIZE_MAX if the blocks are cut short or garbled.
+ */
+static inline size_t mhook_decode_blocks(const uint8_t* data, size_t length, mhook_record_t* records){
+  const uint8_t* end = data + length;
+  const uint8_t* in;
+  mhook_block_t block;
+  mhook_record_t prev, r;
+  size_t count = 0;
+  uint32_t i;
+
+  while(data < end){
+    if((size_t)(end - data) < sizeof(mhook_block_t)){
+      return SIZE_MAX;
+    }
+    memcpy(&block, data, sizeof(mhook_block_t));
+    data += sizeof(mhook_block_t);
+    if(block.bytes > (size_t)(end - data)){
+      return SIZE_MAX;
+    }
+    if(records != NULL){
+      memset(&prev, 0, sizeof(prev));
+      for(in = data, i = 0; i < block.count; i++){
+        if((in = mhook_decode(in, data + block.bytes, &block, i, &r, &prev)) == NULL){
+          return SIZE_MAX;
+        }
+        records[count + i] = r;
+      }
+    }
+    count += block.count;
+    data += block.bytes;
+  }
+  return count;
+}
+
 #endif
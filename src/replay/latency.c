@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "latency.h"
+
+static const char* op_names[LATENCY_OPS] = { "malloc", "free", "calloc", "realloc" };
+
+static const char* class_names[LATENCY_CLASSES] = { "<= 64", "<= 512", "<= 4K", "<= 128K", "> 128K" };
+
+static const double percentiles[] = { 0.50, 0.90, 0.99, 0.999 };
+
+#define NPERCENTILES  (sizeof(percentiles) / sizeof(percentiles[0]))
+
+/* the nanoseconds in a tick, measured against CLOCK_MONOTONIC_RAW the first time it is needed */
+static double ns_per_tick(void){
+  static double ratio = 0;
+#if defined(__x86_64__) || defined(__i386__)
+  struct timespec begin, end, pause = { 0, 20000000 };
+  uint64_t start, ticks;
+  double ns;
+
+  if(ratio == 0){
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    start = latency_now();
+    nanosleep(&pause, NULL);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    ticks = latency_now() - start;
+    ns = (double)(end.tv_sec - begin.tv_sec) * 1e9 + (double)(end.tv_nsec - begin.tv_nsec);
+    ratio = ticks == 0 ? 1.0 : ns / ticks;
+  }
+#else
+  ratio = 1.0;
+#endif
+  return ratio;
+}
+
+/* the largest number of ticks that lands in the bucket */
+static uint64_t bucket_limit(unsigned bucket){
+  unsigned bits, sub;
+
+  if(bucket < LATENCY_EXACT){
+    return bucket;
+  }
+  bits = (bucket - LATENCY_EXACT) / (1 << LATENCY_SUBBITS) + 5;
+  sub = (bucket - LATENCY_EXACT) % (1 << LATENCY_SUBBITS);
+  return ((uint64_t)((1 << LATENCY_SUBBITS) + sub + 1) << (bits - LATENCY_SUBBITS)) - 1;
+}
+
+static uint64_t percentile(const latency_histogram_t* h, double fraction){
+  uint64_t rank, seen, limit;
+  unsigned bucket;
+
+  rank = (uint64_t)(fraction * h->count);
+  if(rank >= h->count){
+    rank = h->count - 1;
+  }
+  for(seen = 0, bucket = 0; bucket < LATENCY_BUCKETS; bucket++){
+    seen += h->buckets[bucket];
+    if(seen > rank){
+      break;
+    }
+  }
+  limit = bucket_limit(bucket);
+  return limit < h->max ? limit : h->max;
+}
+
+static void dump_histogram(FILE* fp, const char* name, const latency_histogram_t* h, double ratio){
+  size_t i;
+
+  if(h->count == 0){
+    return;
+  }
+  fprintf(fp, "%-12s %10" PRIu64 " %8.1f", name, h->count, ratio * h->total / h->count);
+  for(i = 0; i < NPERCENTILES; i++){
+    fprintf(fp, " %8.0f", ratio * percentile(h, percentiles[i]));
+  }
+  fprintf(fp, " %10.0f\n", ratio * h->max);
+}
+
+static void merge_histogram(latency_histogram_t* into, const latency_histogram_t* from){
+  unsigned bucket;
+
+  into->count += from->count;
+  into->total += from->total;
+  if(from->max > into->max){
+    into->max = from->max;
+  }
+  for(bucket = 0; bucket < LATENCY_BUCKETS; bucket++){
+    into->buckets[bucket] += from->buckets[bucket];
+  }
+}
+
+void latency_merge(latency_stats_t* into, const latency_stats_t* from){
+  unsigned op, class;
+
+  for(op = 0; op < LATENCY_OPS; op++){
+    merge_histogram(&into->ops[op], &from->ops[op]);
+    for(class = 0; class < LATENCY_CLASSES; class++){
+      merge_histogram(&into->classes[op][class], &from->classes[op][class]);
+    }
+  }
+}
+
+void dump_latency(FILE* fp, const latency_stats_t* stats){
+  char name[32];
+  unsigned op, class;
+  double ratio;
+
+  ratio = ns_per_tick();
+  fprintf(fp, "%-12s %10s %8s %8s %8s %8s %8s %10s\n", "latency ns", "calls", "mean", "p50", "p90", "p99", "p99.9", "max");
+  for(op = 0; op < LATENCY_OPS; op++){
+    dump_histogram(fp, op_names[op], &stats->ops[op], ratio);
+    for(class = 0; class < LATENCY_CLASSES; class++){
+      snprintf(name, sizeof(name), "  %s", class_names[class]);
+      dump_histogram(fp, name, &stats->classes[op][class], ratio);
+    }
+  }
+}
+
+void latency_summary(const latency_stats_t* stats, double summary[LATENCY_SUMMARY]){
+  latency_histogram_t all;
+  unsigned op;
+  size_t i;
+  double ratio;
+
+  memset(&all, 0, sizeof(all));
+  memset(summary, 0, LATENCY_SUMMARY * sizeof(double));
+  for(op = 0; op < LATENCY_OPS; op++){
+    merge_histogram(&all, &stats->ops[op]);
+  }
+  if(all.count == 0){
+    return;
+  }
+  ratio = ns_per_tick();
+  summary[0] = ratio * all.total / all.count;
+  for(i = 0; i < NPERCENTILES; i++){
+    summary[i + 1] = ratio * percentile(&all, percentiles[i]);
+  }
+  summary[LATENCY_SUMMARY - 1] = ratio * all.max;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _REPLAY_LATENCY
+#define _REPLAY_LATENCY
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Per call latency histograms for the replays.
+ *
+ * A call is timed with the time stamp counter (fenced, so the reads
+ * are not reordered around the call) where there is one, and with
+ * CLOCK_MONOTONIC_RAW elsewhere; clock() cannot tell one malloc from
+ * the next. The histograms are log-linear in the ticks: exact below
+ * 32, then 16 buckets between each power of two and the next, so a
+ * percentile is within 1/16th of the truth, and a pause of many
+ * milliseconds (a consolidation, a table expansion) still has a bucket
+ * of its own. Ticks are turned into nanoseconds only when printed.
+ *
+ * There is one histogram per kind of call, and for malloc, calloc and
+ * realloc one per size class of the request as well.
+ */
+
+enum latency_op { LATENCY_MALLOC, LATENCY_FREE, LATENCY_CALLOC, LATENCY_REALLOC, LATENCY_OPS };
+
+#define LATENCY_EXACT     32
+#define LATENCY_SUBBITS   4
+#define LATENCY_BUCKETS   (LATENCY_EXACT + (64 - 5) * (1 << LATENCY_SUBBITS))
+
+/* requests of at most 64, 512, 4K and 128K bytes, and the rest */
+#define LATENCY_CLASSES   5
+
+/* the size of a free, which the replays do not know */
+#define LATENCY_NOSIZE    SIZE_MAX
+
+typedef struct latency_histogram {
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint64_t buckets[LATENCY_BUCKETS];
+} latency_histogram_t;
+
+typedef struct latency_stats {
+  latency_histogram_t ops[LATENCY_OPS];
+  latency_histogram_t classes[LATENCY_OPS][LATENCY_CLASSES];
+} latency_stats_t;
+
+static inline uint64_t latency_now(void){
+#if defined(__x86_64__) || defined(__i386__)
+  uint32_t lo, hi;
+
+  __asm__ __volatile__ ("lfence\n\trdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+  return ((uint64_t)hi << 32) | lo;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline unsigned latency_bucket(uint64_t ticks){
+  unsigned bits;
+
+  if(ticks < LATENCY_EXACT){
+    return ticks;
+  }
+  bits = 63 - __builtin_clzll(ticks);
+  return LATENCY_EXACT + (bits - 5) * (1 << LATENCY_SUBBITS) + ((ticks >> (bits - LATENCY_SUBBITS)) & ((1 << LATENCY_SUBBITS) - 1));
+}
+
+static inline unsigned latency_class(size_t size){
+  if(size <= 64) return 0;
+  if(size <= 512) return 1;
+  if(size <= 4096) return 2;
+  if(size <= 128 * 1024) return 3;
+  return 4;
+}
+
+static inline void latency_add(latency_histogram_t* h, uint64_t ticks){
+  h->count++;
+  h->total += ticks;
+  if(ticks > h->max){
+    h->max = ticks;
+  }
+  h->buckets[latency_bucket(ticks)]++;
+}
+
+/* records a call that took the ticks since start */
+static inline void latency_record(latency_stats_t* stats, enum latency_op op, size_t size, uint64_t start){
+  uint64_t ticks = latency_now() - start;
+
+  latency_add(&stats->ops[op], ticks);
+  if(size != LATENCY_NOSIZE){
+    latency_add(&stats->classes[op][latency_class(size)], ticks);
+  }
+}
+
+extern void latency_merge(latency_stats_t* into, const latency_stats_t* from);
+
+/* a table of calls, mean, p50, p90, p99, p99.9 and max, in nanoseconds */
+extern void dump_latency(FILE* fp, const latency_stats_t* stats);
+
+/* over all the calls: the mean, p50, p90, p99, p99.9 and max, in nanoseconds */
+#define LATENCY_SUMMARY  6
+
+extern void latency_summary(const latency_stats_t* stats, double summary[LATENCY_SUMMARY]);
+
+#endif
@@ -0,0 +1,894 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mhook.h"
+
+#include "replayops.h"
+
+/*
+ *  Summarizes the pattern of allocation in a trace, text or binary, as
+ *  analysis/parse_data does, and more, without loading it:
+ *
+ *  manalyze [-j jobs] [-n top] <mhook output file>...
+ *
+ *  It reports the calls of each kind, the sizes asked for (by log2, and
+ *  the most frequent ones), the peak of the live bytes and blocks, the
+ *  lifetimes of the blocks in calls (following them through reallocs),
+ *  the reallocs and their chains, and the bytes allocated by each call
+ *  site. A file of - is stdin, so that a compressed text trace can be
+ *  piped in.
+ *
+ *  A text trace is read a window at a time. Each window is cut into a
+ *  chunk per job (at line ends), the jobs parse their chunks and count
+ *  what does not depend on the order of the calls in parallel, while
+ *  the calls of the window before are followed in order, which only takes
+ *  looking up their addresses. A binary trace is mapped and decoded; its records are
+ *  counted in parallel, while they are followed merged in mhook_order
+ *  (see mhook.h).
+ *
+ */
+
+/* the bytes of text each job parses at a time */
+#define CHUNK      (16 * 1024 * 1024)
+
+#define LOG2S      65
+
+#define DEFAULT_TOP  20
+
+enum kind { MALLOC, CALLOC, REALLOC, FREE, FREE_NULL, OTHER, MALFORMED, KINDS };
+
+static const char* kind_names[KINDS] = { "malloc", "calloc", "realloc", "free", "free(NULL)", "other", "malformed" };
+
+typedef struct call {
+  uint8_t op;
+  uint64_t size;               /* the bytes asked for: calloc's product, realloc's new size */
+  uint64_t ptr;                /* free and realloc's argument; malloc and calloc's result */
+  uint64_t ptr2;               /* realloc's result */
+  uint64_t caller;
+} call_t;
+
+/* counts keyed by size or by caller, in an open addressed table */
+typedef struct counter {
+  uint64_t key;
+  uint64_t calls;              /* zero for an empty entry */
+  uint64_t bytes;
+} counter_t;
+
+typedef struct counters {
+  size_t count;
+  size_t capacity;             /* a power of two */
+  counter_t* entries;
+} counters_t;
+
+/* what does not depend on the order of the calls */
+typedef struct tally {
+  uint64_t kinds[KINDS];
+  uint64_t bytes[KINDS];       /* asked for */
+  uint64_t size_log2[LOG2S];
+  counters_t sizes;
+  counters_t callers;
+} tally_t;
+
+/* a live block */
+typedef struct block {
+  uint64_t ptr;                /* zero for an empty entry */
+  uint64_t size;
+  uint64_t birth;              /* the call that allocated it, before any realloc */
+  uint64_t reallocs;
+} block_t;
+
+/* what does: the calls followed in order */
+typedef struct state {
+  uint64_t calls;
+  /* the live blocks, in an open addressed table */
+  size_t count;
+  size_t capacity;
+  block_t* blocks;
+  uint64_t live_bytes;
+  uint64_t peak_bytes;
+  uint64_t peak_bytes_at;
+  uint64_t peak_blocks;
+  uint64_t peak_blocks_at;
+  uint64_t unknown_frees;      /* of blocks allocated before the trace started */
+  uint64_t failed;             /* allocations that returned NULL */
+  uint64_t lifetime_log2[LOG2S];
+  /* the reallocs */
+  uint64_t in_place;
+  uint64_t moved;
+  uint64_t grown;
+  uint64_t shrunk;
+  uint64_t from_null;
+  uint64_t to_zero;
+  uint64_t chain_log2[LOG2S];  /* the reallocs a block went through, of those that went through any */
+  uint64_t longest_chain;
+} state_t;
+
+/* the calls of a chunk of text, in order */
+typedef struct batch {
+  call_t* calls;
+  size_t count;
+  size_t capacity;
+} batch_t;
+
+/*
+ * A job: a chunk of text, or a range of records, to parse and count. A
+ * job has two batches, so that the calls of one window can be followed
+ * while those of the next are parsed.
+ */
+typedef struct job {
+  pthread_t thread;
+  const char* text;
+  size_t length;
+  const mhook_record_t* records;
+  size_t count;
+  batch_t batches[2];
+  batch_t* batch;              /* the one being parsed into */
+  tally_t tally;
+  bool failed;
+} job_t;
+
+static inline unsigned log2_of(uint64_t value){
+  return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+
+static inline size_t hash_of(uint64_t key, size_t capacity){
+  return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
+/*
+ * Blocks allocated one after the other are mostly next to each other,
+ * and so are their entries: the bits of the address above the table's
+ * are only folded in, to spread the heaps and the mmapped blocks.
+ */
+static inline size_t block_hash(uint64_t ptr, size_t capacity){
+  uint64_t key = ptr >> 4;
+
+  return (size_t)(key ^ (key >> 20) ^ (key >> 40)) & (capacity - 1);
+}
+
+static bool init_counters(counters_t* c, size_t capacity){
+  c->count = 0;
+  c->capacity = capacity;
+  c->entries = calloc(capacity, sizeof(counter_t));
+  return c->entries != NULL;
+}
+
+static bool count_key(counters_t* c, uint64_t key, uint64_t calls, uint64_t bytes);
+
+static bool grow_counters(counters_t* c){
+  counters_t bigger;
+  size_t i;
+
+  if(!init_counters(&bigger, 2 * c->capacity)){
+    return false;
+  }
+  for(i = 0; i < c->capacity; i++){
+    if(c->entries[i].calls != 0){
+      count_key(&bigger, c->entries[i].key, c->entries[i].calls, c->entries[i].bytes);
+    }
+  }
+  free(c->entries);
+  *c = bigger;
+  return true;
+}
+
+static bool count_key(counters_t* c, uint64_t key, uint64_t calls, uint64_t bytes){
+  size_t i;
+
+  if(2 * (c->count + 1) > c->capacity && !grow_counters(c)){
+    return false;
+  }
+  for(i = hash_of(key, c->capacity); c->entries[i].calls != 0; i = (i + 1) & (c->capacity - 1)){
+    if(c->entries[i].key == key){
+      c->entries[i].calls += calls;
+      c->entries[i].bytes += bytes;
+      return true;
+    }
+  }
+  c->entries[i].key = key;
+  c->entries[i].calls = calls;
+  c->entries[i].bytes = bytes;
+  c->count++;
+  return true;
+}
+
+static bool init_tally(tally_t* t){
+  memset(t, 0, sizeof(tally_t));
+  return init_counters(&t->sizes, 1024) && init_counters(&t->callers, 1024);
+}
+
+static void delete_tally(tally_t* t){
+  free(t->sizes.entries);
+  free(t->callers.entries);
+}
+
+static bool merge_tally(tally_t* into, const tally_t* from){
+  const counters_t* c;
+  size_t i;
+
+  for(i = 0; i < KINDS; i++){
+    into->kinds[i] += from->kinds[i];
+    into->bytes[i] += from->bytes[i];
+  }
+  for(i = 0; i < LOG2S; i++){
+    into->size_log2[i] += from->size_log2[i];
+  }
+  for(c = &from->sizes, i = 0; i < c->capacity; i++){
+    if(c->entries[i].calls != 0 && !count_key(&into->sizes, c->entries[i].key, c->entries[i].calls, c->entries[i].bytes)){
+      return false;
+    }
+  }
+  for(c = &from->callers, i = 0; i < c->capacity; i++){
+    if(c->entries[i].calls != 0 && !count_key(&into->callers, c->entries[i].key, c->entries[i].calls, c->entries[i].bytes)){
+      return false;
+    }
+  }
+  return true;
+}
+
+/* turns a record into a call; false for one that is not */
+static bool to_call(const mhook_record_t* r, call_t* call){
+  call->op = r->op;
+  call->ptr = r->ptr;
+  call->ptr2 = r->ptr2;
+  call->caller = r->caller;
+  switch(r->op){
+  case 'm':
+  case 'r':
+    call->size = r->size;
+    return true;
+  case 'c':
+    call->size = r->size * r->size2;
+    return true;
+  case 'f':
+    call->size = 0;
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool tally_call(tally_t* t, const call_t* call){
+  enum kind kind;
+
+  switch(call->op){
+  case 'm': kind = MALLOC; break;
+  case 'c': kind = CALLOC; break;
+  case 'r': kind = REALLOC; break;
+  default:
+    t->kinds[call->ptr == 0 ? FREE_NULL : FREE]++;
+    return true;
+  }
+  t->kinds[kind]++;
+  t->bytes[kind] += call->size;
+  t->size_log2[log2_of(call->size)]++;
+  return count_key(&t->sizes, call->size, 1, call->size) && count_key(&t->callers, call->caller, 1, call->size);
+}
+
+static bool add_batch_call(batch_t* batch, const call_t* call){
+  call_t* calls;
+
+  if(batch->count == batch->capacity){
+    batch->capacity = batch->capacity == 0 ? 64 * 1024 : 2 * batch->capacity;
+    calls = realloc(batch->calls, batch->capacity * sizeof(call_t));
+    if(calls == NULL){
+      return false;
+    }
+    batch->calls = calls;
+  }
+  batch->calls[batch->count++] = *call;
+  return true;
+}
+
+/* parses and counts a job's chunk of text, or counts its records */
+static void* run_job(void* arg){
+  job_t* job = arg;
+  const char* end = job->text + job->length;
+  const char* line;
+  const char* eol;
+  mhook_record_t r;
+  call_t call;
+  size_t index;
+
+  for(line = job->text; line < end; line = eol + 1){
+    eol = memchr(line, '\n', end - line);
+    if(eol == NULL){
+      eol = end;
+    }
+    if(eol == line){
+      continue;
+    }
+    if(!parse_trace_line(line, eol, &r)){
+      job->tally.kinds[MALFORMED]++;
+    } else if(!to_call(&r, &call)){
+      job->tally.kinds[OTHER]++;
+    } else if(!tally_call(&job->tally, &call) || !add_batch_call(job->batch, &call)){
+      job->failed = true;
+      return NULL;
+    }
+  }
+  for(index = 0; index < job->count; index++){
+    if(!to_call(&job->records[index], &call)){
+      job->tally.kinds[OTHER]++;
+    } else if(!tally_call(&job->tally, &call)){
+      job->failed = true;
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+/* starts the jobs, each in a thread of its own; how many were started */
+static size_t start_jobs(job_t* jobs, size_t njobs){
+  size_t i;
+
+  for(i = 0; i < njobs; i++){
+    if(pthread_create(&jobs[i].thread, NULL, run_job, &jobs[i]) != 0){
+      fprintf(stderr, "Could not create a thread: %s\n", strerror(errno));
+      break;
+    }
+  }
+  return i;
+}
+
+/* waits for the started jobs; false if any failed, or any was not started */
+static bool join_jobs(job_t* jobs, size_t njobs, size_t started){
+  bool retval = started == njobs;
+  size_t i;
+
+  for(i = 0; i < started; i++){
+    pthread_join(jobs[i].thread, NULL);
+    if(jobs[i].failed){
+      fprintf(stderr, "Out of memory\n");
+      retval = false;
+    }
+  }
+  return retval;
+}
+
+/* the live blocks */
+
+static block_t* find_block(state_t* s, uint64_t ptr){
+  size_t i;
+
+  for(i = block_hash(ptr, s->capacity); s->blocks[i].ptr != 0; i = (i + 1) & (s->capacity - 1)){
+    if(s->blocks[i].ptr == ptr){
+      return &s->blocks[i];
+    }
+  }
+  return NULL;
+}
+
+/* the entry for ptr, empty if it was not there */
+static block_t* insert_block(state_t* s, uint64_t ptr){
+  block_t* blocks;
+  size_t i, j, capacity;
+
+  if(2 * (s->count + 1) > s->capacity){
+    blocks = s->blocks;
+    capacity = s->capacity;
+    s->capacity = capacity == 0 ? 64 * 1024 : 2 * capacity;
+    s->blocks = calloc(s->capacity, sizeof(block_t));
+    if(s->blocks == NULL){
+      s->blocks = blocks;
+      s->capacity = capacity;
+      return NULL;
+    }
+    for(j = 0; j < capacity; j++){
+      if(blocks[j].ptr != 0){
+        for(i = block_hash(blocks[j].ptr, s->capacity); s->blocks[i].ptr != 0; i = (i + 1) & (s->capacity - 1));
+        s->blocks[i] = blocks[j];
+      }
+    }
+    free(blocks);
+  }
+  for(i = block_hash(ptr, s->capacity); s->blocks[i].ptr != 0; i = (i + 1) & (s->capacity - 1)){
+    if(s->blocks[i].ptr == ptr){
+      return &s->blocks[i];
+    }
+  }
+  s->count++;
+  return &s->blocks[i];
+}
+
+/* removes the entry b, moving back those after it that would no longer be found */
+static void remove_block(state_t* s, block_t* b){
+  size_t i = b - s->blocks, j = i, home;
+
+  for(;;){
+    s->blocks[i].ptr = 0;
+    do {
+      j = (j + 1) & (s->capacity - 1);
+      if(s->blocks[j].ptr == 0){
+        s->count--;
+        return;
+      }
+      home = block_hash(s->blocks[j].ptr, s->capacity);
+    } while(i <= j ? (i < home && home <= j) : (i < home || home <= j));
+    s->blocks[i] = s->blocks[j];
+    i = j;
+  }
+}
+
+static void end_block(state_t* s, block_t* b){
+  s->lifetime_log2[log2_of(s->calls - b->birth)]++;
+  if(b->reallocs > 0){
+    s->chain_log2[log2_of(b->reallocs)]++;
+    if(b->reallocs > s->longest_chain){
+      s->longest_chain = b->reallocs;
+    }
+  }
+  s->live_bytes -= b->size;
+  remove_block(s, b);
+}
+
+static bool start_block(state_t* s, uint64_t ptr, uint64_t size, uint64_t birth, uint64_t reallocs){
+  block_t* b = insert_block(s, ptr);
+
+  if(b == NULL){
+    return false;
+  }
+  if(b->ptr != 0){
+    /* allocated again without having been freed: a free the trace missed */
+    s->live_bytes -= b->size;
+  }
+  b->ptr = ptr;
+  b->size = size;
+  b->birth = birth;
+  b->reallocs = reallocs;
+  s->live_bytes += size;
+  if(s->live_bytes > s->peak_bytes){
+    s->peak_bytes = s->live_bytes;
+    s->peak_bytes_at = s->calls;
+  }
+  if(s->count > s->peak_blocks){
+    s->peak_blocks = s->count;
+    s->peak_blocks_at = s->calls;
+  }
+  return true;
+}
+
+static bool follow_call(state_t* s, const call_t* call){
+  block_t* b;
+  uint64_t birth, reallocs, size;
+  bool retval = true;
+
+  switch(call->op){
+  case 'm':
+  case 'c':
+    if(call->ptr == 0){
+      s->failed++;
+    } else {
+      retval = start_block(s, call->ptr, call->size, s->calls, 0);
+    }
+    break;
+  case 'f':
+    if(call->ptr != 0){
+      if((b = find_block(s, call->ptr)) != NULL){
+        end_block(s, b);
+      } else {
+        s->unknown_frees++;
+      }
+    }
+    break;
+  case 'r':
+    b = call->ptr == 0 ? NULL : find_block(s, call->ptr);
+    if(call->ptr == 0){
+      s->from_null++;
+    } else if(b == NULL){
+      s->unknown_frees++;
+    }
+    if(call->ptr2 == 0){
+      if(call->size == 0){
+        s->to_zero++;
+        if(b != NULL){
+          end_block(s, b);
+        }
+      } else {
+        s->failed++;
+      }
+      break;
+    }
+    birth = s->calls;
+    reallocs = 1;
+    if(b != NULL){
+      size = b->size;
+      birth = b->birth;
+      reallocs = b->reallocs + 1;
+      s->grown += call->size > size;
+      s->shrunk += call->size < size;
+      s->live_bytes -= size;
+      remove_block(s, b);
+    }
+    if(call->ptr != 0){
+      if(call->ptr == call->ptr2){
+        s->in_place++;
+      } else {
+        s->moved++;
+      }
+    }
+    retval = start_block(s, call->ptr2, call->size, birth, reallocs);
+    break;
+  }
+  s->calls++;
+  if(!retval){
+    fprintf(stderr, "Out of memory\n");
+  }
+  return retval;
+}
+
+static void binary_call(const mhook_record_t* r, uint32_t thread, void* arg){
+  state_t* s = arg;
+  call_t call;
+
+  (void)thread;
+  if(to_call(r, &call)){
+    follow_call(s, &call);
+  }
+}
+
+/* the largest first */
+static int compare_bytes(const void* a, const void* b){
+  const counter_t* x = a;
+  const counter_t* y = b;
+
+  return x->bytes > y->bytes ? -1 : x->bytes < y->bytes;
+}
+
+/* the most frequent first */
+static int compare_calls(const void* a, const void* b){
+  const counter_t* x = a;
+  const counter_t* y = b;
+
+  return x->calls > y->calls ? -1 : x->calls < y->calls;
+}
+
+/* the top entries of c, keyed in hex (callers) or not (sizes) */
+static void dump_top(FILE* fp, const char* title, const counters_t* c, size_t top,
+                     int (*compare)(const void*, const void*), uint64_t total, bool hex){
+  counter_t* sorted;
+  size_t i, n;
+
+  sorted = malloc((c->count + 1) * sizeof(counter_t));
+  if(sorted == NULL){
+    return;
+  }
+  for(n = 0, i = 0; i < c->capacity; i++){
+    if(c->entries[i].calls != 0){
+      sorted[n++] = c->entries[i];
+    }
+  }
+  qsort(sorted, n, sizeof(counter_t), compare);
+  fprintf(fp, "%-18s %12s %16s %8s   (%zu in all)\n", title, "calls", "bytes", "% bytes", n);
+  for(i = 0; i < n && i < top; i++){
+    if(hex){
+      fprintf(fp, "0x%016" PRIx64, sorted[i].key);
+    } else {
+      fprintf(fp, "%18" PRIu64, sorted[i].key);
+    }
+    fprintf(fp, " %12" PRIu64 " %16" PRIu64 " %8.2f\n", sorted[i].calls, sorted[i].bytes,
+            total == 0 ? 0.0 : 100.0 * sorted[i].bytes / total);
+  }
+  free(sorted);
+}
+
+static void dump_log2(FILE* fp, const char* title, const uint64_t histogram[LOG2S]){
+  unsigned k;
+
+  fprintf(fp, "%s\n", title);
+  for(k = 0; k < LOG2S; k++){
+    if(histogram[k] != 0){
+      fprintf(fp, "%20" PRIu64 " %12" PRIu64 "\n", k == 0 ? 0 : (uint64_t)1 << (k - 1), histogram[k]);
+    }
+  }
+}
+
+static void dump_analysis(FILE* fp, const char* filename, const tally_t* t, const state_t* s, size_t top){
+  uint64_t total;
+  unsigned i;
+
+  fprintf(fp, "%s: %" PRIu64 " calls\n", filename, s->calls);
+  fprintf(fp, "%-18s %12s %16s\n", "kind", "calls", "bytes");
+  for(i = 0; i < KINDS; i++){
+    fprintf(fp, "%-18s %12" PRIu64, kind_names[i], t->kinds[i]);
+    if(i <= REALLOC){
+      fprintf(fp, " %16" PRIu64, t->bytes[i]);
+    }
+    fprintf(fp, "\n");
+  }
+  fprintf(fp, "%-18s %12" PRIu64 "\n", "unknown frees", s->unknown_frees);
+  fprintf(fp, "%-18s %12" PRIu64 "\n", "failed", s->failed);
+  total = t->bytes[MALLOC] + t->bytes[CALLOC] + t->bytes[REALLOC];
+
+  dump_log2(fp, "sizes (at least)", t->size_log2);
+  dump_top(fp, "size", &t->sizes, top, compare_calls, total, false);
+
+  fprintf(fp, "peak live bytes    %16" PRIu64 " at call %" PRIu64 "\n", s->peak_bytes, s->peak_bytes_at);
+  fprintf(fp, "peak live blocks   %16" PRIu64 " at call %" PRIu64 "\n", s->peak_blocks, s->peak_blocks_at);
+  fprintf(fp, "live at the end    %16" PRIu64 " bytes in %zu blocks\n", s->live_bytes, s->count);
+
+  dump_log2(fp, "lifetimes in calls (at least), of the blocks freed", s->lifetime_log2);
+
+  fprintf(fp, "reallocs: %" PRIu64 " in place, %" PRIu64 " moved, %" PRIu64 " grown, %" PRIu64 " shrunk, "
+          "%" PRIu64 " of NULL, %" PRIu64 " to 0\n",
+          s->in_place, s->moved, s->grown, s->shrunk, s->from_null, s->to_zero);
+  fprintf(fp, "longest realloc chain %" PRIu64 "\n", s->longest_chain);
+  dump_log2(fp, "realloc chains (at least), of the blocks freed", s->chain_log2);
+
+  dump_top(fp, "call site", &t->callers, top, compare_bytes, total, true);
+}
+
+/* follows the calls of the jobs' batches, which are those of a window */
+static bool follow_batches(job_t* jobs, size_t njobs, unsigned which, state_t* s){
+  batch_t* batch;
+  size_t i, j;
+
+  for(i = 0; i < njobs; i++){
+    batch = &jobs[i].batches[which];
+    for(j = 0; j < batch->count; j++){
+      if(!follow_call(s, &batch->calls[j])){
+        return false;
+      }
+    }
+    batch->count = 0;
+  }
+  return true;
+}
+
+/*
+ * A text trace, a window at a time: the calls of the last window are
+ * followed while the jobs parse the next one, into their other batches,
+ * from the other buffer.
+ */
+static bool analyze_text(const char* filename, int fd, job_t* jobs, size_t njobs, state_t* s){
+  size_t window = njobs * CHUNK;
+  size_t filled, cut, start, started, i, j;
+  char* buffers[2];
+  char* buffer;
+  unsigned which;
+  ssize_t got;
+  bool eof, pending, retval;
+
+  buffers[0] = mmap(NULL, 2 * window, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(buffers[0] == MAP_FAILED){
+    fprintf(stderr, "Out of memory\n");
+    return false;
+  }
+  buffers[1] = buffers[0] + window;
+
+  retval = true;
+  pending = false;
+  filled = 0;
+  eof = false;
+  for(which = 0; retval && !eof; which ^= 1){
+    buffer = buffers[which];
+    while(filled < window && (got = read(fd, buffer + filled, window - filled)) != 0){
+      if(got < 0){
+        if(errno == EINTR){
+          continue;
+        }
+        fprintf(stderr, "Could not read: %s\n", strerror(errno));
+        retval = false;
+        break;
+      }
+      filled += got;
+    }
+    eof = filled < window;
+    if(!retval || filled == 0){
+      break;
+    }
+    if(!pending && filled >= sizeof(MHOOK_MAGIC) - 1 && memcmp(buffer, MHOOK_MAGIC, sizeof(MHOOK_MAGIC) - 1) == 0){
+      fprintf(stderr, "%s is a binary trace, which has to be a file\n", filename);
+      retval = false;
+      break;
+    }
+
+    /* the window ends at its last line end, unless it is the last */
+    cut = filled;
+    if(!eof){
+      while(cut > 0 && buffer[cut - 1] != '\n'){
+        cut--;
+      }
+      if(cut == 0){
+        fprintf(stderr, "A line is longer than %zu bytes\n", window);
+        retval = false;
+        break;
+      }
+    }
+
+    for(start = 0, i = 0; i < njobs; i++){
+      j = i + 1 == njobs ? cut : start + (cut - start) / (njobs - i);
+      /* a job may get nothing, when there are more jobs than bytes */
+      while(j > start && j < cut && buffer[j - 1] != '\n'){
+        j++;
+      }
+      jobs[i].text = buffer + start;
+      jobs[i].length = j - start;
+      jobs[i].batch = &jobs[i].batches[which];
+      start = j;
+    }
+    started = start_jobs(jobs, njobs);
+
+    if(pending){
+      retval = follow_batches(jobs, njobs, which ^ 1, s);
+    }
+    retval = join_jobs(jobs, njobs, started) && retval;
+    pending = true;
+
+    /* the rest of a line goes to the other buffer */
+    memcpy(buffers[which ^ 1], buffer + cut, filled - cut);
+    filled -= cut;
+  }
+
+  if(retval && pending){
+    retval = follow_batches(jobs, njobs, which ^ 1, s);
+  }
+
+  munmap(buffers[0], 2 * window);
+  return retval;
+}
+
+/* a binary trace, mapped */
+static bool analyze_binary(const char* filename, int fd, job_t* jobs, size_t njobs, state_t* s){
+  mhook_record_t* records;
+  struct stat sb;
+  size_t count, start, started, i;
+  void* map;
+  bool retval;
+
+  if(fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)){
+    fprintf(stderr, "%s is a binary trace, which has to be a file\n", filename);
+    return false;
+  }
+  if(sb.st_size < (off_t)sizeof(mhook_header_t)){
+    fprintf(stderr, "%s is truncated\n", filename);
+    return false;
+  }
+  map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(map == MAP_FAILED){
+    fprintf(stderr, "Could not map %s: %s\n", filename, strerror(errno));
+    return false;
+  }
+  records = decode_trace(filename, map, sb.st_size, &count);
+  munmap(map, sb.st_size);
+  if(records == NULL){
+    return false;
+  }
+
+  for(start = 0, i = 0; i < njobs; i++){
+    jobs[i].records = records + start;
+    jobs[i].count = (count - start) / (njobs - i);
+    start += jobs[i].count;
+  }
+  /* the records are followed while they are counted */
+  started = start_jobs(jobs, njobs);
+  retval = merge_trace(records, count, binary_call, s);
+  retval = join_jobs(jobs, njobs, started) && retval;
+
+  delete_records(records, count);
+  return retval;
+}
+
+static bool analyze(const char* filename, size_t njobs, size_t top){
+  char magic[sizeof(((mhook_header_t*)0)->magic)];
+  job_t* jobs;
+  tally_t tally;
+  state_t state;
+  size_t got, i;
+  bool retval;
+  int fd;
+
+  fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+  if(fd < 0){
+    fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+    return false;
+  }
+
+  memset(&state, 0, sizeof(state_t));
+  jobs = calloc(njobs, sizeof(job_t));
+  retval = jobs != NULL && init_tally(&tally);
+  for(i = 0; retval && i < njobs; i++){
+    retval = init_tally(&jobs[i].tally);
+  }
+  if(!retval){
+    fprintf(stderr, "Out of memory\n");
+    goto exit;
+  }
+
+  /* a binary trace starts with its magic; a text one with a line that does not */
+  got = 0;
+  if(fd != STDIN_FILENO){
+    got = pread(fd, magic, sizeof(magic), 0);
+  }
+  if(got == sizeof(magic) && memcmp(magic, MHOOK_MAGIC, sizeof(magic)) == 0){
+    retval = analyze_binary(filename, fd, jobs, njobs, &state);
+  } else {
+    retval = analyze_text(filename, fd, jobs, njobs, &state);
+  }
+
+  for(i = 0; retval && i < njobs; i++){
+    retval = merge_tally(&tally, &jobs[i].tally);
+  }
+  if(retval){
+    dump_analysis(stdout, filename, &tally, &state, top);
+  }
+
+ exit:
+  for(i = 0; jobs != NULL && i < njobs; i++){
+    delete_tally(&jobs[i].tally);
+    free(jobs[i].batches[0].calls);
+    free(jobs[i].batches[1].calls);
+  }
+  free(jobs);
+  delete_tally(&tally);
+  free(state.blocks);
+  if(fd != STDIN_FILENO){
+    close(fd);
+  }
+  return retval;
+}
+
+static void usage(const char* name){
+  fprintf(stdout, "Usage: %s [-j jobs] [-n top] <mhook output file>...\n", name);
+}
+
+int main(int argc, char* argv[]){
+  long njobs, top;
+  int opt, code;
+
+  njobs = sysconf(_SC_NPROCESSORS_ONLN);
+  top = DEFAULT_TOP;
+  while((opt = getopt(argc, argv, "j:n:")) != -1){
+    switch(opt){
+    case 'j':
+      njobs = strtol(optarg, NULL, 0);
+      break;
+    case 'n':
+      top = strtol(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if(optind == argc || njobs < 1 || top < 0){
+    usage(argv[0]);
+    return 1;
+  }
+
+  code = 0;
+  for(; optind < argc; optind++){
+    if(!analyze(argv[optind], njobs, top)){
+      code = 1;
+    }
+  }
+  return code;
+}
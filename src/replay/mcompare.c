@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/*
+ *  Compares allocators on the same traces, each replayed (with replay -s,
+ *  so parsed before it is run) in a child process of its own:
+ *
+ *  mcompare [-r runs] [-x replay] -a name=allocator[@replay] ... trace ...
+ *
+ *  where an allocator is one of
+ *
+ *    system          the replay as it is linked (the system's glibc);
+ *    ld:<loader>     a glibc build, run with its dynamic linker (e.g.
+ *                    build/glibc-install/lib/ld-2.23.90.so), and the
+ *                    libraries beside it;
+ *    <library>       a shared library, LD_PRELOADed (jemalloc, tcmalloc, ...).
+ *
+ *  An allocator runs the -x replay (./replay by default) unless it names
+ *  one of its own after an @: a glibc build's loader can only load a
+ *  replay built against that glibc's headers and libraries, such as
+ *  ../glibc_tests/replay, which is linked with the build's loader and so
+ *  is its "system".
+ *
+ *  Each trace is replayed runs times (3 by default) per allocator without
+ *  timing the calls, for the average wall clock time and the peak
+ *  resident set size (over that of the loaded trace), and once more
+ *  timing them, for their latencies.
+ *  The table has a row per trace and allocator, and like the SPEC tables
+ *  in the README, the overhead of each allocator over the first one.
+ *
+ */
+
+#define MAX_ALLOCATORS  16
+#define DEFAULT_RUNS    3
+#define BUFFERSZ        1024
+
+typedef struct allocator {
+  const char* name;
+  const char* loader;          /* ld:<loader>, or NULL */
+  const char* preload;         /* <library>, or NULL */
+  const char* replay;          /* @<replay>, or NULL for the -x one */
+} allocator_t;
+
+/* what a replay -s reports */
+typedef struct result {
+  size_t calls;
+  double secs;
+  double mean, p50, p90, p99, p999, max;
+  uint64_t rss;
+} result_t;
+
+static bool parse_allocator(char* arg, allocator_t* allocator){
+  char* spec = strchr(arg, '=');
+  char* replay;
+
+  if(spec == NULL){
+    return false;
+  }
+  *spec++ = '\0';
+  allocator->name = arg;
+  allocator->loader = NULL;
+  allocator->preload = NULL;
+  allocator->replay = NULL;
+  replay = strrchr(spec, '@');
+  if(replay != NULL){
+    *replay++ = '\0';
+    allocator->replay = replay;
+  }
+  if(strncmp(spec, "ld:", 3) == 0){
+    allocator->loader = spec + 3;
+  } else if(strcmp(spec, "system") != 0){
+    allocator->preload = spec;
+  }
+  return true;
+}
+
+/* runs the replay of the trace with the allocator; false if it did not report */
+static bool run_replay(const char* replay, allocator_t* allocator, const char* trace, bool timed, result_t* result){
+  char buffer[BUFFERSZ];
+  char libdir[BUFFERSZ];
+  const char* argv[8];
+  int argc, status, fds[2];
+  ssize_t length;
+  size_t total;
+  pid_t pid;
+
+  argc = 0;
+  if(allocator->loader != NULL){
+    snprintf(libdir, sizeof(libdir), "%s", allocator->loader);
+    argv[argc++] = allocator->loader;
+    argv[argc++] = "--library-path";
+    argv[argc++] = dirname(libdir);
+  }
+  argv[argc++] = allocator->replay != NULL ? allocator->replay : replay;
+  argv[argc++] = timed ? "-sl" : "-s";
+  argv[argc++] = trace;
+  argv[argc] = NULL;
+
+  if(pipe(fds) != 0){
+    fprintf(stderr, "pipe failed: %s\n", strerror(errno));
+    return false;
+  }
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(stderr, "fork failed: %s\n", strerror(errno));
+    return false;
+  }
+  if(pid == 0){
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    close(STDERR_FILENO);
+    open("/dev/null", O_WRONLY);
+    if(allocator->preload != NULL){
+      setenv("LD_PRELOAD", allocator->preload, 1);
+    }
+    execv(argv[0], (char* const*)argv);
+    _exit(127);
+  }
+
+  close(fds[1]);
+  total = 0;
+  while(total < sizeof(buffer) - 1 && (length = read(fds[0], buffer + total, sizeof(buffer) - 1 - total)) > 0){
+    total += length;
+  }
+  buffer[total] = '\0';
+  close(fds[0]);
+  waitpid(pid, &status, 0);
+
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+     sscanf(buffer, "summary %zu %lf %lf %lf %lf %lf %lf %lf %" SCNu64, &result->calls, &result->secs,
+            &result->mean, &result->p50, &result->p90, &result->p99, &result->p999, &result->max, &result->rss) != 9){
+    fprintf(stderr, "%s on %s did not report\n", allocator->name, trace);
+    return false;
+  }
+  return true;
+}
+
+/* the average wall clock time and the largest peak rss of runs replays, and the latencies of a timed one */
+static bool measure(const char* replay, allocator_t* allocator, const char* trace, int runs, result_t* result){
+  result_t run;
+  double secs;
+  uint64_t rss;
+  int i;
+
+  secs = 0;
+  rss = 0;
+  for(i = 0; i < runs; i++){
+    if(!run_replay(replay, allocator, trace, false, &run)){
+      return false;
+    }
+    secs += run.secs;
+    if(run.rss > rss){
+      rss = run.rss;
+    }
+  }
+  if(!run_replay(replay, allocator, trace, true, result)){
+    return false;
+  }
+  result->secs = secs / runs;
+  result->rss = rss;
+  return true;
+}
+
+int main(int argc, char* argv[]){
+  allocator_t allocators[MAX_ALLOCATORS];
+  const char* replay = "./replay";
+  char namebuf[BUFFERSZ];
+  char overhead[32];
+  result_t result;
+  double baseline;               /* the first allocator's secs, 0 if it failed */
+  int nallocators, runs, opt, i, code;
+  bool first;
+
+  nallocators = 0;
+  runs = DEFAULT_RUNS;
+  while ((opt = getopt(argc, argv, "r:x:a:")) != -1) {
+    switch (opt) {
+    case 'r': runs = atoi(optarg); break;
+    case 'x': replay = optarg; break;
+    case 'a':
+      if(nallocators == MAX_ALLOCATORS || !parse_allocator(optarg, &allocators[nallocators])){
+        fprintf(stdout, "At most %d allocators, each given as name=system|ld:<loader>|<library>[@<replay>]\n", MAX_ALLOCATORS);
+        return 1;
+      }
+      nallocators++;
+      break;
+    default: optind = argc + 1; break;
+    }
+  }
+
+  if (optind >= argc || runs <= 0) {
+    fprintf(stdout, "Usage: %s [-r runs] [-x replay] -a name=allocator[@replay] ... <mhook output file> ...\n", argv[0]);
+    return 1;
+  }
+  if(nallocators == 0){
+    allocators[nallocators].name = "glibc";
+    allocators[nallocators].loader = NULL;
+    allocators[nallocators].preload = NULL;
+    allocators[nallocators].replay = NULL;
+    nallocators++;
+  }
+
+  fprintf(stdout, "%-24s %-12s %9s %11s %9s %8s %8s %8s %8s %8s %10s %12s\n", "trace", "allocator", "secs", "% Overhead",
+          "Mcalls/s", "mean ns", "p50", "p90", "p99", "p99.9", "max", "peak rss");
+  code = 0;
+  for(; optind < argc; optind++){
+    snprintf(namebuf, sizeof(namebuf), "%s", argv[optind]);
+    first = true;
+    baseline = 0;
+    for(i = 0; i < nallocators; i++){
+      if(!measure(replay, &allocators[i], argv[optind], runs, &result)){
+        code = 1;
+        continue;
+      }
+      if(i == 0){
+        baseline = result.secs;
+      }
+      /* with nothing to compare against there is no overhead */
+      if(baseline == 0){
+        snprintf(overhead, sizeof(overhead), "n/a");
+      } else {
+        snprintf(overhead, sizeof(overhead), "%.2f", 100 * (result.secs - baseline) / baseline);
+      }
+      fprintf(stdout, "%-24.24s %-12s %9.3f %11s %9.2f %8.1f %8.0f %8.0f %8.0f %8.0f %10.0f %12" PRIu64 "\n",
+              first ? basename(namebuf) : "", allocators[i].name, result.secs, overhead,
+              result.secs == 0 ? 0.0 : result.calls / result.secs / 1e6,
+              result.mean, result.p50, result.p90, result.p99, result.p999, result.max, result.rss);
+      fflush(stdout);
+      first = false;
+    }
+  }
+  return code;
+}
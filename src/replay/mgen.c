@@ -0,0 +1,473 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "mhook.h"
+
+#include "profile.h"
+
+/*
+ *  Generates a synthetic binary trace (MHOOK_FORMAT=binary) from a
+ *  profile extracted by mprofile:
+ *
+ *  mgen [-s seed] <profile> <calls> <threads> <output>
+ *
+ *  so that replay, threplay and mcompare can run a workload of any
+ *  length and thread count with the statistics of a real one, without
+ *  having to ship (or even have) its trace.
+ *
+ *  The threads take turns, a call each; the timestamp of a call is its
+ *  index, so the trace's mhook_order is the order it was generated in.
+ *  A thread allocates for a run of calls, of a length drawn from the
+ *  profile's bursts, with sizes drawn from its sizes and a lifetime drawn
+ *  from those of the size's class; between runs it frees the blocks that
+ *  are due. A block is freed by another thread than its own as often as
+ *  the profile's frees are remote, and a realloc, as often as in the
+ *  profile, resizes a block by a ratio drawn from the reallocs of its
+ *  size class, up to the largest size in the profile. The free
+ *  runs are what the lifetimes make of them. The free(NULL)s, which
+ *  some programs make a lot of, are made as often as in the profile.
+ *  The other frees are too only as far as the lifetimes fit in the
+ *  trace: the blocks of a program that frees them all as it exits
+ *  mostly outlive it.
+ *
+ *  The addresses are made up, and never reused, which the replays do
+ *  not mind. The same seed generates the same trace.
+ *
+ */
+
+#define NEVER  UINT64_MAX
+
+typedef struct block {
+  uint64_t death;              /* the call it is due to be freed at */
+  uint64_t ptr;
+  uint64_t size;
+} block_t;
+
+/* the blocks a thread is to free, a min heap on their death */
+typedef struct heap {
+  size_t count;
+  size_t capacity;
+  block_t* blocks;
+} heap_t;
+
+typedef struct distribution {
+  size_t count;
+  uint64_t* cumulative;        /* cumulative[i] is the weight of the values before and at i */
+} distribution_t;
+
+typedef struct generator {
+  uint64_t state;              /* of the random numbers */
+  distribution_t sizes;        /* the exact sizes, then the log2 classes */
+  uint64_t* size_values;
+  distribution_t lifetimes[PROFILE_LOG2];  /* the log2 lifetimes, then never */
+  distribution_t all_lifetimes;            /* for a class the profile has no lifetimes for */
+  distribution_t ratios[PROFILE_LOG2];     /* by the log2 of the old size */
+  distribution_t all_ratios;               /* for a class the profile has no reallocs of */
+  uint64_t largest;
+  distribution_t alloc_runs;
+  double calloc_ratio;         /* of the allocations */
+  double realloc_ratio;        /* of the calls that are not frees */
+  double remote_ratio;         /* of the frees of blocks */
+  double null_ratio;           /* of the calls, the free(NULL)s */
+  uint64_t next_ptr;
+} generator_t;
+
+/* xorshift64* */
+static uint64_t next_random(generator_t* gen){
+  gen->state ^= gen->state >> 12;
+  gen->state ^= gen->state << 25;
+  gen->state ^= gen->state >> 27;
+  return gen->state * 0x2545F4914F6CDD1DULL;
+}
+
+static double next_unit(generator_t* gen){
+  return (next_random(gen) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* a uniform value in [2^k, 2^(k+1)) */
+static uint64_t next_in_class(generator_t* gen, unsigned k){
+  uint64_t low = 1ULL << k;
+
+  return low + (k == 0 ? 0 : next_random(gen) % low);
+}
+
+static bool init_distribution(distribution_t* d, const uint64_t* weights, size_t count){
+  uint64_t total;
+  size_t i;
+
+  d->count = count;
+  d->cumulative = malloc(count * sizeof(uint64_t));
+  if(d->cumulative == NULL){
+    return false;
+  }
+  for(total = 0, i = 0; i < count; i++){
+    total += weights[i];
+    d->cumulative[i] = total;
+  }
+  return true;
+}
+
+static bool is_empty(const distribution_t* d){
+  return d->count == 0 || d->cumulative[d->count - 1] == 0;
+}
+
+static size_t sample(generator_t* gen, const distribution_t* d){
+  uint64_t target = next_random(gen) % d->cumulative[d->count - 1];
+  size_t low = 0, high = d->count - 1, middle;
+
+  while(low < high){
+    middle = low + (high - low) / 2;
+    if(d->cumulative[middle] > target){
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+  return low;
+}
+
+static bool init_generator(generator_t* gen, const profile_t* profile, uint64_t seed){
+  uint64_t weights[PROFILE_SIZES + PROFILE_LOG2];
+  uint64_t all[PROFILE_LOG2 + 1];
+  uint64_t all_ratios[PROFILE_RATIOS];
+  uint64_t allocs, frees, others;
+  unsigned i, k;
+  bool retval;
+
+  memset(gen, 0, sizeof(generator_t));
+  gen->state = seed == 0 ? 1 : seed;
+  gen->next_ptr = 0x10000;
+
+  gen->size_values = malloc((PROFILE_SIZES + PROFILE_LOG2) * sizeof(uint64_t));
+  if(gen->size_values == NULL){
+    return false;
+  }
+  for(i = 0; i < profile->nsizes; i++){
+    gen->size_values[i] = profile->sizes[i];
+    weights[i] = profile->size_counts[i];
+  }
+  for(k = 0; k < PROFILE_LOG2; k++){
+    gen->size_values[profile->nsizes + k] = k;
+    weights[profile->nsizes + k] = profile->size_log2[k];
+  }
+  retval = init_distribution(&gen->sizes, weights, profile->nsizes + PROFILE_LOG2);
+
+  memset(all, 0, sizeof(all));
+  for(k = 0; retval && k < PROFILE_LOG2; k++){
+    for(i = 0; i < PROFILE_LOG2; i++){
+      weights[i] = profile->lifetimes[k][i];
+      all[i] += weights[i];
+    }
+    weights[PROFILE_LOG2] = profile->never[k];
+    all[PROFILE_LOG2] += weights[PROFILE_LOG2];
+    retval = init_distribution(&gen->lifetimes[k], weights, PROFILE_LOG2 + 1);
+  }
+  memset(all_ratios, 0, sizeof(all_ratios));
+  for(k = 0; retval && k < PROFILE_LOG2; k++){
+    for(i = 0; i < PROFILE_RATIOS; i++){
+      all_ratios[i] += profile->ratios[k][i];
+    }
+    retval = init_distribution(&gen->ratios[k], profile->ratios[k], PROFILE_RATIOS);
+  }
+  gen->largest = profile->largest;
+  retval = retval &&
+    init_distribution(&gen->all_lifetimes, all, PROFILE_LOG2 + 1) &&
+    init_distribution(&gen->all_ratios, all_ratios, PROFILE_RATIOS) &&
+    init_distribution(&gen->alloc_runs, profile->alloc_runs, PROFILE_LOG2);
+
+  allocs = profile->kinds[PROFILE_MALLOC] + profile->kinds[PROFILE_CALLOC];
+  others = allocs + profile->kinds[PROFILE_REALLOC];
+  frees = profile->kinds[PROFILE_FREE] - profile->null_frees;
+  gen->calloc_ratio = allocs == 0 ? 0 : (double)profile->kinds[PROFILE_CALLOC] / allocs;
+  gen->realloc_ratio = others == 0 ? 0 : (double)profile->kinds[PROFILE_REALLOC] / others;
+  gen->remote_ratio = frees == 0 ? 0 : (double)profile->remote_frees / frees;
+  gen->null_ratio = profile->calls == 0 ? 0 : (double)profile->null_frees / profile->calls;
+
+  if(retval && (is_empty(&gen->sizes) || is_empty(&gen->all_lifetimes))){
+    fprintf(stderr, "The profile has no allocations\n");
+    retval = false;
+  }
+  return retval;
+}
+
+static void delete_generator(generator_t* gen){
+  unsigned k;
+
+  for(k = 0; k < PROFILE_LOG2; k++){
+    free(gen->lifetimes[k].cumulative);
+    free(gen->ratios[k].cumulative);
+  }
+  free(gen->all_lifetimes.cumulative);
+  free(gen->all_ratios.cumulative);
+  free(gen->alloc_runs.cumulative);
+  free(gen->sizes.cumulative);
+  free(gen->size_values);
+}
+
+static uint64_t next_size(generator_t* gen){
+  size_t i = sample(gen, &gen->sizes);
+
+  return i < gen->sizes.count - PROFILE_LOG2 ? gen->size_values[i] : next_in_class(gen, gen->size_values[i]);
+}
+
+static uint64_t next_lifetime(generator_t* gen, uint64_t size){
+  const distribution_t* d = &gen->lifetimes[profile_log2(size)];
+  size_t k;
+
+  k = sample(gen, is_empty(d) ? &gen->all_lifetimes : d);
+  return k == PROFILE_LOG2 ? NEVER : next_in_class(gen, k);
+}
+
+static uint64_t next_run(generator_t* gen){
+  return is_empty(&gen->alloc_runs) ? 1 : next_in_class(gen, sample(gen, &gen->alloc_runs));
+}
+
+/* the ratio is that of the block's class, so a block resized again and
+   again does not compound one class's growth into sizes no call made */
+static uint64_t next_resize(generator_t* gen, uint64_t size){
+  const distribution_t* d = &gen->ratios[profile_log2(size)];
+  int steps;
+  double resized;
+
+  if(is_empty(d)){
+    d = &gen->all_ratios;
+  }
+  if(is_empty(d)){
+    return size;
+  }
+  steps = (int)sample(gen, d) - 4 * PROFILE_RATIO_STEPS;
+  resized = size * __builtin_exp2((double)steps / PROFILE_RATIO_STEPS);
+  if(gen->largest != 0 && resized > gen->largest){
+    resized = size > gen->largest ? size : gen->largest;
+  }
+  return resized < 1 ? 1 : (uint64_t)resized;
+}
+
+static bool push(heap_t* heap, block_t block){
+  block_t* blocks;
+  size_t i, parent;
+
+  if(heap->count == heap->capacity){
+    heap->capacity = heap->capacity == 0 ? 1024 : 2 * heap->capacity;
+    blocks = realloc(heap->blocks, heap->capacity * sizeof(block_t));
+    if(blocks == NULL){
+      return false;
+    }
+    heap->blocks = blocks;
+  }
+  for(i = heap->count++; i > 0; i = parent){
+    parent = (i - 1) / 2;
+    if(heap->blocks[parent].death <= block.death){
+      break;
+    }
+    heap->blocks[i] = heap->blocks[parent];
+  }
+  heap->blocks[i] = block;
+  return true;
+}
+
+static block_t pop(heap_t* heap){
+  block_t top = heap->blocks[0], last = heap->blocks[--heap->count];
+  size_t i, child;
+
+  for(i = 0; (child = 2 * i + 1) < heap->count; i = child){
+    if(child + 1 < heap->count && heap->blocks[child + 1].death < heap->blocks[child].death){
+      child++;
+    }
+    if(last.death <= heap->blocks[child].death){
+      break;
+    }
+    heap->blocks[i] = heap->blocks[child];
+  }
+  if(heap->count > 0){
+    heap->blocks[i] = last;
+  }
+  return top;
+}
+
+static int generate(generator_t* gen, uint64_t calls, uint32_t nthreads, FILE* out){
+  mhook_header_t header;
+  mhook_record_t r;
+  heap_t* heaps;
+  mhook_writer_t* writers;     /* each thread's block */
+  uint64_t* runs;              /* the allocations left in each thread's run */
+  uint64_t step, lifetime;
+  uint32_t t, owner;
+  heap_t* heap;
+  block_t block;
+  int code;
+
+  heaps = calloc(nthreads, sizeof(heap_t));
+  writers = calloc(nthreads, sizeof(mhook_writer_t));
+  runs = calloc(nthreads, sizeof(uint64_t));
+  if(heaps == NULL || writers == NULL || runs == NULL){
+    fprintf(stderr, "Out of memory\n");
+    code = 1;
+    goto exit;
+  }
+
+  memcpy(header.magic, MHOOK_MAGIC, sizeof(header.magic));
+  header.version = MHOOK_VERSION;
+  header.record_size = sizeof(mhook_record_t);
+  fwrite(&header, sizeof(header), 1, out);
+  for(t = 0; t < nthreads; t++){
+    mhook_start(&writers[t], t, 1000 + t);
+  }
+
+  code = 0;
+  for(step = 0; step < calls; step++){
+    t = step % nthreads;
+    heap = &heaps[t];
+
+    memset(&r, 0, sizeof(r));
+    r.timestamp = step;
+
+    if(next_unit(gen) < gen->null_ratio){
+      r.op = 'f';
+    } else if(runs[t] == 0 && heap->count > 0 && heap->blocks[0].death <= step){
+      block = pop(heap);
+      r.op = 'f';
+      r.ptr = block.ptr;
+    } else if(heap->count > 0 && next_unit(gen) < gen->realloc_ratio){
+      /* resizing does not change when the block is due */
+      block_t* b = &heap->blocks[next_random(gen) % heap->count];
+      r.op = 'r';
+      r.ptr = b->ptr;
+      r.size = next_resize(gen, b->size);
+      r.ptr2 = gen->next_ptr;
+      gen->next_ptr += (r.size + 31) & ~15ULL;
+      b->ptr = r.ptr2;
+      b->size = r.size;
+    } else {
+      if(runs[t] == 0){
+        runs[t] = next_run(gen);
+      }
+      runs[t]--;
+      block.size = next_size(gen);
+      block.ptr = gen->next_ptr;
+      gen->next_ptr += (block.size + 31) & ~15ULL;
+      if(next_unit(gen) < gen->calloc_ratio){
+        r.op = 'c';
+        r.size = 1;
+        r.size2 = block.size;
+      } else {
+        r.op = 'm';
+        r.size = block.size;
+      }
+      r.ptr = block.ptr;
+      lifetime = next_lifetime(gen, block.size);
+      if(lifetime != NEVER){
+        block.death = step + lifetime;
+        owner = t;
+        if(nthreads > 1 && next_unit(gen) < gen->remote_ratio){
+          owner = (t + 1 + next_random(gen) % (nthreads - 1)) % nthreads;
+        }
+        if(!push(&heaps[owner], block)){
+          fprintf(stderr, "Out of memory\n");
+          code = 1;
+          goto exit;
+        }
+      }
+    }
+    if(mhook_append(&writers[t], &r)){
+      fwrite(&writers[t].block, mhook_block_size(&writers[t]), 1, out);
+      mhook_flushed(&writers[t]);
+    }
+  }
+  for(t = 0; code == 0 && t < nthreads; t++){
+    if(writers[t].block.count > 0){
+      fwrite(&writers[t].block, mhook_block_size(&writers[t]), 1, out);
+    }
+  }
+
+ exit:
+  for(t = 0; heaps != NULL && t < nthreads; t++){
+    free(heaps[t].blocks);
+  }
+  free(runs);
+  free(writers);
+  free(heaps);
+  return code;
+}
+
+static void usage(const char* name){
+  fprintf(stdout, "Usage: %s [-s seed] <profile> <calls> <threads> <output>\n", name);
+}
+
+int main(int argc, char* argv[]){
+  profile_t* profile;
+  generator_t gen;
+  uint64_t seed, calls;
+  long nthreads;
+  FILE* out;
+  int opt, code;
+
+  seed = 1;
+  while((opt = getopt(argc, argv, "s:")) != -1){
+    switch(opt){
+    case 's':
+      seed = strtoull(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if(argc - optind != 4){
+    usage(argv[0]);
+    return 1;
+  }
+
+  calls = strtoull(argv[optind + 1], NULL, 0);
+  nthreads = strtol(argv[optind + 2], NULL, 0);
+  if(nthreads < 1){
+    usage(argv[0]);
+    return 1;
+  }
+
+  profile = malloc(sizeof(profile_t));
+  if(profile == NULL || !read_profile(argv[optind], profile) || !init_generator(&gen, profile, seed)){
+    free(profile);
+    return 1;
+  }
+
+  out = strcmp(argv[optind + 3], "-") == 0 ? stdout : fopen(argv[optind + 3], "w");
+  if(out == NULL){
+    fprintf(stderr, "Could not open %s: %s\n", argv[optind + 3], strerror(errno));
+    code = 1;
+  } else {
+    code = generate(&gen, calls, nthreads, out);
+    if(fclose(out) != 0){
+      fprintf(stderr, "Could not write %s: %s\n", argv[optind + 3], strerror(errno));
+      code = 1;
+    }
+  }
+
+  delete_generator(&gen);
+  free(profile);
+  return code;
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "replayops.h"
+
+#include "profile.h"
+
+/*
+ *  Extracts the statistical model (see profile.h) of a trace, text or
+ *  binary, for mgen:
+ *
+ *  mprofile <mhook output file> [<profile>]
+ *
+ *  The profile goes to stdout when no file is given. The trace is loaded
+ *  as replay -p loads it, so a multithreaded trace is taken in
+ *  mhook_order, and its cross-thread frees are those of the threads
+ *  that ran it.
+ *
+ */
+
+typedef struct size_count {
+  uint64_t size;
+  uint64_t count;
+} size_count_t;
+
+static int compare_sizes(const void* a, const void* b){
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* most frequent first */
+static int compare_counts(const void* a, const void* b){
+  const size_count_t* x = a;
+  const size_count_t* y = b;
+
+  return x->count > y->count ? -1 : x->count < y->count;
+}
+
+/* the most frequent sizes exactly, the rest by their log2 */
+static bool profile_sizes(profile_t* profile, uint64_t* sizes, size_t nsizes){
+  size_count_t* counts;
+  size_t i, ncounts;
+
+  qsort(sizes, nsizes, sizeof(uint64_t), compare_sizes);
+  counts = calloc(nsizes + 1, sizeof(size_count_t));
+  if(counts == NULL){
+    return false;
+  }
+  for(ncounts = 0, i = 0; i < nsizes; i++){
+    if(ncounts == 0 || counts[ncounts - 1].size != sizes[i]){
+      counts[ncounts].size = sizes[i];
+      counts[ncounts++].count = 0;
+    }
+    counts[ncounts - 1].count++;
+  }
+  qsort(counts, ncounts, sizeof(size_count_t), compare_counts);
+  for(i = 0; i < ncounts; i++){
+    if(i < PROFILE_SIZES){
+      profile->sizes[i] = counts[i].size;
+      profile->size_counts[i] = counts[i].count;
+      profile->nsizes++;
+    } else {
+      profile->size_log2[profile_log2(counts[i].size)] += counts[i].count;
+    }
+  }
+  free(counts);
+  return true;
+}
+
+static void end_run(uint64_t runs[PROFILE_LOG2], size_t* length){
+  if(*length > 0){
+    runs[profile_log2(*length)]++;
+    *length = 0;
+  }
+}
+
+static bool extract(replay_program_t* program, profile_t* profile){
+  replay_thread_t* thread = &program->threads[0];
+  replay_op_t* op;
+  uint64_t* births;            /* the call that allocated the block a slot continues */
+  uint64_t* sizes;             /* the slot's size */
+  uint8_t* classes;            /* the log2 of the size the block was allocated with */
+  uint8_t* alive;
+  uint64_t* requests;          /* the sizes of the mallocs and callocs */
+  size_t nrequests, index, allocs, frees;
+  uint64_t size;
+  uint32_t slot;
+  bool retval;
+
+  memset(profile, 0, sizeof(profile_t));
+  profile->calls = program->nops;
+  profile->threads = program->traced_threads;
+
+  births = calloc(program->nslots + 1, sizeof(uint64_t));
+  sizes = calloc(program->nslots + 1, sizeof(uint64_t));
+  classes = calloc(program->nslots + 1, sizeof(uint8_t));
+  alive = calloc(program->nslots + 1, sizeof(uint8_t));
+  requests = calloc(program->nslots + 1, sizeof(uint64_t));
+  retval = births != NULL && sizes != NULL && classes != NULL && alive != NULL && requests != NULL;
+
+  nrequests = allocs = frees = 0;
+  for(index = 0; retval && index < thread->count; index++){
+    op = &thread->ops[index];
+    switch(op->kind){
+    case OP_MALLOC:
+    case OP_CALLOC:
+      profile->kinds[op->kind == OP_MALLOC ? PROFILE_MALLOC : PROFILE_CALLOC]++;
+      size = op->kind == OP_MALLOC ? op->size : op->size * op->size2;
+      requests[nrequests++] = size;
+      if(size > profile->largest){
+        profile->largest = size;
+      }
+      if((slot = op->out) != NO_SLOT){
+        births[slot] = index;
+        sizes[slot] = size;
+        classes[slot] = profile_log2(size);
+        alive[slot] = 1;
+      }
+      end_run(profile->free_runs, &frees);
+      allocs++;
+      break;
+    case OP_REALLOC:
+      profile->kinds[PROFILE_REALLOC]++;
+      if(op->size > profile->largest){
+        profile->largest = op->size;
+      }
+      if(op->in != NO_SLOT){
+        profile->ratios[profile_log2(sizes[op->in])][profile_ratio(sizes[op->in], op->size)]++;
+        alive[op->in] = 0;
+        if(op->out == NO_SLOT){
+          profile->lifetimes[classes[op->in]][profile_log2(index - births[op->in])]++;
+        }
+      }
+      if((slot = op->out) != NO_SLOT){
+        births[slot] = op->in != NO_SLOT ? births[op->in] : index;
+        classes[slot] = op->in != NO_SLOT ? classes[op->in] : profile_log2(op->size);
+        sizes[slot] = op->size;
+        alive[slot] = 1;
+      }
+      end_run(profile->alloc_runs, &allocs);
+      end_run(profile->free_runs, &frees);
+      break;
+    case OP_FREE:
+      profile->kinds[PROFILE_FREE]++;
+      if((slot = op->in) != NO_SLOT){
+        profile->lifetimes[classes[slot]][profile_log2(index - births[slot])]++;
+        profile->remote_frees += op->remote;
+        alive[slot] = 0;
+      } else {
+        profile->null_frees++;
+      }
+      end_run(profile->alloc_runs, &allocs);
+      frees++;
+      break;
+    }
+  }
+  end_run(profile->alloc_runs, &allocs);
+  end_run(profile->free_runs, &frees);
+
+  for(slot = 0; retval && slot < program->nslots; slot++){
+    if(alive[slot]){
+      profile->never[classes[slot]]++;
+    }
+  }
+
+  if(retval){
+    retval = profile_sizes(profile, requests, nrequests);
+  }
+  if(!retval){
+    fprintf(stderr, "Out of memory\n");
+  }
+
+  free(requests);
+  free(alive);
+  free(classes);
+  free(sizes);
+  free(births);
+  return retval;
+}
+
+int main(int argc, char* argv[]){
+  replay_program_t program;
+  profile_t* profile;
+  FILE* out;
+  int code;
+
+  if (argc < 2 || argc > 3) {
+    fprintf(stdout, "Usage: %s <mhook output file> [<profile>]\n", argv[0]);
+    return 1;
+  }
+
+  if(!load_program(argv[1], true, &program)){
+    return 1;
+  }
+
+  profile = malloc(sizeof(profile_t));
+  if(profile == NULL || !extract(&program, profile)){
+    delete_program(&program);
+    return 1;
+  }
+
+  out = argc == 3 ? fopen(argv[2], "w") : stdout;
+  if(out == NULL){
+    fprintf(stderr, "Could not open %s: %s\n", argv[2], strerror(errno));
+    code = 1;
+  } else {
+    fprintf(out, "# profile of %s\n", argv[1]);
+    write_profile(out, profile);
+    code = out != stdout && fclose(out) != 0;
+  }
+
+  free(profile);
+  delete_program(&program);
+  return code;
+}
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <time.h>
 
 
 #include "malloc.h"
@@ -38,6 +39,10 @@ static const bool verbose = true;
  *  Hopefully in the exact same fashion (but whether our calls to
  *  realloc match the scripts lies in the lap of the malloc gods). 
  *
+ *  The wall clock time from the first pthread_create to the last
+ *  pthread_join is reported, so different arena policies can be
+ *  compared (e.g. MALLOC_PERCPU_ARENAS=1 with 4 threads per core).
+ *
  *
  */
 
@@ -63,6 +68,7 @@ int main(int argc, char* argv[]){
   pthread_t threads[MAX_THREADS];
   targs_t targs[MAX_THREADS];
   void* status;
+  struct timespec start, end;
   
   if (argc != 3) {
     fprintf(stdout, "Usage: %s <nthreads> <mhook output file>\n", argv[0]);
@@ -83,6 +89,8 @@ int main(int argc, char* argv[]){
   } else {
 
    
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
    for( i = 0; i < nthreads; i++){
 
      targs[i].id = i;
@@ -108,6 +116,11 @@ int main(int argc, char* argv[]){
 	}
 	
    }
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   fprintf(stdout, "%d threads in %.3f secs\n", nthreads,
+	   (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9);
    
   }
   
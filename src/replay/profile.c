@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "profile.h"
+
+#define BUFFERSZ  1024
+
+static const char* kind_names[PROFILE_KINDS] = { "malloc", "calloc", "realloc", "free" };
+
+void write_profile(FILE* fp, const profile_t* profile){
+  unsigned i, j;
+
+  fprintf(fp, "calls %" PRIu64 "\n", profile->calls);
+  fprintf(fp, "threads %u\n", profile->threads);
+  for(i = 0; i < PROFILE_KINDS; i++){
+    fprintf(fp, "kind %s %" PRIu64 "\n", kind_names[i], profile->kinds[i]);
+  }
+  fprintf(fp, "remote_frees %" PRIu64 "\n", profile->remote_frees);
+  fprintf(fp, "null_frees %" PRIu64 "\n", profile->null_frees);
+  fprintf(fp, "largest %" PRIu64 "\n", profile->largest);
+  for(i = 0; i < profile->nsizes; i++){
+    fprintf(fp, "size %" PRIu64 " %" PRIu64 "\n", profile->sizes[i], profile->size_counts[i]);
+  }
+  for(i = 0; i < PROFILE_LOG2; i++){
+    if(profile->size_log2[i] != 0){
+      fprintf(fp, "size_log2 %u %" PRIu64 "\n", i, profile->size_log2[i]);
+    }
+  }
+  for(i = 0; i < PROFILE_LOG2; i++){
+    for(j = 0; j < PROFILE_LOG2; j++){
+      if(profile->lifetimes[i][j] != 0){
+        fprintf(fp, "lifetime %u %u %" PRIu64 "\n", i, j, profile->lifetimes[i][j]);
+      }
+    }
+    if(profile->never[i] != 0){
+      fprintf(fp, "never %u %" PRIu64 "\n", i, profile->never[i]);
+    }
+  }
+  for(i = 0; i < PROFILE_LOG2; i++){
+    for(j = 0; j < PROFILE_RATIOS; j++){
+      if(profile->ratios[i][j] != 0){
+        fprintf(fp, "realloc %u %d %" PRIu64 "\n", i, (int)j - 4 * PROFILE_RATIO_STEPS, profile->ratios[i][j]);
+      }
+    }
+  }
+  for(i = 0; i < PROFILE_LOG2; i++){
+    if(profile->alloc_runs[i] != 0){
+      fprintf(fp, "burst alloc %u %" PRIu64 "\n", i, profile->alloc_runs[i]);
+    }
+  }
+  for(i = 0; i < PROFILE_LOG2; i++){
+    if(profile->free_runs[i] != 0){
+      fprintf(fp, "burst free %u %" PRIu64 "\n", i, profile->free_runs[i]);
+    }
+  }
+}
+
+bool read_profile(const char* filename, profile_t* profile){
+  char buffer[BUFFERSZ];
+  char name[BUFFERSZ];
+  uint64_t a, b;
+  unsigned i, j;
+  int ratio;
+  size_t linecount;
+  bool ok;
+  FILE* fp;
+
+  memset(profile, 0, sizeof(profile_t));
+  fp = fopen(filename, "r");
+  if(fp == NULL){
+    fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+    return false;
+  }
+
+  linecount = 0;
+  while(fgets(buffer, BUFFERSZ, fp) != NULL){
+    linecount++;
+    if(buffer[0] == '#' || buffer[0] == '\n'){
+      continue;
+    }
+    if(sscanf(buffer, "calls %" SCNu64, &a) == 1){
+      profile->calls = a;
+      ok = true;
+    } else if(sscanf(buffer, "threads %u", &i) == 1){
+      profile->threads = i;
+      ok = true;
+    } else if(sscanf(buffer, "kind %1023s %" SCNu64, name, &a) == 2){
+      for(ok = false, i = 0; i < PROFILE_KINDS; i++){
+        if(strcmp(name, kind_names[i]) == 0){
+          profile->kinds[i] = a;
+          ok = true;
+        }
+      }
+    } else if(sscanf(buffer, "remote_frees %" SCNu64, &a) == 1){
+      profile->remote_frees = a;
+      ok = true;
+    } else if(sscanf(buffer, "null_frees %" SCNu64, &a) == 1){
+      profile->null_frees = a;
+      ok = true;
+    } else if(sscanf(buffer, "largest %" SCNu64, &a) == 1){
+      profile->largest = a;
+      ok = true;
+    } else if(sscanf(buffer, "size_log2 %u %" SCNu64, &i, &a) == 2){
+      ok = i < PROFILE_LOG2;
+      if(ok){
+        profile->size_log2[i] = a;
+      }
+    } else if(sscanf(buffer, "size %" SCNu64 " %" SCNu64, &a, &b) == 2){
+      ok = profile->nsizes < PROFILE_SIZES;
+      if(ok){
+        profile->sizes[profile->nsizes] = a;
+        profile->size_counts[profile->nsizes++] = b;
+      }
+    } else if(sscanf(buffer, "lifetime %u %u %" SCNu64, &i, &j, &a) == 3){
+      ok = i < PROFILE_LOG2 && j < PROFILE_LOG2;
+      if(ok){
+        profile->lifetimes[i][j] = a;
+      }
+    } else if(sscanf(buffer, "never %u %" SCNu64, &i, &a) == 2){
+      ok = i < PROFILE_LOG2;
+      if(ok){
+        profile->never[i] = a;
+      }
+    } else if(sscanf(buffer, "realloc %u %d %" SCNu64, &i, &ratio, &a) == 3){
+      ratio += 4 * PROFILE_RATIO_STEPS;
+      ok = i < PROFILE_LOG2 && ratio >= 0 && ratio < PROFILE_RATIOS;
+      if(ok){
+        profile->ratios[i][ratio] = a;
+      }
+    } else if(sscanf(buffer, "burst alloc %u %" SCNu64, &i, &a) == 2){
+      ok = i < PROFILE_LOG2;
+      if(ok){
+        profile->alloc_runs[i] = a;
+      }
+    } else if(sscanf(buffer, "burst free %u %" SCNu64, &i, &a) == 2){
+      ok = i < PROFILE_LOG2;
+      if(ok){
+        profile->free_runs[i] = a;
+      }
+    } else {
+      ok = false;
+    }
+    if(!ok){
+      fprintf(stderr, "Reading line %zu of %s failed: %s", linecount, filename, buffer);
+      fclose(fp);
+      return false;
+    }
+  }
+  fclose(fp);
+  return true;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _REPLAY_PROFILE
+#define _REPLAY_PROFILE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * A statistical model of a trace, as extracted by mprofile and used by
+ * mgen to generate synthetic traces of any length and thread count.
+ *
+ * Sizes are the requests of malloc and calloc: the PROFILE_SIZES most
+ * frequent ones exactly, the rest by their log2. The lifetime of a block
+ * is the number of calls (of all the threads) from its allocation to its
+ * free, following it through reallocs; it is kept, by log2, for each
+ * log2 size class, with the blocks that were never freed. A realloc is
+ * kept as the log2 of its growth, in eighths, for the log2 size class of
+ * the block it resizes, and the largest size a call asked for bounds
+ * what a generated realloc grows a block to. Bursts are the runs of
+ * allocations, and of frees, with nothing else in between, by log2.
+ *
+ * Profiles are written and read as text, a line per nonzero count, so
+ * they can be looked at, diffed and edited.
+ */
+
+#define PROFILE_LOG2     64
+#define PROFILE_SIZES    256
+/* log2(new size / old size) in eighths, from -4 to 4 */
+#define PROFILE_RATIO_STEPS  8
+#define PROFILE_RATIOS   (8 * PROFILE_RATIO_STEPS + 1)
+
+enum profile_kind { PROFILE_MALLOC, PROFILE_CALLOC, PROFILE_REALLOC, PROFILE_FREE, PROFILE_KINDS };
+
+typedef struct profile {
+  uint64_t calls;
+  uint32_t threads;
+  uint64_t kinds[PROFILE_KINDS];
+  uint64_t remote_frees;                    /* frees in another thread than the allocation */
+  uint64_t null_frees;                      /* free(NULL)s, which are frees as well */
+  uint64_t largest;                         /* the largest size of a malloc, calloc or realloc */
+  uint32_t nsizes;
+  uint64_t sizes[PROFILE_SIZES];            /* the exact sizes */
+  uint64_t size_counts[PROFILE_SIZES];
+  uint64_t size_log2[PROFILE_LOG2];         /* the other sizes */
+  uint64_t lifetimes[PROFILE_LOG2][PROFILE_LOG2];  /* [log2 size][log2 lifetime] */
+  uint64_t never[PROFILE_LOG2];             /* [log2 size] never freed */
+  uint64_t ratios[PROFILE_LOG2][PROFILE_RATIOS];  /* [log2 old size][ratio] */
+  uint64_t alloc_runs[PROFILE_LOG2];
+  uint64_t free_runs[PROFILE_LOG2];
+} profile_t;
+
+/* the log2 of value, with 0 in with 1 */
+static inline unsigned profile_log2(uint64_t value){
+  return value <= 1 ? 0 : 63 - __builtin_clzll(value);
+}
+
+static inline unsigned profile_ratio(uint64_t oldsize, uint64_t newsize){
+  double steps;
+  int index;
+
+  if(oldsize == 0 || newsize == 0){
+    return newsize == 0 ? 0 : PROFILE_RATIOS - 1;
+  }
+  steps = __builtin_log2((double)newsize / (double)oldsize) * PROFILE_RATIO_STEPS;
+  index = (int)__builtin_lround(steps) + 4 * PROFILE_RATIO_STEPS;
+  return index < 0 ? 0 : index >= PROFILE_RATIOS ? PROFILE_RATIOS - 1 : index;
+}
+
+extern void write_profile(FILE* fp, const profile_t* profile);
+
+/* false, after saying why, if the file is not a profile */
+extern bool read_profile(const char* filename, profile_t* profile);
+
+#endif
@@ -17,11 +17,21 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include "malloc.h"
 
 #include "replaylib.h"
 
+#include "replayops.h"
+
 static const bool verbose = true;
 
 /*
@@ -39,22 +49,232 @@ static const bool verbose = true;
  *  main idea behind the replay script is to trigger similar bugs
  *  in the client malloc library.
  *
+ *  With -p the trace (text or binary, see load_program) is parsed into
+ *  an array of calls before any of them is made, and the array is then
+ *  run in a tight loop, so the time reported is the allocator's rather
+ *  than that of reading and parsing the trace between the calls. A
+ *  multithreaded binary trace is run as one thread, in mhook_order
+ *  (threplay runs it with its threads).
+ *
+ *  With -f (which implies -p) the footprint of the replay is tracked
+ *  and written, every -n calls, to a csv file: the bytes requested and
+ *  the usable bytes of the live blocks, the metadata bytes in use and
+ *  mapped, and the resident set size (see replay_footprint_t). Their
+ *  peaks are reported at the end.
+ *
+ *  With -t (which also implies -p) the replay touches the blocks as
+ *  the program would: it writes the given fraction (1 for all) of the
+ *  requested bytes of each block it gets, and reads them back, a cache
+ *  line at a time, before it frees or reallocs the block. The calls are
+ *  timed without the touching, but the wall clock time includes it, so
+ *  the cost of the heap's layout to the client shows up there.
+ *
+ *  With -s (which implies -p as well) the only output on stdout is a
+ *  line of numbers, for mcompare: the calls, the seconds, the mean, p50,
+ *  p90, p99, p99.9 and max latency in nanoseconds (zeros without -l),
+ *  and the peak resident set size of the run, over what it was once the
+ *  trace was loaded, so the trace and the arrays it was parsed into are
+ *  not counted as the allocator's.
+ *
+ *  The latency of each call is measured (see latency.h), and the
+ *  percentiles per kind of call, and per size class of request, are
+ *  printed at the end; with -p only if asked for with -l, as timing
+ *  every call adds to the wall clock time of the loop.
+ *
+ *  When verbose it also reports the user space dTLB load misses of the
+ *  replay (if perf is available), and the resident set size at the end
+ *  and at its peak, to compare heap layouts (e.g. MALLOC_THP_HEAPS=1).
+ *
  */
 
+/* returns a started counter of user space dTLB load misses, or -1 if perf is not available */
+static int dtlb_counter(void){
+  struct perf_event_attr attr;
+  int fd;
+
+  memset(&attr, 0, sizeof(struct perf_event_attr));
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.size = sizeof(struct perf_event_attr);
+  attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  if(fd != -1){
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  return fd;
+}
+
+/* copies the lines of a /proc file that start with one of the keys */
+static void dump_proc_lines(FILE* out, const char* path, const char* keys[]){
+  char line[256];
+  FILE* fp;
+  int i;
+
+  fp = fopen(path, "r");
+  if(fp == NULL){
+    return;
+  }
+  while(fgets(line, sizeof(line), fp) != NULL){
+    for(i = 0; keys[i] != NULL; i++){
+      if(strncmp(line, keys[i], strlen(keys[i])) == 0){
+        fprintf(out, "rss %s", line);
+      }
+    }
+  }
+  fclose(fp);
+}
+
+/* the kB of a line of /proc/self/status (e.g. "VmHWM:") in bytes, or zero */
+static uint64_t status_bytes(const char* key){
+  char line[256];
+  uint64_t kb;
+  FILE* fp;
+
+  kb = 0;
+  fp = fopen("/proc/self/status", "r");
+  if(fp == NULL){
+    return 0;
+  }
+  while(fgets(line, sizeof(line), fp) != NULL){
+    if(strncmp(line, key, strlen(key)) == 0){
+      kb = strtoull(line + strlen(key), NULL, 10);
+      break;
+    }
+  }
+  fclose(fp);
+  return kb * 1024;
+}
+
+/* starts VmHWM over from VmRSS (since linux 4.0), and returns VmRSS */
+static uint64_t reset_peak_rss(void){
+  FILE* fp;
+
+  fp = fopen("/proc/self/clear_refs", "w");
+  if(fp != NULL){
+    fputs("5", fp);
+    fclose(fp);
+  }
+  return status_bytes("VmRSS:");
+}
+
+static void dump_footprint(FILE* out, int dtlbfd){
+  static const char* status_keys[] = { "VmRSS:", "VmHWM:", NULL };
+  static const char* smaps_keys[] = { "AnonHugePages:", NULL };
+  uint64_t dtlb_misses;
+
+  if(dtlbfd != -1 && read(dtlbfd, &dtlb_misses, sizeof(uint64_t)) == sizeof(uint64_t)){
+    fprintf(out, "dTLB load misses %" PRIu64 "\n", dtlb_misses);
+  } else {
+    fprintf(out, "dTLB load misses unavailable\n");
+  }
+  dump_proc_lines(out, "/proc/self/status", status_keys);
+  dump_proc_lines(out, "/proc/self/smaps_rollup", smaps_keys);
+}
+
+
+/* the calls between the samples of the footprint timeline */
+#define DEFAULT_INTERVAL  10000
+
+typedef struct options {
+  bool preparsed;              /* -p */
+  bool timed;                  /* -l */
+  const char* timeline;        /* -f <csv file> */
+  size_t interval;             /* -n <calls> */
+  double touch;                /* -t <fraction> */
+  bool summary;                /* -s */
+} options_t;
+
+static int process_program(const char *filename, options_t* options){
+  replay_program_t program;
+  double latency[LATENCY_SUMMARY];
+  double secs;
+  uint64_t baseline, peak;
+  int i;
+
+  if(!load_program(filename, true, &program)){
+    return 1;
+  }
+
+  program.timed = options->timed;
+  program.touch = options->touch;
+
+  if(options->timeline != NULL && !init_footprint(&program, options->timeline, options->interval)){
+    delete_program(&program);
+    return 1;
+  }
+
+  /* the peak of loading the trace, and the trace, are not the allocator's */
+  baseline = options->summary ? reset_peak_rss() : 0;
+
+  secs = run_program(&program);
+
+  fprintf(stderr, "Replayed %zu calls from  %s in %.3f secs (%.1f ns per call)\n", program.nops, filename, secs,
+          program.nops == 0 ? 0.0 : secs * 1e9 / program.nops);
+
+  if(options->timed){
+    dump_program_latency(stderr, &program);
+  }
+
+  dump_footprint_peaks(stderr, &program);
+
+  if(options->summary){
+    summarize_program_latency(&program, latency);
+    fprintf(stdout, "summary %zu %.6f", program.nops, secs);
+    for(i = 0; i < LATENCY_SUMMARY; i++){
+      fprintf(stdout, " %.1f", latency[i]);
+    }
+    peak = status_bytes("VmHWM:");
+    fprintf(stdout, " %" PRIu64 "\n", peak > baseline ? peak - baseline : 0);
+  }
+
+  delete_program(&program);
+
+  return 0;
+}
 
 int main(int argc, char* argv[]){
+  options_t options = { false, false, NULL, DEFAULT_INTERVAL, 0, false };
   int code;
-  
-  if (argc != 2) {
-    fprintf(stdout, "Usage: %s <mhook output file>\n", argv[0]);
+  int dtlbfd;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "plf:n:t:s")) != -1) {
+    switch (opt) {
+    case 'p': options.preparsed = true; break;
+    case 'l': options.timed = true; break;
+    case 'f': options.timeline = optarg; options.preparsed = true; break;
+    case 'n': options.interval = strtoul(optarg, NULL, 0); break;
+    case 't': options.touch = strtod(optarg, NULL); options.preparsed = true; break;
+    case 's': options.summary = true; options.preparsed = true; break;
+    default: optind = argc; break;
+    }
+  }
+
+  if (optind != argc - 1) {
+    fprintf(stdout, "Usage: %s [-p [-l] [-f <csv file> [-n <calls>]] [-t <fraction>] [-s]] <mhook output file>\n", argv[0]);
     return 1;
   }
 
-  code = process_file(argv[1], verbose);
+  dtlbfd = dtlb_counter();
+
+  if (options.preparsed) {
+    code = process_program(argv[optind], &options);
+  } else {
+    code = process_file(argv[optind], verbose);
+  }
   
-  if (verbose) {
+  if (verbose && !options.summary) {
+    dump_footprint(stdout, dtlbfd);
     malloc_stats();
   }
 
+  if (dtlbfd != -1) {
+    close(dtlbfd);
+  }
+
   return code;
 }
@@ -36,6 +36,8 @@ const uint64_t malloc_stats_interval = 10000000;
 
 #include "lphash.h"
 
+#include "latency.h"
+
 #include "malloc.h"
 
 const bool silent_running = true;
@@ -50,16 +52,7 @@ const size_t BUFFERSZ = 1024;
 
 typedef unsigned char uchar;
 
-typedef struct replay_stats_s {
-  size_t malloc_count;
-  clock_t malloc_clock;
-  size_t free_count;
-  clock_t free_clock;
-  size_t calloc_count;
-  clock_t calloc_clock;
-  size_t realloc_count;
-  clock_t realloc_clock;
-} replay_stats_t;
+typedef latency_stats_t replay_stats_t;
 
 
 
@@ -77,19 +70,8 @@ static bool replay_free(lphash_t* htbl, replay_stats_t* statsp, const uchar* buf
 
 static bool dirtywork(uintptr_t addresses[], size_t len, const uchar* buffer, size_t buffersz);
 
-static inline float stat2float(size_t count, clock_t clock){
-  float retval = 0;
-  if(count != 0){
-    retval = (clock/(float)count);
-  }
-  return retval;
-}
-
 static void dump_stats(FILE* fp,  replay_stats_t* statsp){
-  fprintf(fp, "malloc   %.2f  clocks per call\n",  stat2float(statsp->malloc_count, statsp->malloc_clock));
-  fprintf(fp, "free   %.2f  clocks per call\n",  stat2float(statsp->free_count, statsp->free_clock));
-  fprintf(fp, "calloc   %.2f  clocks per call\n",  stat2float(statsp->calloc_count, statsp->calloc_clock));
-  fprintf(fp, "realloc  %.2f  clocks per call\n",  stat2float(statsp->realloc_count, statsp->realloc_clock));
+  dump_latency(fp, statsp);
 }
 
 
@@ -249,14 +231,13 @@ static bool replayline(lphash_t* htbl, replay_stats_t* statsp, const uchar* buff
 
 static void *_r_malloc(replay_stats_t* statsp, size_t size){
   void* rptr;
-  clock_t start;
+  uint64_t start;
 
-  start = clock();
+  start = latency_now();
 
   rptr = malloc(size);
   
-  statsp->malloc_clock += clock() - start;
-  statsp->malloc_count++;
+  latency_record(statsp, LATENCY_MALLOC, size, start);
 
   if(track_allocations || rptr == NULL){
     fprintf(stderr, "malloc returned %p of requested size %zu\n", rptr, size);
@@ -267,14 +248,13 @@ static void *_r_malloc(replay_stats_t* statsp, size_t size){
 
 static void *_r_realloc(replay_stats_t* statsp, void *ptr, size_t size){
   void* rptr;
-  clock_t start;
+  uint64_t start;
   
-  start = clock();
+  start = latency_now();
 
   rptr  = realloc(ptr, size);
 
-  statsp->realloc_clock += clock() - start;
-  statsp->realloc_count++;
+  latency_record(statsp, LATENCY_REALLOC, size, start);
   
   if(track_allocations || rptr == NULL){
     fprintf(stderr, "realloc returned %p of requested size %zu\n", rptr, size);
@@ -285,35 +265,33 @@ static void *_r_realloc(replay_stats_t* statsp, void *ptr, size_t size){
 
 static void * _r_calloc(replay_stats_t* statsp, size_t count, size_t size){
   void* rptr;
-  clock_t start;
+  uint64_t start;
 
-  start = clock();
+  start = latency_now();
     
   rptr = calloc(count, size);
 
+  latency_record(statsp, LATENCY_CALLOC, count * size, start);
+
   if(track_allocations || rptr == NULL){
     fprintf(stderr, "realloc returned %p of requested size %zu\n", rptr, count * size);
   }
-  
-  statsp->calloc_clock += clock() - start;
-  statsp->calloc_count++;
 
   return rptr;
 }
 
 static void _r_free(replay_stats_t* statsp, void *ptr){
-  clock_t start;
+  uint64_t start;
 
   if(track_allocations){
     fprintf(stderr, "freeing %p\n", ptr);
   }
 
-  start = clock();
+  start = latency_now();
 
   free(ptr);
   
-  statsp->free_clock += clock() - start;
-  statsp->free_count++;
+  latency_record(statsp, LATENCY_FREE, LATENCY_NOSIZE, start);
   
 
 }
@@ -0,0 +1,1097 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "replayops.h"
+
+#include "mhook.h"
+
+#include "lphash.h"
+
+#include "latency.h"
+
+#include "malloc.h"
+
+/* slots[i] of a block the replay failed to allocate */
+#define FAILED  ((void*)-1)
+
+/* the spins before a waiting thread yields */
+#define SPINS   64
+
+/* the buffers of the footprint's timeline and of the malloc_info output it reads */
+#define FOOTPRINT_BUFFER  (64 * 1024)
+#define INFO_BUFFER       (1024 * 1024)
+
+/* touch_read reads a byte of each cache line */
+#define TOUCH_STRIDE  64
+
+static void* map_array(size_t count, size_t size){
+  void* memory;
+
+  if(count == 0){
+    count = 1;
+  }
+  memory = mmap(NULL, count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return memory == MAP_FAILED ? NULL : memory;
+}
+
+static void unmap_array(void* memory, size_t count, size_t size){
+  if(memory != NULL){
+    munmap(memory, (count == 0 ? 1 : count) * size);
+  }
+}
+
+/*
+ * The merge of the threads' records in mhook_order: a binary heap of
+ * the threads, keyed by their next record.
+ */
+typedef struct merge {
+  const mhook_record_t* records;
+  size_t** index;              /* index[t][i] is the i-th record of thread t */
+  size_t* next;                /* the position in index[t] of thread t's next record */
+  size_t* counts;
+  uint32_t* heap;
+  uint32_t size;
+} merge_t;
+
+static inline bool merge_less(merge_t* m, uint32_t a, uint32_t b){
+  const mhook_record_t* ra = &m->records[m->index[a][m->next[a]]];
+  const mhook_record_t* rb = &m->records[m->index[b][m->next[b]]];
+  uint64_t oa = mhook_order(ra), ob = mhook_order(rb);
+
+  return oa < ob || (oa == ob && a < b);
+}
+
+static void merge_down(merge_t* m, uint32_t i){
+  uint32_t child, tmp;
+
+  for(;;){
+    child = 2 * i + 1;
+    if(child >= m->size){
+      return;
+    }
+    if(child + 1 < m->size && merge_less(m, m->heap[child + 1], m->heap[child])){
+      child++;
+    }
+    if(!merge_less(m, m->heap[child], m->heap[i])){
+      return;
+    }
+    tmp = m->heap[i];
+    m->heap[i] = m->heap[child];
+    m->heap[child] = tmp;
+    i = child;
+  }
+}
+
+/* the next record in mhook_order, or NULL; sets *threadp to its thread */
+static const mhook_record_t* merge_pop(merge_t* m, uint32_t* threadp){
+  const mhook_record_t* r;
+  uint32_t t;
+
+  if(m->size == 0){
+    return NULL;
+  }
+  t = m->heap[0];
+  r = &m->records[m->index[t][m->next[t]]];
+  *threadp = t;
+  if(++m->next[t] == m->counts[t]){
+    m->heap[0] = m->heap[--m->size];
+  }
+  merge_down(m, 0);
+  return r;
+}
+
+/* what turning the traced calls into slots needs */
+typedef struct loader {
+  replay_program_t* program;
+  lphash_t htbl;               /* traced address => its slot + 1 */
+  lphash_t displaced;          /* traced address => the slot + 1 it had when it was handed out again */
+  lphash_t displaced_at;       /* traced address => when (mhook_order + 1) that was */
+  uint32_t* owners;            /* owners[i] is the thread that allocated slot i */
+  size_t nallocs;              /* the most slots there can be */
+  bool serial;
+} loader_t;
+
+/*
+ * A realloc frees its argument before it returns, which is when it is
+ * ordered, so another thread may be handed the same address (and be
+ * ordered) first. The block that was there is kept aside as displaced,
+ * for a realloc of the address that was called before the address was
+ * handed out again; otherwise it was a block we missed the free of.
+ */
+static uint32_t new_slot(loader_t* loader, uint64_t addr, uint64_t when, uint32_t thread){
+  uint32_t slot = loader->program->nslots++;
+  void* key = (void*)(uintptr_t)addr;
+  void* value = lphash_lookup(&loader->htbl, key);
+
+  if(value != NULL){
+    lphash_delete(&loader->htbl, key);
+    lphash_delete(&loader->displaced, key);
+    lphash_delete(&loader->displaced_at, key);
+    lphash_insert(&loader->displaced, key, value);
+    lphash_insert(&loader->displaced_at, key, (void*)(uintptr_t)(when + 1));
+  }
+  lphash_insert(&loader->htbl, key, (void*)(uintptr_t)(slot + 1));
+  loader->owners[slot] = thread;
+  return slot;
+}
+
+/* the slot of the traced block at addr, which is being freed, or NO_SLOT if we never saw it allocated */
+static uint32_t old_slot(loader_t* loader, uint64_t addr){
+  void* value = lphash_lookup(&loader->htbl, (void*)(uintptr_t)addr);
+
+  if(value == NULL){
+    return NO_SLOT;
+  }
+  lphash_delete(&loader->htbl, (void*)(uintptr_t)addr);
+  return (uint32_t)((uintptr_t)value - 1);
+}
+
+/* the slot of the traced block at addr that a realloc called at started is freeing (see new_slot) */
+static uint32_t realloc_slot(loader_t* loader, uint64_t addr, uint64_t started){
+  void* key = (void*)(uintptr_t)addr;
+  void* at = lphash_lookup(&loader->displaced_at, key);
+  void* value;
+
+  if(at != NULL && started < (uintptr_t)at - 1){
+    value = lphash_lookup(&loader->displaced, key);
+    lphash_delete(&loader->displaced, key);
+    lphash_delete(&loader->displaced_at, key);
+    return (uint32_t)((uintptr_t)value - 1);
+  }
+  return old_slot(loader, addr);
+}
+
+/* appends the call to the ops of thread t; the calls must come in mhook_order */
+static void add_call(loader_t* loader, const mhook_record_t* r, uint32_t t){
+  replay_program_t* program = loader->program;
+  replay_thread_t* thread;
+  replay_op_t* op;
+
+  /* t stays the traced thread, for owners and remote */
+  thread = &program->threads[loader->serial ? 0 : t];
+  if(thread->count == 0){
+    thread->tid = r->tid;
+  }
+  op = &thread->ops[thread->count];
+  memset(op, 0, sizeof(replay_op_t));
+  op->in = NO_SLOT;
+  op->out = NO_SLOT;
+
+  switch(r->op){
+  case 'm':
+    op->kind = OP_MALLOC;
+    op->size = r->size;
+    if(r->ptr != 0){
+      op->out = new_slot(loader, r->ptr, mhook_order(r), t);
+    }
+    break;
+  case 'c':
+    op->kind = OP_CALLOC;
+    op->size = r->size;
+    op->size2 = r->size2;
+    if(r->size2 > UINT32_MAX){
+      op->size = r->size * r->size2;
+      op->size2 = 1;
+    }
+    if(r->ptr != 0){
+      op->out = new_slot(loader, r->ptr, mhook_order(r), t);
+    }
+    break;
+  case 'r':
+    op->kind = OP_REALLOC;
+    op->size = r->size;
+    if(r->ptr != 0){
+      /* realloc of a block we never saw allocated: a malloc will do */
+      op->in = realloc_slot(loader, r->ptr, r->timestamp);
+    }
+    if(r->ptr2 != 0){
+      op->out = new_slot(loader, r->ptr2, mhook_order(r), t);
+    }
+    break;
+  case 'f':
+    op->kind = OP_FREE;
+    if(r->ptr != 0){
+      op->in = old_slot(loader, r->ptr);
+      if(op->in == NO_SLOT){
+        /* this is a pretty common occurence */
+        program->skipped++;
+        return;
+      }
+    }
+    break;
+  default:
+    return;
+  }
+
+  if(op->in != NO_SLOT && loader->owners[op->in] != t){
+    op->remote = 1;
+  }
+  thread->count++;
+  program->nops++;
+}
+
+/* sets up the program's threads, with room for counts[t] calls in thread t, and its slots */
+static bool init_loader(loader_t* loader, replay_program_t* program, uint32_t nthreads, const size_t* counts, size_t nallocs, bool serial){
+  size_t total;
+  uint32_t t;
+
+  loader->program = program;
+  loader->nallocs = nallocs;
+  loader->serial = serial || nthreads <= 1;
+  loader->owners = NULL;
+
+  if (!init_lphash(&loader->htbl) || !init_lphash(&loader->displaced) || !init_lphash(&loader->displaced_at)) {
+    fprintf(stderr, "Could not initialize the linear pool hashtable: %s\n", strerror(errno));
+    return false;
+  }
+  if(nallocs >= NO_SLOT){
+    fprintf(stderr, "Too many allocations\n");
+    return false;
+  }
+
+  program->traced_threads = nthreads;
+  program->nthreads = loader->serial ? 1 : nthreads;
+  program->threads = map_array(program->nthreads, sizeof(replay_thread_t));
+  program->slots = map_array(nallocs, sizeof(void*));
+  loader->owners = map_array(nallocs, sizeof(uint32_t));
+  if(program->threads == NULL || program->slots == NULL || loader->owners == NULL){
+    fprintf(stderr, "Out of memory\n");
+    return false;
+  }
+  program->capacity = nallocs;
+  if(loader->serial){
+    for(total = 0, t = 0; t < nthreads; t++){
+      total += counts[t];
+    }
+    program->threads[0].count = total;
+  } else {
+    for(t = 0; t < nthreads; t++){
+      program->threads[t].count = counts[t];
+    }
+  }
+  for(t = 0; t < program->nthreads; t++){
+    program->threads[t].ops = map_array(program->threads[t].count, sizeof(replay_op_t));
+    if(program->threads[t].ops == NULL){
+      fprintf(stderr, "Out of memory\n");
+      return false;
+    }
+    program->threads[t].capacity = program->threads[t].count;
+    program->threads[t].count = 0;
+  }
+  return true;
+}
+
+static void fini_loader(loader_t* loader){
+  unmap_array(loader->owners, loader->nallocs, sizeof(uint32_t));
+  delete_lphash(&loader->htbl);
+  delete_lphash(&loader->displaced);
+  delete_lphash(&loader->displaced_at);
+}
+
+static inline bool is_allocation(const mhook_record_t* r){
+  return ((r->op == 'm' || r->op == 'c') && r->ptr != 0) || (r->op == 'r' && r->ptr2 != 0);
+}
+
+bool merge_trace(const mhook_record_t* records, size_t count, void (*call)(const mhook_record_t* r, uint32_t thread, void* arg), void* arg){
+  const mhook_record_t* r;
+  merge_t merge;
+  size_t index;
+  uint32_t nthreads, t;
+  bool retval;
+
+  memset(&merge, 0, sizeof(merge_t));
+  retval = false;
+
+  nthreads = 0;
+  for(index = 0; index < count; index++){
+    if(records[index].thread >= nthreads){
+      nthreads = records[index].thread + 1;
+    }
+  }
+  merge.records = records;
+  merge.counts = map_array(nthreads, sizeof(size_t));
+  merge.next = map_array(nthreads, sizeof(size_t));
+  merge.index = map_array(nthreads, sizeof(size_t*));
+  merge.heap = map_array(nthreads, sizeof(uint32_t));
+  if(merge.counts == NULL || merge.next == NULL || merge.index == NULL || merge.heap == NULL){
+    fprintf(stderr, "Out of memory\n");
+    goto exit;
+  }
+  for(index = 0; index < count; index++){
+    merge.counts[records[index].thread]++;
+  }
+
+  for(t = 0; t < nthreads; t++){
+    merge.index[t] = map_array(merge.counts[t], sizeof(size_t));
+    if(merge.index[t] == NULL){
+      fprintf(stderr, "Out of memory\n");
+      goto exit;
+    }
+    if(merge.counts[t] > 0){
+      merge.heap[merge.size++] = t;
+    }
+  }
+  for(index = 0; index < count; index++){
+    t = records[index].thread;
+    merge.index[t][merge.next[t]++] = index;
+  }
+  for(t = 0; t < nthreads; t++){
+    merge.next[t] = 0;
+  }
+  for(index = merge.size / 2 + 1; index > 0; index--){
+    merge_down(&merge, index - 1);
+  }
+
+  while((r = merge_pop(&merge, &t)) != NULL){
+    call(r, t, arg);
+  }
+  retval = true;
+
+ exit:
+
+  for(t = 0; merge.index != NULL && t < nthreads; t++){
+    unmap_array(merge.index[t], merge.counts[t], sizeof(size_t));
+  }
+  unmap_array(merge.index, nthreads, sizeof(size_t*));
+  unmap_array(merge.heap, nthreads, sizeof(uint32_t));
+  unmap_array(merge.next, nthreads, sizeof(size_t));
+  unmap_array(merge.counts, nthreads, sizeof(size_t));
+  return retval;
+}
+
+static void merge_call(const mhook_record_t* r, uint32_t thread, void* loader){
+  add_call(loader, r, thread);
+}
+
+mhook_record_t* decode_trace(const char* filename, const void* map, size_t length, size_t* countp){
+  const mhook_header_t* header = map;
+  const uint8_t* blocks = (const uint8_t*)(header + 1);
+  mhook_record_t* records;
+  size_t count;
+
+  if(length < sizeof(mhook_header_t)){
+    fprintf(stderr, "%s is truncated\n", filename);
+    return NULL;
+  }
+  if(header->version != MHOOK_VERSION || header->record_size != sizeof(mhook_record_t)){
+    fprintf(stderr, "%s is version %u with %u byte records, not version %u with %zu\n", filename,
+            header->version, header->record_size, MHOOK_VERSION, sizeof(mhook_record_t));
+    return NULL;
+  }
+  length -= sizeof(mhook_header_t);
+  count = mhook_decode_blocks(blocks, length, NULL);
+  if(count == SIZE_MAX){
+    fprintf(stderr, "%s is truncated or garbled\n", filename);
+    return NULL;
+  }
+  records = map_array(count, sizeof(mhook_record_t));
+  if(records == NULL){
+    fprintf(stderr, "Out of memory\n");
+    return NULL;
+  }
+  mhook_decode_blocks(blocks, length, records);
+  *countp = count;
+  return records;
+}
+
+void delete_records(mhook_record_t* records, size_t count){
+  unmap_array(records, count, sizeof(mhook_record_t));
+}
+
+static bool load_binary(const char* filename, const void* map, size_t length, bool serial, replay_program_t* program){
+  mhook_record_t* records;
+  loader_t loader;
+  size_t count, index, nallocs;
+  size_t* counts;
+  uint32_t nthreads;
+  bool retval;
+
+  memset(&loader, 0, sizeof(loader_t));
+  retval = false;
+
+  records = decode_trace(filename, map, length, &count);
+  if(records == NULL){
+    return false;
+  }
+
+  /* the threads, and how many records and allocations each has */
+  nthreads = 0;
+  for(index = 0; index < count; index++){
+    if(records[index].thread >= nthreads){
+      nthreads = records[index].thread + 1;
+    }
+  }
+  counts = map_array(nthreads, sizeof(size_t));
+  if(counts == NULL){
+    fprintf(stderr, "Out of memory\n");
+    delete_records(records, count);
+    return false;
+  }
+  nallocs = 0;
+  for(index = 0; index < count; index++){
+    counts[records[index].thread]++;
+    if(is_allocation(&records[index])){
+      nallocs++;
+    }
+  }
+
+  /* the calls, in mhook_order, with the traced addresses turned into slots */
+  if(init_loader(&loader, program, nthreads, counts, nallocs, serial)){
+    retval = merge_trace(records, count, merge_call, &loader);
+  }
+
+  unmap_array(counts, nthreads, sizeof(size_t));
+  if(loader.program != NULL){
+    fini_loader(&loader);
+  }
+  delete_records(records, count);
+  return retval;
+}
+
+/* the hex number (with or without 0x) after the blanks at *cursor, or false if there is none */
+static inline bool parse_hex(const char** cursor, const char* end, uint64_t* value){
+  const char* c = *cursor;
+  uint64_t v = 0;
+  const char* digits;
+  int digit;
+
+  while(c < end && *c == ' '){
+    c++;
+  }
+  if(c + 1 < end && c[0] == '0' && (c[1] == 'x' || c[1] == 'X')){
+    c += 2;
+  }
+  for(digits = c; c < end; c++){
+    if(*c >= '0' && *c <= '9'){
+      digit = *c - '0';
+    } else if(*c >= 'a' && *c <= 'f'){
+      digit = *c - 'a' + 10;
+    } else if(*c >= 'A' && *c <= 'F'){
+      digit = *c - 'A' + 10;
+    } else {
+      break;
+    }
+    v = (v << 4) | digit;
+  }
+  if(c == digits){
+    return false;
+  }
+  *cursor = c;
+  *value = v;
+  return true;
+}
+
+bool parse_trace_line(const char* start, const char* end, mhook_record_t* r){
+  uint64_t fields[4];
+  size_t nfields, index;
+  const char* c;
+
+  memset(r, 0, sizeof(mhook_record_t));
+  if(end - start < 2 || start[1] != ' '){
+    return false;
+  }
+  r->op = start[0];
+  switch(r->op){
+  case 'm': nfields = MALLOCARGS; break;
+  case 'f': nfields = FREEARGS; break;
+  case 'c': nfields = CALLOCARGS; break;
+  case 'r': nfields = REALLOCARGS; break;
+  case 'i':
+  case 'e': return true;
+  default: return false;
+  }
+  c = start + 1;
+  for(index = 0; index < nfields; index++){
+    if(!parse_hex(&c, end, &fields[index])){
+      return false;
+    }
+  }
+  switch(r->op){
+  case 'm':
+    r->size = fields[0]; r->ptr = fields[1]; r->caller = fields[2];
+    break;
+  case 'f':
+    r->ptr = fields[0]; r->caller = fields[1];
+    break;
+  case 'c':
+    r->size = fields[0]; r->size2 = fields[1]; r->ptr = fields[2]; r->caller = fields[3];
+    break;
+  case 'r':
+    r->ptr = fields[0]; r->size = fields[1]; r->ptr2 = fields[2]; r->caller = fields[3];
+    break;
+  }
+  return true;
+}
+
+/* a text trace is a single thread's, in order */
+static bool load_text(const char* filename, const char* text, size_t length, replay_program_t* program){
+  const char* end = text + length;
+  const char* line;
+  const char* eol;
+  mhook_record_t r;
+  loader_t loader;
+  size_t count, nallocs, linecount;
+  bool retval;
+
+  /* every line is at most one call, and every m, c or r at most one allocation */
+  count = nallocs = 0;
+  for(line = text; line < end; line = eol + 1){
+    eol = memchr(line, '\n', end - line);
+    if(eol == NULL){
+      eol = end;
+    }
+    count++;
+    if(line[0] == 'm' || line[0] == 'c' || line[0] == 'r'){
+      nallocs++;
+    }
+  }
+
+  memset(&loader, 0, sizeof(loader_t));
+  retval = init_loader(&loader, program, 1, &count, nallocs, true);
+
+  linecount = 0;
+  for(line = text; retval && line < end; line = eol + 1){
+    eol = memchr(line, '\n', end - line);
+    if(eol == NULL){
+      eol = end;
+    }
+    linecount++;
+    if(!parse_trace_line(line, eol, &r)){
+      fprintf(stderr, "Loading line %zu failed: %.*s\n", linecount, (int)(eol - line), line);
+      retval = false;
+      break;
+    }
+    add_call(&loader, &r, 0);
+  }
+
+  if(loader.program != NULL){
+    fini_loader(&loader);
+  }
+  return retval;
+}
+
+bool load_program(const char* filename, bool serial, replay_program_t* program){
+  struct stat sb;
+  void* map;
+  bool retval;
+  int fd;
+
+  memset(program, 0, sizeof(replay_program_t));
+
+  fd = open(filename, O_RDONLY);
+  if(fd < 0 || fstat(fd, &sb) != 0){
+    fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+    if(fd >= 0){
+      close(fd);
+    }
+    return false;
+  }
+  if(sb.st_size == 0){
+    close(fd);
+    return true;
+  }
+  map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED){
+    fprintf(stderr, "Could not map %s: %s\n", filename, strerror(errno));
+    return false;
+  }
+  madvise(map, sb.st_size, MADV_SEQUENTIAL);
+
+  if((size_t)sb.st_size >= sizeof(mhook_header_t) && memcmp(map, MHOOK_MAGIC, sizeof(((mhook_header_t*)0)->magic)) == 0){
+    retval = load_binary(filename, map, sb.st_size, serial, program);
+  } else {
+    retval = load_text(filename, map, sb.st_size, program);
+  }
+
+  munmap(map, sb.st_size);
+  if(!retval){
+    delete_program(program);
+  }
+  return retval;
+}
+
+static void delete_footprint(replay_footprint_t* fp, size_t nslots);
+
+void delete_program(replay_program_t* program){
+  uint32_t t;
+
+  for(t = 0; program->threads != NULL && t < program->nthreads; t++){
+    unmap_array(program->threads[t].ops, program->threads[t].capacity, sizeof(replay_op_t));
+    unmap_array(program->threads[t].latency, 1, sizeof(latency_stats_t));
+  }
+  unmap_array(program->threads, program->nthreads, sizeof(replay_thread_t));
+  unmap_array(program->slots, program->capacity, sizeof(void*));
+  delete_footprint(program->footprint, program->capacity);
+  unmap_array(program->touched, program->capacity, sizeof(uint64_t));
+  memset(program, 0, sizeof(replay_program_t));
+}
+
+static const char* column_names[FP_COLUMNS] = { "requested", "usable", "metadata_used", "metadata_mapped", "rss" };
+
+static void delete_footprint(replay_footprint_t* fp, size_t nslots){
+  if(fp == NULL){
+    return;
+  }
+  if(fp->csv != NULL){
+    fclose(fp->csv);
+  }
+  if(fp->info != NULL){
+    fclose(fp->info);
+  }
+  if(fp->statm >= 0){
+    close(fp->statm);
+  }
+  unmap_array(fp->csv_buffer, FOOTPRINT_BUFFER, 1);
+  unmap_array(fp->info_buffer, INFO_BUFFER, 1);
+  unmap_array(fp->requested, nslots, sizeof(uint64_t));
+  unmap_array(fp->usable, nslots, sizeof(uint64_t));
+  unmap_array(fp, 1, sizeof(replay_footprint_t));
+}
+
+bool init_footprint(replay_program_t* program, const char* csvname, size_t interval){
+  replay_footprint_t* fp;
+  int column;
+
+  if(program->nthreads > 1){
+    fprintf(stderr, "Only the footprint of a single thread can be tracked\n");
+    return false;
+  }
+  fp = map_array(1, sizeof(replay_footprint_t));
+  if(fp == NULL){
+    fprintf(stderr, "Out of memory\n");
+    return false;
+  }
+  program->footprint = fp;
+  fp->statm = -1;
+  fp->interval = interval == 0 ? 1 : interval;
+
+  /* the buffers are mmapped, so that the timeline is written without using the heap */
+  fp->requested = map_array(program->capacity, sizeof(uint64_t));
+  fp->usable = map_array(program->capacity, sizeof(uint64_t));
+  fp->csv_buffer = map_array(FOOTPRINT_BUFFER, 1);
+  fp->info_buffer = map_array(INFO_BUFFER, 1);
+  if(fp->requested == NULL || fp->usable == NULL || fp->csv_buffer == NULL || fp->info_buffer == NULL){
+    fprintf(stderr, "Out of memory\n");
+    return false;
+  }
+
+  fp->csv = fopen(csvname, "w");
+  if(fp->csv == NULL){
+    fprintf(stderr, "Could not open %s: %s\n", csvname, strerror(errno));
+    return false;
+  }
+  setvbuf(fp->csv, fp->csv_buffer, _IOFBF, FOOTPRINT_BUFFER);
+  fp->info = fmemopen(fp->info_buffer, INFO_BUFFER, "w");
+  if(fp->info == NULL){
+    fprintf(stderr, "Could not open a memory stream: %s\n", strerror(errno));
+    return false;
+  }
+  setvbuf(fp->info, NULL, _IONBF, 0);
+  fp->statm = open("/proc/self/statm", O_RDONLY);
+
+  fprintf(fp->csv, "calls");
+  for(column = 0; column < FP_COLUMNS; column++){
+    fprintf(fp->csv, ",%s", column_names[column]);
+  }
+  fprintf(fp->csv, "\n");
+  return true;
+}
+
+void dump_footprint_peaks(FILE* out, replay_program_t* program){
+  replay_footprint_t* fp = program->footprint;
+  int column;
+
+  if(fp == NULL){
+    return;
+  }
+  for(column = 0; column < FP_COLUMNS; column++){
+    fprintf(out, "peak %-16s %14" PRIu64 " bytes at call %zu\n", column_names[column], fp->peak[column], fp->peak_calls[column]);
+  }
+}
+
+
+typedef struct runner {
+  replay_program_t* program;
+  replay_thread_t* thread;
+  pthread_barrier_t* start;    /* NULL when run by the calling thread */
+  replay_footprint_t* footprint;
+} runner_t;
+
+static inline void publish(void** slots, uint32_t slot, void* ptr){
+  if(slot != NO_SLOT){
+    __atomic_store_n(&slots[slot], ptr == NULL ? FAILED : ptr, __ATOMIC_RELEASE);
+  }
+}
+
+/* the replay's block for the slot, once its allocating thread has published it */
+static inline void* handoff(void** slots, uint32_t slot, replay_thread_t* thread){
+  void* ptr;
+  int spins;
+
+  if(slot == NO_SLOT){
+    return NULL;
+  }
+  ptr = __atomic_load_n(&slots[slot], __ATOMIC_ACQUIRE);
+  if(ptr == NULL){
+    thread->waits++;
+    for(spins = 0; (ptr = __atomic_load_n(&slots[slot], __ATOMIC_ACQUIRE)) == NULL; spins++){
+      if(spins >= SPINS){
+        sched_yield();
+      }
+    }
+  }
+  return ptr == FAILED ? NULL : ptr;
+}
+
+/* the bytes of /proc/self/statm's second field (the resident pages) */
+static uint64_t resident_bytes(int statm){
+  char buffer[128];
+  ssize_t length;
+  char* rest;
+
+  length = pread(statm, buffer, sizeof(buffer) - 1, 0);
+  if(length <= 0){
+    return 0;
+  }
+  buffer[length] = '\0';
+  strtoull(buffer, &rest, 10);
+  return strtoull(rest, NULL, 10) * sysconf(_SC_PAGESIZE);
+}
+
+/* the size of the last (the total) <metadata type="..." size="..."/> of the malloc_info output, or zero */
+static uint64_t info_metadata(const char* info, const char* type){
+  char key[64];
+  const char* found;
+  const char* last;
+
+  snprintf(key, sizeof(key), "<metadata type=\"%s\" size=\"", type);
+  for(last = NULL, found = info; (found = strstr(found, key)) != NULL; found++){
+    last = found;
+  }
+  return last == NULL ? 0 : strtoull(last + strlen(key), NULL, 10);
+}
+
+static inline void track_peak(replay_footprint_t* fp, enum replay_column column){
+  if(fp->current[column] > fp->peak[column]){
+    fp->peak[column] = fp->current[column];
+    fp->peak_calls[column] = fp->calls;
+  }
+}
+
+static void sample_footprint(replay_footprint_t* fp){
+  int column;
+
+  rewind(fp->info);
+  fp->info_buffer[0] = '\0';
+  malloc_info(0, fp->info);
+  fflush(fp->info);
+  fp->current[FP_METADATA_USED] = info_metadata(fp->info_buffer, "used");
+  fp->current[FP_METADATA_MAPPED] = info_metadata(fp->info_buffer, "mapped");
+  fp->current[FP_RSS] = resident_bytes(fp->statm);
+  track_peak(fp, FP_METADATA_USED);
+  track_peak(fp, FP_METADATA_MAPPED);
+  track_peak(fp, FP_RSS);
+
+  fprintf(fp->csv, "%zu", fp->calls);
+  for(column = 0; column < FP_COLUMNS; column++){
+    fprintf(fp->csv, ",%" PRIu64, fp->current[column]);
+  }
+  fprintf(fp->csv, "\n");
+}
+
+static inline void track_alloc(replay_footprint_t* fp, uint32_t slot, uint64_t size, void* ptr){
+  if(slot == NO_SLOT || ptr == NULL){
+    return;
+  }
+  fp->requested[slot] = size;
+  fp->usable[slot] = malloc_usable_size(ptr);
+  fp->current[FP_REQUESTED] += fp->requested[slot];
+  fp->current[FP_USABLE] += fp->usable[slot];
+  track_peak(fp, FP_REQUESTED);
+  track_peak(fp, FP_USABLE);
+}
+
+static inline void track_free(replay_footprint_t* fp, uint32_t slot){
+  if(slot == NO_SLOT){
+    return;
+  }
+  fp->current[FP_REQUESTED] -= fp->requested[slot];
+  fp->current[FP_USABLE] -= fp->usable[slot];
+  fp->requested[slot] = fp->usable[slot] = 0;
+}
+
+static inline void track_call(replay_footprint_t* fp){
+  if(++fp->calls % fp->interval == 0){
+    sample_footprint(fp);
+  }
+}
+
+/* writes the touched fraction of slot's new block */
+static inline void touch_write(replay_program_t* program, uint32_t slot, uint64_t size, void* ptr){
+  uint64_t bytes;
+
+  if(slot == NO_SLOT || ptr == NULL){
+    return;
+  }
+  bytes = (uint64_t)(size * program->touch);
+  if(bytes > size){
+    bytes = size;
+  }
+  memset(ptr, (int)(slot & 0xFF), bytes);
+  program->touched[slot] = bytes;
+}
+
+/* reads a byte of each cache line (TOUCH_STRIDE) of what was written of slot's block */
+static inline uint64_t touch_read(replay_program_t* program, uint32_t slot, const void* ptr){
+  const char* bytes = ptr;
+  uint64_t sum, offset, length;
+
+  if(slot == NO_SLOT || ptr == NULL){
+    return 0;
+  }
+  length = program->touched[slot];
+  for(sum = 0, offset = 0; offset < length; offset += TOUCH_STRIDE){
+    sum += (uint8_t)bytes[offset];
+  }
+  return sum;
+}
+
+/*
+ * The thread's calls; when timed, each one's latency (not counting any
+ * wait for a handoff, or the touching of the blocks), when there is a
+ * footprint, the footprint, and when touching, the touching.
+ */
+static inline void run_ops(replay_program_t* program, replay_thread_t* thread, bool timed, replay_footprint_t* footprint, bool touching){
+  latency_stats_t* latency = thread->latency;
+  void** slots = program->slots;
+  replay_op_t* op;
+  replay_op_t* end;
+  uint64_t start = 0;
+  uint64_t checksum = 0;
+  void* ptr;
+
+  for(op = thread->ops, end = op + thread->count; op < end; op++){
+    switch(op->kind){
+    case OP_MALLOC:
+      if(timed) start = latency_now();
+      ptr = malloc(op->size);
+      if(timed) latency_record(latency, LATENCY_MALLOC, op->size, start);
+      if(footprint) track_alloc(footprint, op->out, op->size, ptr);
+      if(touching) touch_write(program, op->out, op->size, ptr);
+      publish(slots, op->out, ptr);
+      break;
+    case OP_CALLOC:
+      if(timed) start = latency_now();
+      ptr = calloc(op->size, op->size2);
+      if(timed) latency_record(latency, LATENCY_CALLOC, op->size * op->size2, start);
+      if(footprint) track_alloc(footprint, op->out, op->size * op->size2, ptr);
+      if(touching) touch_write(program, op->out, op->size * op->size2, ptr);
+      publish(slots, op->out, ptr);
+      break;
+    case OP_REALLOC:
+      ptr = handoff(slots, op->in, thread);
+      thread->remote_frees += op->remote;
+      if(touching) checksum += touch_read(program, op->in, ptr);
+      if(timed) start = latency_now();
+      ptr = realloc(ptr, op->size);
+      if(timed) latency_record(latency, LATENCY_REALLOC, op->size, start);
+      if(footprint){
+        /* a failed realloc leaves the old block be; realloc to 0 frees it */
+        if(ptr != NULL || op->size == 0) track_free(footprint, op->in);
+        track_alloc(footprint, op->out, op->size, ptr);
+      }
+      if(touching) touch_write(program, op->out, op->size, ptr);
+      publish(slots, op->out, ptr);
+      break;
+    case OP_FREE:
+      ptr = handoff(slots, op->in, thread);
+      thread->remote_frees += op->remote;
+      if(touching) checksum += touch_read(program, op->in, ptr);
+      if(timed) start = latency_now();
+      free(ptr);
+      if(timed) latency_record(latency, LATENCY_FREE, LATENCY_NOSIZE, start);
+      if(footprint) track_free(footprint, op->in);
+      break;
+    }
+    if(footprint) track_call(footprint);
+  }
+  thread->checksum = checksum;
+}
+
+static void* run_thread(void* arg){
+  runner_t* runner = (runner_t*)arg;
+  replay_program_t* program = runner->program;
+  replay_thread_t* thread = runner->thread;
+
+  if(runner->start != NULL){
+    pthread_barrier_wait(runner->start);
+  }
+
+  /* the plain loop is kept apart, so that nothing is left in it to test */
+  if(thread->latency == NULL && runner->footprint == NULL && program->touched == NULL){
+    run_ops(program, thread, false, NULL, false);
+  } else {
+    run_ops(program, thread, thread->latency != NULL, runner->footprint, program->touched != NULL);
+  }
+  if(runner->footprint != NULL){
+    sample_footprint(runner->footprint);
+  }
+  return NULL;
+}
+
+double run_program(replay_program_t* program){
+  pthread_barrier_t start;
+  struct timespec begin, end;
+  pthread_t* threads;
+  runner_t* runners;
+  runner_t runner;
+  uint32_t t;
+  int rc;
+
+  if(program->touch > 0 && program->touched == NULL){
+    program->touched = map_array(program->capacity, sizeof(uint64_t));
+  }
+  for(t = 0; program->timed && t < program->nthreads; t++){
+    if(program->threads[t].latency == NULL){
+      program->threads[t].latency = map_array(1, sizeof(latency_stats_t));
+    }
+  }
+
+  if(program->nthreads <= 1){
+    runner.program = program;
+    runner.thread = program->threads;
+    runner.start = NULL;
+    runner.footprint = program->footprint;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    if(program->nthreads == 1){
+      run_thread(&runner);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - begin.tv_sec) + (double)(end.tv_nsec - begin.tv_nsec) / 1e9;
+  }
+
+  threads = map_array(program->nthreads, sizeof(pthread_t));
+  runners = map_array(program->nthreads, sizeof(runner_t));
+  if(threads == NULL || runners == NULL){
+    fprintf(stderr, "Out of memory\n");
+    exit(-1);
+  }
+
+  pthread_barrier_init(&start, NULL, program->nthreads + 1);
+
+  for(t = 0; t < program->nthreads; t++){
+    runners[t].program = program;
+    runners[t].thread = &program->threads[t];
+    runners[t].start = &start;
+    runners[t].footprint = NULL;
+    rc = pthread_create(&threads[t], NULL, run_thread, &runners[t]);
+    if (rc){
+      fprintf(stderr, "return code from pthread_create() is %d\n", rc);
+      exit(-1);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  pthread_barrier_wait(&start);
+
+  for(t = 0; t < program->nthreads; t++){
+    rc = pthread_join(threads[t], NULL);
+    if (rc){
+      fprintf(stderr, "return code from pthread_join() is %d\n", rc);
+      exit(-1);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  pthread_barrier_destroy(&start);
+  unmap_array(runners, program->nthreads, sizeof(runner_t));
+  unmap_array(threads, program->nthreads, sizeof(pthread_t));
+
+  return (double)(end.tv_sec - begin.tv_sec) + (double)(end.tv_nsec - begin.tv_nsec) / 1e9;
+}
+
+void dump_program(FILE* fp, replay_program_t* program){
+  replay_thread_t* thread;
+  size_t waits, remote_frees;
+  uint32_t t;
+
+  waits = remote_frees = 0;
+  fprintf(fp, "%-8s %8s %12s %12s %12s\n", "thread", "tid", "calls", "remote frees", "waits");
+  for(t = 0; t < program->nthreads; t++){
+    thread = &program->threads[t];
+    if(thread->count == 0){
+      continue;
+    }
+    fprintf(fp, "%-8u %8u %12zu %12zu %12zu\n", t, thread->tid, thread->count, thread->remote_frees, thread->waits);
+    waits += thread->waits;
+    remote_frees += thread->remote_frees;
+  }
+  fprintf(fp, "%u threads, %zu calls, %u blocks, %zu remote frees, %zu waits, %zu unknown frees skipped\n",
+          program->nthreads, program->nops, program->nslots, remote_frees, waits, program->skipped);
+}
+
+/* the latencies of all the threads, merged into an mmapped latency_stats_t, or NULL */
+static latency_stats_t* merge_latency(replay_program_t* program){
+  latency_stats_t* total;
+  uint32_t t;
+
+  total = map_array(1, sizeof(latency_stats_t));
+  if(total == NULL){
+    return NULL;
+  }
+  for(t = 0; t < program->nthreads; t++){
+    if(program->threads[t].latency != NULL){
+      latency_merge(total, program->threads[t].latency);
+    }
+  }
+  return total;
+}
+
+void dump_program_latency(FILE* fp, replay_program_t* program){
+  latency_stats_t* total = merge_latency(program);
+
+  if(total != NULL){
+    dump_latency(fp, total);
+    unmap_array(total, 1, sizeof(latency_stats_t));
+  }
+}
+
+void summarize_program_latency(replay_program_t* program, double summary[LATENCY_SUMMARY]){
+  latency_stats_t* total = merge_latency(program);
+
+  memset(summary, 0, LATENCY_SUMMARY * sizeof(double));
+  if(total != NULL){
+    latency_summary(total, summary);
+    unmap_array(total, 1, sizeof(latency_stats_t));
+  }
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _REPLAY_OPS
+#define _REPLAY_OPS
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mhook.h"
+
+#include "latency.h"
+
+/*
+ * A trace turned into a program: for each thread of the trace, the
+ * array of its calls, in order.
+ *
+ * The blocks the trace allocates are numbered (slots) in the order of
+ * their allocation across all the threads (mhook_order), and the calls
+ * refer to slots rather than to the traced addresses. While the program
+ * runs, slots[i] holds the block the replay got for slot i, so a call
+ * that frees or reallocs a block allocated by another thread waits for
+ * that thread to have published it: the only synchronization between
+ * the threads is this handoff, one writer and one reader per slot.
+ * Since slots are numbered in a global order of the calls, every call
+ * waits only on calls before it, so the program cannot deadlock.
+ *
+ * All the arrays are mmapped, so loading does not disturb the heap
+ * being measured, and running a program does nothing between the calls
+ * but look up slots, so the time it takes is the allocator's.
+ */
+
+#define NO_SLOT  UINT32_MAX
+
+enum replay_kind { OP_MALLOC, OP_CALLOC, OP_REALLOC, OP_FREE };
+
+typedef struct replay_op {
+  uint8_t kind;                /* a replay_kind */
+  uint8_t remote;              /* frees (or reallocs) a block allocated by another thread of the trace */
+  uint16_t pad;
+  uint32_t size2;              /* calloc's size */
+  uint64_t size;               /* malloc and realloc's size, calloc's count */
+  uint32_t in;                 /* the slot freed or realloc'ed, or NO_SLOT for NULL */
+  uint32_t out;                /* the slot allocated, or NO_SLOT */
+} replay_op_t;
+
+typedef struct replay_thread {
+  uint32_t tid;                /* the traced thread's kernel id */
+  size_t count;
+  size_t capacity;             /* the ops array's length */
+  replay_op_t* ops;
+  /* what running it took */
+  size_t waits;                /* handoffs it had to wait for */
+  size_t remote_frees;
+  latency_stats_t* latency;    /* the calls' latencies, when the program is timed */
+  uint64_t checksum;           /* of what it read of the blocks it touched */
+} replay_thread_t;
+
+/*
+ * The footprint of a run, tracked call by call when asked for (see
+ * init_footprint): the bytes requested by, and the usable bytes of, the
+ * blocks live in the replay; and sampled every interval calls, the bytes
+ * of the allocator's metadata in use and mapped (as malloc_info reports
+ * them; zero for an allocator that does not), and the resident set size.
+ * Each sample is a line of the csv timeline. The peaks of the first two
+ * are exact, the others are those of the samples.
+ */
+
+enum replay_column { FP_REQUESTED, FP_USABLE, FP_METADATA_USED, FP_METADATA_MAPPED, FP_RSS, FP_COLUMNS };
+
+typedef struct replay_footprint {
+  FILE* csv;                   /* the timeline */
+  size_t interval;             /* the calls between samples */
+  size_t calls;
+  uint64_t* requested;         /* requested[i] is the size asked for slot i's block */
+  uint64_t* usable;            /* usable[i] is its malloc_usable_size */
+  uint64_t current[FP_COLUMNS];
+  uint64_t peak[FP_COLUMNS];
+  size_t peak_calls[FP_COLUMNS];
+  char* csv_buffer;
+  /* where malloc_info is written to, and read back from */
+  FILE* info;
+  char* info_buffer;
+  int statm;                   /* /proc/self/statm */
+} replay_footprint_t;
+
+typedef struct replay_program {
+  uint32_t nthreads;
+  uint32_t traced_threads;     /* the trace's threads, which serial loading puts in one */
+  replay_thread_t* threads;
+  uint32_t nslots;
+  size_t capacity;             /* the slots array's length */
+  void** slots;
+  size_t nops;
+  size_t skipped;              /* frees of blocks allocated before the trace started */
+  bool timed;                  /* time each call (see latency.h) as well as the whole */
+  replay_footprint_t* footprint;
+  /*
+   * The fraction of each block's requested bytes the replay writes when
+   * it gets the block, and reads (a byte of each cache line) before it
+   * frees or reallocs it, as the program would have; zero for none.
+   */
+  double touch;
+  uint64_t* touched;           /* touched[i] is the bytes of slot i's block that were written */
+} replay_program_t;
+
+/*
+ * Loads a trace, binary (MHOOK_FORMAT=binary) or text, parsing it all up
+ * front; false, after saying why, if it could not. A text trace has a
+ * single thread. When serial, all the calls of a binary trace go to a
+ * single thread, in mhook_order.
+ */
+extern bool load_program(const char* filename, bool serial, replay_program_t* program);
+
+/*
+ * Runs each of the program's threads in a thread of its own, or, when
+ * there is just the one, in the calling thread; returns the wall clock
+ * seconds it took.
+ */
+extern double run_program(replay_program_t* program);
+
+extern void dump_program(FILE* fp, replay_program_t* program);
+
+/* the latencies of all the threads' calls, if the program was timed */
+extern void dump_program_latency(FILE* fp, replay_program_t* program);
+
+/* see latency_summary */
+extern void summarize_program_latency(replay_program_t* program, double summary[LATENCY_SUMMARY]);
+
+/*
+ * Tracks the footprint of the program's runs, writing its timeline,
+ * sampled every interval calls, to the csv file. Only a program with a
+ * single thread (see load_program) is tracked.
+ */
+extern bool init_footprint(replay_program_t* program, const char* csvname, size_t interval);
+
+/* the peaks of the footprint, and when they were reached */
+extern void dump_footprint_peaks(FILE* fp, replay_program_t* program);
+
+extern void delete_program(replay_program_t* program);
+
+/*
+ * Parses a line of a text trace into r: its op, sizes, pointers and
+ * caller; false if it is not a line mhook writes.
+ */
+extern bool parse_trace_line(const char* start, const char* end, mhook_record_t* r);
+
+/*
+ * The records of the binary trace mapped at map (header and all),
+ * decoded into an array of *countp to be given back to delete_records;
+ * NULL, after saying why, if it is not one this code can read.
+ */
+extern mhook_record_t* decode_trace(const char* filename, const void* map, size_t length, size_t* countp);
+
+extern void delete_records(mhook_record_t* records, size_t count);
+
+/*
+ * Calls call on each of the records of a binary trace, with its thread,
+ * in mhook_order; false, after saying why, if it could not.
+ */
+extern bool merge_trace(const mhook_record_t* records, size_t count,
+                        void (*call)(const mhook_record_t* r, uint32_t thread, void* arg), void* arg);
+
+#endif
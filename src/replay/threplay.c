@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2016  SRI International
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "malloc.h"
+
+#include "replayops.h"
+
+/* flag to turn on malloc_stats at the end */
+static const bool verbose = true;
+
+/*
+ *  Replays a multithreaded program's binary mhook trace
+ *  (MHOOK_FORMAT=binary) the way the program ran it: each traced
+ *  thread is replayed by a thread of its own, making the same calls in
+ *  the same order, and a block freed (or realloc'ed) by a thread other
+ *  than the one that allocated it is handed over as in the program.
+ *  Unlike mtreplay, which runs copies of one thread's script, this
+ *  keeps the program's cross-thread frees, and so the arenas' remote
+ *  frees and lock contention.
+ *
+ *  The whole trace is turned into per-thread arrays of calls before
+ *  the threads start, so the time reported is that of the calls (and
+ *  the handoffs), not of parsing.
+ *
+ */
+
+int main(int argc, char* argv[]){
+  replay_program_t program;
+  double secs;
+
+  if (argc != 2) {
+    fprintf(stdout, "Usage: %s <mhook output file>\n", argv[0]);
+    return 1;
+  }
+
+  if(!load_program(argv[1], false, &program)){
+    return 1;
+  }
+
+  program.timed = verbose;
+
+  secs = run_program(&program);
+
+  fprintf(stdout, "%u threads, %zu calls in %.3f secs\n", program.nthreads, program.nops, secs);
+
+  dump_program(stdout, &program);
+
+  if(verbose){
+    dump_program_latency(stdout, &program);
+  }
+
+  delete_program(&program);
+
+  if(verbose){
+    malloc_stats();
+  }
+
+  return 0;
+}
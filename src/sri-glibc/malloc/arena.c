@@ -18,6 +18,7 @@
    not, see <http://www.gnu.org/licenses/>.  */
 
 #include <stdbool.h>
+#include <sched.h>
 
 #include "lookup.h"
 
@@ -40,7 +41,9 @@ typedef struct _heap_info
      that sizeof (heap_info) + 2 * SIZE_SZ is a multiple of
      MALLOC_ALIGNMENT. */
   char pad[-6 * SIZE_SZ & MALLOC_ALIGN_MASK];
-} heap_info;
+  /* SRI: the arena follows the heap_info, so this keeps its cache line
+     groups (see struct malloc_state) aligned */
+} CACHE_ALIGNED heap_info;
 
 /* Get a compile-time error if the heap_info padding is not correct
    to make alignment work as expected in sYSMALLOc.  */
@@ -77,6 +80,15 @@ int __malloc_initialized = -1;
  * list has arena_index 2.
  */
 
+/* SRI: the per-CPU arenas (mp_.percpu_arenas). CPU 0 uses the main_arena,
+ * the others are created on first use; see percpu_arena_get.
+ */
+#define PERCPU_ARENAS_MAX  256
+
+static mstate percpu_arenas[PERCPU_ARENAS_MAX];
+
+static mstate percpu_arena_get (size_t size, int site);
+
 /* the last arena in the main_arena.next list */
 static struct malloc_state *last_arena = &main_arena;
 
@@ -98,17 +110,34 @@ static size_t arena_count = 1;
    in the new arena. */
 
 #define arena_get(ptr, size, site) do {					\
-      ptr = thread_arena;						      \
-      arena_lock (ptr, size, site);						\
+      ptr = mp_.percpu_arenas ? percpu_arena_get (size, site) : NULL;	      \
+      if (ptr == NULL)							      \
+        {								      \
+          ptr = thread_arena;						      \
+          arena_lock (ptr, size, site);					      \
+        }								      \
   } while (0)
 
 #define arena_lock(ptr, size, site) do {					\
       if (ptr && !arena_is_corrupt (ptr))				      \
-        LOCK_ARENA(ptr, site);						\
+        {								      \
+          memcxt_refill (&ptr->memcxt);					      \
+          LOCK_ARENA(ptr, site);					      \
+          if (__glibc_unlikely (ptr->lock_last_contended		      \
+                                && ptr->contention > ARENA_HOT))	      \
+            ptr = arena_migrate (ptr, site);				      \
+        }								      \
       else								      \
         ptr = arena_get2 ((size), NULL);				      \
   } while (0)
 
+/* SRI: an arena is hot when more than a quarter of its lock acquisitions
+   have had to wait (see locking.h); a thread that waits for a hot
+   arena moves to one that is at most half as contended. */
+#define ARENA_HOT  (CONTENTION_SCALE / 4)
+
+static mstate arena_migrate (mstate hot, int site);
+
 /* find the heap and corresponding arena for a given ptr */
 
 #define heap_for_ptr(ptr) \
@@ -289,6 +318,7 @@ ptmalloc_lock_all (void)
   for (ar_ptr = &main_arena;; )
     {
       LOCK_ARENA(ar_ptr, ARENA_SITE);
+      memcxt_lock (&ar_ptr->memcxt);
       ar_ptr = ar_ptr->next;
       if (ar_ptr == &main_arena)
         break;
@@ -326,6 +356,7 @@ ptmalloc_unlock_all (void)
   __free_hook = save_free_hook;
   for (ar_ptr = &main_arena;; )
     {
+      memcxt_unlock (&ar_ptr->memcxt);
       UNLOCK_ARENA(ar_ptr, ARENA_SITE);
       ar_ptr = ar_ptr->next;
       if (ar_ptr == &main_arena)
@@ -360,7 +391,8 @@ ptmalloc_unlock_all2 (void)
   free_list = NULL;
   for (ar_ptr = &main_arena;; )
     {
-      mutex_init (&ar_ptr->mutex);
+      arena_mutex_init (&ar_ptr->mutex);
+      memcxt_reset (&ar_ptr->memcxt);
       if (ar_ptr != save_arena)
         {
 	  /* This arena is no longer attached to any thread.  */
@@ -374,6 +406,13 @@ ptmalloc_unlock_all2 (void)
     }
   mutex_init (&list_lock);
   atfork_recursive_cntr = 0;
+
+  /* SRI: the buckets kept back by the threads that did not come along */
+  memcxt_reset_magazines ();
+
+  /* SRI: the purger thread did not come along; the next malloc starts one */
+  if (purger_started == PURGER_RUNNING)
+    purger_started = PURGER_NONE;
 }
 
 # else
@@ -481,6 +520,8 @@ ptmalloc_init (void)
                     __libc_mallopt (M_TOP_PAD, atoi (&envline[9]));
                   else if (memcmp (envline, "PERTURB_", 8) == 0)
                     __libc_mallopt (M_PERTURB, atoi (&envline[9]));
+                  else if (memcmp (envline, "SLAB_MAX", 8) == 0)
+                    __libc_mallopt (M_SLAB_MAX, atoi (&envline[9]));
                 }
               break;
             case 9:
@@ -490,6 +531,8 @@ ptmalloc_init (void)
                     __libc_mallopt (M_MMAP_MAX, atoi (&envline[10]));
                   else if (memcmp (envline, "ARENA_MAX", 9) == 0)
                     __libc_mallopt (M_ARENA_MAX, atoi (&envline[10]));
+                  else if (memcmp (envline, "THP_HEAPS", 9) == 0)
+                    __libc_mallopt (M_THP_HEAPS, atoi (&envline[10]));
                 }
               break;
             case 10:
@@ -499,6 +542,27 @@ ptmalloc_init (void)
                     __libc_mallopt (M_ARENA_TEST, atoi (&envline[11]));
                 }
               break;
+            case 11:
+              if (!__builtin_expect (__libc_enable_secure, 0))
+                {
+                  if (memcmp (envline, "PURGE_DECAY", 11) == 0)
+                    __libc_mallopt (M_PURGE_DECAY, atoi (&envline[12]));
+                }
+              break;
+            case 13:
+              if (!__builtin_expect (__libc_enable_secure, 0))
+                {
+                  if (memcmp (envline, "PERCPU_ARENAS", 13) == 0)
+                    __libc_mallopt (M_PERCPU_ARENAS, atoi (&envline[14]));
+                }
+              break;
+            case 14:
+              if (!__builtin_expect (__libc_enable_secure, 0))
+                {
+                  if (memcmp (envline, "MMAP_CACHE_MAX", 14) == 0)
+                    __libc_mallopt (M_MMAP_CACHE_MAX, atoi (&envline[15]));
+                }
+              break;
             case 15:
               if (!__builtin_expect (__libc_enable_secure, 0))
                 {
@@ -508,6 +572,20 @@ ptmalloc_init (void)
                     __libc_mallopt (M_MMAP_THRESHOLD, atoi (&envline[16]));
                 }
               break;
+            case 17:
+              if (!__builtin_expect (__libc_enable_secure, 0))
+                {
+                  if (memcmp (envline, "CONSOLIDATE_LIMIT", 17) == 0)
+                    __libc_mallopt (M_CONSOLIDATE_LIMIT, atoi (&envline[18]));
+                }
+              break;
+            case 18:
+              if (!__builtin_expect (__libc_enable_secure, 0))
+                {
+                  if (memcmp (envline, "METADATA_HUGEPAGES", 18) == 0)
+                    __libc_mallopt (M_METADATA_HUGEPAGES, atoi (&envline[19]));
+                }
+              break;
             default:
               break;
             }
@@ -582,7 +660,7 @@ dump_heap (heap_info *heap)
 static char *aligned_heap_area;
 
 /* Create a new heap.  size is automatically rounded up to a multiple
-   of the page size. */
+   of the page size (of heap_granule, up to HEAP_MAX_SIZE). */
 
 static heap_info *
 internal_function
@@ -602,6 +680,8 @@ new_heap (size_t size, size_t top_pad)
   else
     size = HEAP_MAX_SIZE;
   size = ALIGN_UP (size, pagesize);
+  if (heap_granule () != pagesize)
+    size = MIN (ALIGN_UP (size, heap_granule ()), HEAP_MAX_SIZE);
 
   /* A memory region aligned to a multiple of HEAP_MAX_SIZE is needed.
      No swap space needs to be reserved for the following large
@@ -653,6 +733,9 @@ new_heap (size_t size, size_t top_pad)
       __munmap (p2, HEAP_MAX_SIZE);
       return 0;
     }
+  /* SRI: the heap is HEAP_MAX_SIZE aligned, so it is all huge page aligned */
+  if (heap_granule () != pagesize)
+    sri_madvise_hugepages (p2, HEAP_MAX_SIZE);
   h = (heap_info *) p2;
   h->size = size;
   h->mprotect_size = size;
@@ -661,7 +744,7 @@ new_heap (size_t size, size_t top_pad)
 }
 
 /* Grow a heap.  size is automatically rounded up to a
-   multiple of the page size. */
+   multiple of the page size (of heap_granule, when the heap has room). */
 
 static int
 grow_heap (heap_info *h, long diff)
@@ -673,6 +756,7 @@ grow_heap (heap_info *h, long diff)
   new_size = (long) h->size + diff;
   if ((unsigned long) new_size > (unsigned long) HEAP_MAX_SIZE)
     return -1;
+  new_size = MIN (ALIGN_UP (new_size, heap_granule ()), HEAP_MAX_SIZE);
 
   if ((unsigned long) new_size > h->mprotect_size)
     {
@@ -681,6 +765,11 @@ grow_heap (heap_info *h, long diff)
                       PROT_READ | PROT_WRITE) != 0)
         return -2;
 
+      /* SRI: shrink_heap may have remapped it, losing the advice */
+      if (heap_granule () != pagesize)
+        sri_madvise_hugepages ((char *) h + h->mprotect_size,
+                               (unsigned long) new_size - h->mprotect_size);
+
       h->mprotect_size = new_size;
     }
 
@@ -746,10 +835,14 @@ heap_trim (heap_info *heap, size_t pad)
   chunkinfoptr _md_p;
   chunkinfoptr _md_fencepost;
 
+  unregister_batch_t unregister_batch;
+
 
   heap_info *prev_heap;
   long new_size, top_size, top_area, extra, prev_size, misalign;
 
+  unregister_batch.count = 0;
+
   /* Can this heap go away completely? */
   /*
    * SRI: the mstate part of the header only occurs in the first heap
@@ -772,7 +865,7 @@ heap_trim (heap_info *heap, size_t pad)
        * because we are in a non-first heap of this arena. 
        */
       prev_heap = heap->prev;
-      prev_size = prev_heap->size - (MINSIZE - 2 * SIZE_SZ);
+      prev_size = prev_heap->size - FENCEPOST_SIZE;
 
       /* SRI: we are going to delete this heap and consolidate the tail of the previous heap */
       p = chunk_at_offset (prev_heap, prev_size);
@@ -786,6 +879,7 @@ heap_trim (heap_info *heap, size_t pad)
 
       if(_md_p == NULL){
 	missing_metadata(ar_ptr, p);
+	unregister_chunk_flush(ar_ptr, &unregister_batch);
 	return 0;
       }
       assert (_md_p->size == (0 | PREV_INUSE)); /* must be fencepost_0 */
@@ -798,7 +892,7 @@ heap_trim (heap_info *heap, size_t pad)
       _md_p =_md_p->md_prev;
       p = chunkinfo2chunk(_md_p);
 	
-      new_size = chunksize (_md_p) + (MINSIZE - 2 * SIZE_SZ) + misalign;
+      new_size = chunksize (_md_p) + FENCEPOST_SIZE + misalign;
 
       assert (new_size > 0 && new_size < (long) (2 * MINSIZE)); /* must be fencepost_1 */
 
@@ -814,7 +908,7 @@ heap_trim (heap_info *heap, size_t pad)
       _md_temp = _md_fencepost->md_next;
       
       /* SRI: pulling out the fencepost */
-      unregister_chunk(ar_ptr, chunkinfo2chunk(_md_fencepost), 4); 
+      unregister_chunk_deferred(ar_ptr, &unregister_batch, chunkinfo2chunk(_md_fencepost), 4);
       
       /* fix the md_next and md_prev pointers */
       _md_p->md_next = _md_temp;
@@ -826,7 +920,7 @@ heap_trim (heap_info *heap, size_t pad)
       LIBC_PROBE (memory_heap_free, 2, heap, heap->size);
 
       /* heap is being deleted; so must its top */
-      unregister_chunk(ar_ptr, top_chunk, 14); 
+      unregister_chunk_deferred(ar_ptr, &unregister_batch, top_chunk, 14);
       delete_heap (heap);
 
       //fprintf(stderr, "deleteing heap with top chunk %p\n", top_chunk);
@@ -843,7 +937,7 @@ heap_trim (heap_info *heap, size_t pad)
 	  _md_p = _md_p->md_prev;
 	  p = chunkinfo2chunk(_md_p);
 
-	  unregister_chunk(ar_ptr, op, 5);  
+	  unregister_chunk_deferred(ar_ptr, &unregister_batch, op, 5);
 
           bin_unlink(ar_ptr, _md_p, &bck, &fwd);
 	  /* fix the md_next and md_prev pointers */
@@ -868,6 +962,9 @@ heap_trim (heap_info *heap, size_t pad)
       /* check_chunk(ar_ptr, top_chunk); */
     } /* while */
 
+  /* the metadata of the fenceposts, tops and chunks absorbed above */
+  unregister_chunk_flush(ar_ptr, &unregister_batch);
+
   /* Uses similar logic for per-thread arenas as the main arena with systrim
      and _int_free by preserving the top pad and rounding down to the nearest
      page.  */
@@ -882,7 +979,11 @@ heap_trim (heap_info *heap, size_t pad)
 
   /* Release in pagesize units and round down to the nearest page.  */
   extra = ALIGN_DOWN(top_area - pad, pagesz);
-  if (extra == 0)
+
+  /* SRI: with M_THP_HEAPS the heap must still end on a huge page */
+  if (heap_granule () != pagesz)
+    extra = (long) heap->size - (long) ALIGN_UP (heap->size - extra, heap_granule ());
+  if (extra <= 0)
     return 0;
 
   /* Try to shrink. */
@@ -960,7 +1061,7 @@ _int_new_arena (size_t size)
   LIBC_PROBE (memory_arena_new, 2, a, size);
   mstate replaced_arena = thread_arena;
   thread_arena = a;
-  mutex_init (&a->mutex);
+  arena_mutex_init (&a->mutex);
   //BD moved this so we could call the LOCK_ARENA below.
   //(void) mutex_lock (&a->mutex);
 
@@ -1045,11 +1146,30 @@ reused_arena (mstate avoid_arena)
   if (next_to_use == NULL)
     next_to_use = &main_arena;
 
+  /* SRI: first try the least contended arena; the scan starts at
+     next_to_use, so that ties (say, none contended yet) go round-robin */
+  mstate coldest = NULL;
+  result = next_to_use;
+  do
+    {
+      if (!arena_is_corrupt (result) && result != avoid_arena
+          && (coldest == NULL || result->contention < coldest->contention))
+        coldest = result;
+      result = result->next;
+    }
+  while (result != next_to_use);
+
+  if (coldest != NULL && TRYLOCK_ARENA (coldest, ARENA_SITE) == 0)
+    {
+      result = coldest;
+      goto out;
+    }
+
   result = next_to_use;
   do
     {
       if (!arena_is_corrupt (result)){
-	success = mutex_trylock (&result->mutex);
+	success = TRYLOCK_ARENA (result, ARENA_SITE);
 	if (!success) {
 	  goto out;
 	}
@@ -1097,6 +1217,55 @@ out:
   return result;
 }
 
+/* SRI: called holding the lock of hot, the calling thread's arena, just
+   after having to wait for it; returns the arena to use, locked.  If
+   another arena in use is much less contended this thread moves to it.
+   ptmalloc_lock_all takes list_lock before the arenas' locks, so hot's
+   lock is let go before list_lock is taken, and the thread's arena,
+   whichever it is then, is locked again afterwards.  */
+static mstate
+arena_migrate (mstate hot, int site)
+{
+  mstate a, coldest = NULL;
+  bool moved = false;
+
+  if (thread_arena != hot)
+    return hot;
+
+  for (a = hot->next; a != hot; a = a->next)
+    if (!arena_is_corrupt (a) && a->attached_threads > 0
+        && (coldest == NULL || a->contention < coldest->contention))
+      coldest = a;
+
+  if (coldest == NULL || coldest->contention >= hot->contention / 2)
+    return hot;
+
+  UNLOCK_ARENA(hot, site);
+
+  (void) mutex_lock (&list_lock);
+  /* an arena whose last thread has gone is on the free_list */
+  if (coldest->attached_threads > 0)
+    {
+      detach_arena (hot);
+      ++coldest->attached_threads;
+      moved = true;
+    }
+  (void) mutex_unlock (&list_lock);
+
+  if (moved)
+    {
+      LIBC_PROBE (memory_arena_migrate, 2, hot, coldest);
+      thread_arena = coldest;
+      catomic_increment (&hot->migrations_out);
+      catomic_increment (&coldest->migrations_in);
+    }
+
+  a = thread_arena;
+  memcxt_refill (&a->memcxt);
+  LOCK_ARENA(a, site);
+  return a;
+}
+
 static mstate
 internal_function
 arena_get2 (size_t size, mstate avoid_arena)
@@ -1148,6 +1317,57 @@ arena_get2 (size_t size, mstate avoid_arena)
   return a;
 }
 
+/* SRI: in the per-CPU mode arena_get first tries the arena of the CPU we
+   are running on.  When that arena is busy, because its holder was
+   preempted or we were migrated, or the CPU cannot be determined, it
+   returns NULL and arena_get falls back to the thread's arena and the
+   usual blocking path.  A CPU's arena is created by the first thread to
+   run there; it does not change thread_arena beyond what _int_new_arena
+   does.  (This glibc has no rseq, so the CPU comes from sched_getcpu,
+   which is a vDSO call.)  */
+static mstate
+percpu_arena_get (size_t size, int site)
+{
+  mstate a;
+  int cpu;
+
+  cpu = sched_getcpu ();
+  if (cpu < 0)
+    return NULL;
+
+  if (mp_.arena_max != 0)
+    cpu %= mp_.arena_max;
+  cpu %= PERCPU_ARENAS_MAX;
+
+  if (cpu == 0)
+    a = &main_arena;
+  else
+    a = atomic_forced_read (percpu_arenas[cpu]);
+
+  if (a == NULL)
+    {
+      catomic_increment (&narenas);
+      a = _int_new_arena (size);
+      if (__glibc_unlikely (a == NULL))
+        {
+          catomic_decrement (&narenas);
+          return NULL;
+        }
+      /* If another thread on this CPU beat us to it, ours is just an
+         ordinary arena that this thread is attached to.  */
+      (void) catomic_compare_and_exchange_bool_acq (&percpu_arenas[cpu], a, NULL);
+      return a;                 /* _int_new_arena returns it locked */
+    }
+
+  if (arena_is_corrupt (a))
+    return NULL;
+  memcxt_refill (&a->memcxt);
+  if (TRYLOCK_ARENA (a, site) != 0)
+    return NULL;
+
+  return a;
+}
+
 /* If we don't have the main arena, then maybe the failure is due to running
    out of mmapped areas, so we can try allocating on the main arena.
    Otherwise, it is likely that sbrk() has failed and there is still a chance
@@ -1181,6 +1401,9 @@ arena_thread_freeres (void)
   mstate a = thread_arena;
   thread_arena = NULL;
 
+  /* SRI: give the metadata records this thread kept back */
+  memcxt_flush ();
+
   if (a != NULL)
     {
       (void) mutex_lock (&list_lock);
@@ -43,6 +43,8 @@ typedef enum lock_site {
   MALLOC_STATS_SITE     = 10,
   MALLOC_INFO_SITE      = 11,
   ARENA_SITE            = 12,
+  PURGE_SITE            = 13,
+  LOCK_SITE_COUNT       = 14
 } lock_site_t;
 
 
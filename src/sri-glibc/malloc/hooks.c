@@ -320,9 +320,9 @@ malloc_check (size_t sz, const void *caller)
       return NULL;
     }
 
-  (void) mutex_lock (&main_arena.mutex);
+  arena_mutex_lock (&main_arena.mutex);
   _md_victim = (top_check () >= 0) ? _int_malloc (&main_arena, sz + 1) : NULL;
-  (void) mutex_unlock (&main_arena.mutex);
+  arena_mutex_unlock (&main_arena.mutex);
   mem = chunkinfo2mem(_md_victim);
   return mem2mem_check (_md_victim, chunkinfo2chunk(_md_victim), mem, sz);
 }
@@ -337,13 +337,13 @@ free_check (void *mem, const void *caller)
   if (!mem)
     return;
 
-  (void) mutex_lock (&main_arena.mutex);
+  arena_mutex_lock (&main_arena.mutex);
   p = mem2chunk(mem);
   _md_p = lookup_chunk(&main_arena, p);
   p = mem2chunk_check (_md_p, p, mem, NULL);
   if (!p || !_md_p)
     {
-      (void) mutex_unlock (&main_arena.mutex);
+      arena_mutex_unlock (&main_arena.mutex);
 
       malloc_printerr (check_action, "free(): invalid pointer", mem,
 		       &main_arena);
@@ -355,11 +355,11 @@ free_check (void *mem, const void *caller)
       munmap_chunk(_md_p);
       unregister_chunk(&main_arena, p, false); 
       //Done: _md_p->md_prev = _md_p->md_next = NULL
-      (void) mutex_unlock (&main_arena.mutex);
+      arena_mutex_unlock (&main_arena.mutex);
       return;
     }
   _int_free (&main_arena, NULL, p, true, false);
-  (void) mutex_unlock (&main_arena.mutex);
+  arena_mutex_unlock (&main_arena.mutex);
 }
 
 static void *
@@ -387,7 +387,7 @@ realloc_check (void *oldmem, size_t bytes, const void *caller)
       free_check (oldmem, NULL);
       return NULL;
     }
-  (void) mutex_lock (&main_arena.mutex);
+  arena_mutex_lock (&main_arena.mutex);
   oldp = mem2chunk(oldmem);
   _md_oldp = lookup_chunk(&main_arena, oldp);
   if( !_md_oldp){
@@ -395,7 +395,7 @@ realloc_check (void *oldmem, size_t bytes, const void *caller)
   }
   oldp = mem2chunk_check (_md_oldp,  oldp, oldmem, &magic_p);
 
-  (void) mutex_unlock (&main_arena.mutex);
+  arena_mutex_unlock (&main_arena.mutex);
   if (!oldp)
     {
       malloc_printerr (check_action, "realloc(): invalid pointer", oldmem,
@@ -407,7 +407,7 @@ realloc_check (void *oldmem, size_t bytes, const void *caller)
   if ( !checked_request2size (bytes + 1, &nb) ){
     return 0;
   }
-  (void) mutex_lock (&main_arena.mutex);
+  arena_mutex_lock (&main_arena.mutex);
 
   if (chunk_is_mmapped (_md_oldp, oldp))
     {
@@ -458,7 +458,7 @@ realloc_check (void *oldmem, size_t bytes, const void *caller)
   if (newmem == NULL)
     *magic_p ^= 0xFF;
 
-  (void) mutex_unlock (&main_arena.mutex);
+  arena_mutex_unlock (&main_arena.mutex);
 
   return _md_newmem ? mem2mem_check (_md_newmem, chunkinfo2chunk(_md_newmem), newmem, bytes) : NULL;
 }
@@ -499,11 +499,11 @@ memalign_check (size_t alignment, size_t bytes, const void *caller)
       alignment = a;
     }
 
-  (void) mutex_lock (&main_arena.mutex);
+  arena_mutex_lock (&main_arena.mutex);
   _md_mem = (top_check () >= 0) ? _int_memalign (&main_arena, alignment, bytes + 1) :
         NULL;
   mem = chunkinfo2mem(_md_mem);
-  (void) mutex_unlock (&main_arena.mutex);
+  arena_mutex_unlock (&main_arena.mutex);
   return mem2mem_check (_md_mem, chunkinfo2chunk(_md_mem), mem, bytes);
 }
 
@@ -563,7 +563,7 @@ __malloc_get_state (void)
   if (!ms)
     return 0;
 
-  (void) mutex_lock (&main_arena.mutex);
+  arena_mutex_lock (&main_arena.mutex);
   malloc_consolidate (&main_arena);
   ms->magic = MALLOC_STATE_MAGIC;
   ms->version = MALLOC_STATE_VERSION;
@@ -600,7 +600,7 @@ __malloc_get_state (void)
   ms->arena_test = mp_.arena_test;
   ms->arena_max = mp_.arena_max;
   ms->narenas = narenas;
-  (void) mutex_unlock (&main_arena.mutex);
+  arena_mutex_unlock (&main_arena.mutex);
   return (void *) ms;
 }
 
@@ -620,7 +620,7 @@ __malloc_set_state (void *msptr)
   if ((ms->version & ~0xffl) > (MALLOC_STATE_VERSION & ~0xffl))
     return -2;
 
-  (void) mutex_lock (&main_arena.mutex);
+  arena_mutex_lock (&main_arena.mutex);
   /* There are no fastchunks.  */
   clear_fastchunks (&main_arena);
   if (ms->version >= 4)
@@ -719,7 +719,7 @@ __malloc_set_state (void *msptr)
     }
   check_malloc_state (&main_arena);
 
-  (void) mutex_unlock (&main_arena.mutex);
+  arena_mutex_unlock (&main_arena.mutex);
   return 0;
 }
 
@@ -1,6 +1,133 @@
-#ifdef SRI_MALLOC_LOG
-#include "debug.h"
+#include <hp-timing.h>
+#if SRI_ADAPTIVE_LOCK
+#include <lowlevellock.h>
+#endif
+
+/*
+ * SRI: the arena lock.
+ *
+ * With SRI_ADAPTIVE_LOCK the futex word is 0 (unlocked), 1 (locked) or
+ * 2 (locked, maybe with sleepers), as in lowlevellock.h. A thread that
+ * fails to grab the lock spins, pausing 1, 2, 4, ... times between
+ * attempts, for up to ARENA_LOCK_SPINS pauses; critical sections in
+ * malloc are short, so the holder is usually gone by then. Only then does
+ * it mark the lock as contended and sleep on the futex.
+ *
+ * arena_mutex_lock_slow returns the number of times the thread slept.
+ */
+#if SRI_ADAPTIVE_LOCK
+
+#ifndef ARENA_LOCK_SPINS
+#define ARENA_LOCK_SPINS  1024
+#endif
+
+#define arena_mutex_init(m)      ((m)->futex = 0)
+
+static inline int arena_mutex_trylock(arena_mutex_t *m){
+  return atomic_compare_and_exchange_bool_acq(&m->futex, 1, 0);
+}
+
+static size_t arena_mutex_lock_slow(arena_mutex_t *m){
+  size_t waits = 0;
+  int spins, pause, i;
+
+  for(spins = 0, pause = 1; spins < ARENA_LOCK_SPINS; spins += pause, pause <<= 1){
+    for(i = 0; i < pause; i++){
+      atomic_spin_nop ();
+    }
+    if(arena_mutex_trylock(m) == 0){
+      return 0;
+    }
+  }
+  while(atomic_exchange_acq(&m->futex, 2) != 0){
+    lll_futex_wait(&m->futex, 2, LLL_PRIVATE);
+    waits++;
+  }
+  return waits;
+}
+
+static inline void arena_mutex_unlock(arena_mutex_t *m){
+  if(atomic_exchange_rel(&m->futex, 0) == 2){
+    lll_futex_wake(&m->futex, 1, LLL_PRIVATE);
+  }
+}
+
+#else
+
+#define arena_mutex_init(m)      mutex_init(m)
+#define arena_mutex_trylock(m)   mutex_trylock(m)
+#define arena_mutex_unlock(m)    ((void)mutex_unlock(m))
+
+/* we cannot tell spinning from sleeping inside the glibc mutex */
+static inline size_t arena_mutex_lock_slow(arena_mutex_t *m){
+  (void)mutex_lock(m);
+  return 1;
+}
+
+#endif
+
+static inline void arena_mutex_lock(arena_mutex_t *m){
+  if(arena_mutex_trylock(m) != 0){
+    (void)arena_mutex_lock_slow(m);
+  }
+}
+
+/*
+ * SRI: contention statistics, used by arena.c to steer threads away
+ * from busy arenas, and reported per lock_site_t by malloc_stats. They
+ * are only updated by the holder of the lock.
+ *
+ * av->contention is a decaying average of the fraction of acquisitions
+ * that had to wait, out of CONTENTION_SCALE: each acquisition moves it
+ * 1/2^CONTENTION_SHIFT of the way towards 0 or CONTENTION_SCALE.
+ */
+#define CONTENTION_SCALE  1024
+#define CONTENTION_SHIFT  5
+
+static inline void note_lock_acquired(mstate av, int site, bool contended, size_t waits, uint64_t wait){
+  lock_site_stats_t *stats = &av->lock_sites[site];
+
+  stats->acquired++;
+  av->lock_last_contended = contended;
+  av->contention -= av->contention >> CONTENTION_SHIFT;
+  if(contended){
+    stats->contended++;
+    stats->futex_waits += waits;
+    stats->wait += wait;
+    av->contention += CONTENTION_SCALE >> CONTENTION_SHIFT;
+  }
+}
+
+static inline void lock_arena_mutex(mstate av, int site){
+  size_t waits;
 
+  if(__glibc_likely(arena_mutex_trylock(&(av->mutex)) == 0)){
+    note_lock_acquired(av, site, false, 0, 0);
+    return;
+  }
+#if HP_TIMING_AVAIL
+  hp_timing_t start, end;
+  HP_TIMING_NOW(start);
+  waits = arena_mutex_lock_slow(&(av->mutex));
+  HP_TIMING_NOW(end);
+  note_lock_acquired(av, site, true, waits, end - start);
+#else
+  waits = arena_mutex_lock_slow(&(av->mutex));
+  note_lock_acquired(av, site, true, waits, 0);
+#endif
+}
+
+/* an acquisition that would have had to wait is not made, so it counts
+   for neither the site nor the contention score */
+static inline int trylock_arena_mutex(mstate av, int site){
+  if(arena_mutex_trylock(&(av->mutex)) != 0){
+    return EBUSY;
+  }
+  note_lock_acquired(av, site, false, 0, 0);
+  return 0;
+}
+
+#ifdef SRI_MALLOC_LOG
 #include <atomic.h>
 
 static volatile int tid_counter = 0;
@@ -14,15 +141,27 @@ static inline void LOCK_ARENA(mstate av, int site){
   }
   self = tid;
   
-  (void)mutex_lock(&(av->mutex));
+  lock_arena_mutex(av, site);
   log_lock_event(LOCK_ACTION, av, av->arena_index, site, tid);
 
 }
 
 
+static inline int TRYLOCK_ARENA(mstate av, int site){
+  if(trylock_arena_mutex(av, site) != 0){
+    return EBUSY;
+  }
+  if(tid == -1){
+    tid = catomic_exchange_and_add (&tid_counter, 1);
+  }
+  log_lock_event(LOCK_ACTION, av, av->arena_index, site, tid);
+  return 0;
+}
+
+
 static inline void UNLOCK_ARENA(mstate av, int site){
 
-  (void)mutex_unlock(&(av->mutex));
+  arena_mutex_unlock(&(av->mutex));
   log_lock_event(UNLOCK_ACTION, av, av->arena_index, site, tid);
 
 }
@@ -30,10 +169,13 @@ static inline void UNLOCK_ARENA(mstate av, int site){
 #else
 
 static inline void LOCK_ARENA(mstate av, int site){
-  (void)mutex_lock(&(av->mutex));
+  lock_arena_mutex(av, site);
+}
+static inline int TRYLOCK_ARENA(mstate av, int site){
+  return trylock_arena_mutex(av, site);
 }
 static inline void UNLOCK_ARENA(mstate av, int site){
-  (void)mutex_unlock(&(av->mutex));
+  arena_mutex_unlock(&(av->mutex));
 }
 
 #endif
@@ -81,9 +81,12 @@ static sbrk_region_t *sbrk_regions;
 
 #define MMAP_HTABLE_CAPACITY TABLE_SIZE
 
+#define RUN_HTABLE_CAPACITY TABLE_SIZE
+
 
 static lfht_t heap_tbl;  // maps heap ptr --> arena_index
 static lfht_t mmap_tbl;  // maps mmapped region --> size 
+static lfht_t run_tbl;   // maps slab run --> its header
 static size_t heap_max;  // value of HEAP_MAX_SIZE at runtime
 /*
  * N.B. We could eliminate the need for a mmapped arena 
@@ -96,7 +99,8 @@ void lookup_init(size_t hmax){
   sbrk_regions = sri_mmap(NULL, sbrk_region_current_max * sizeof(sbrk_region_t));
   if( ! sbrk_regions ||
       ! init_lfht(&heap_tbl, HEAP_HTABLE_CAPACITY) ||  
-      ! init_lfht(&mmap_tbl, MMAP_HTABLE_CAPACITY)  ){
+      ! init_lfht(&mmap_tbl, MMAP_HTABLE_CAPACITY) ||
+      ! init_lfht(&run_tbl, RUN_HTABLE_CAPACITY)  ){
     fprintf(stderr, "Off to a bad start: lfht inits failed\n");
     abort();
   }
@@ -105,6 +109,7 @@ void lookup_init(size_t hmax){
 void lookup_delete(void){
   delete_lfht(&heap_tbl);
   delete_lfht(&mmap_tbl);
+  delete_lfht(&run_tbl);
 }
 
 
@@ -227,6 +232,29 @@ bool lookup_delete_mmap(void* ptr){
   return retval;
 }
 
+bool lookup_add_run(void* ptr, void* header){
+  bool retval = lfht_add(&run_tbl, (uintptr_t)ptr, (uintptr_t)header);
+  assert(retval);
+  if(!retval){ abort(); }
+  return retval;
+}
+
+bool lookup_delete_run(void* ptr){
+  bool retval = lfht_remove(&run_tbl, (uintptr_t)ptr);
+  assert(retval);
+  if(!retval){ abort(); }
+  return retval;
+}
+
+void* lookup_run(void* ptr){
+  uintptr_t val = 0;
+  bool success = lfht_find(&run_tbl, (uintptr_t)ptr, &val);
+  if(success && val != TOMBSTONE){
+    return (void*)val;
+  }
+  return NULL;
+}
+
 void lookup_dump(FILE* fp, bool dumptables){
   uint32_t i;
   fprintf(fp, "lookup:\n");
@@ -242,6 +270,7 @@ void lookup_dump(FILE* fp, bool dumptables){
   }
   lfht_stats(fp, " mmap_table", &mmap_tbl);
   lfht_stats(fp, " heap_table", &heap_tbl);
+  lfht_stats(fp, " run_table", &run_tbl);
   if(dumptables){
     lfht_dump(fp,  " mmap_table", &mmap_tbl);
     lfht_dump(fp,  " heap_table", &mmap_tbl);
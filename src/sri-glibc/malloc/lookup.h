@@ -56,6 +56,14 @@ extern bool lookup_delete_heap(void* ptr);
 extern bool lookup_add_mmap(void* ptr, size_t sz);
 extern bool lookup_delete_mmap(void* ptr);
 
+/* 
+  The slab runs (see SRI_SLAB in sri.h): lookup_run returns the header
+  registered for the run starting at ptr, or NULL if there is none.
+*/
+extern bool lookup_add_run(void* ptr, void* header);
+extern bool lookup_delete_run(void* ptr);
+extern void* lookup_run(void* ptr);
+
 extern void lookup_dump(FILE*, bool dumptables);
 
 #endif
@@ -899,6 +899,13 @@ int      __posix_memalign(void **, size_t, size_t);
 # endif
 #endif
 
+/* SRI: the most bytes of freed mmapped chunks kept for reuse (see
+   mmap_cache); none by default, since without the purger the cache only
+   ages as mmapped chunks come and go, so an idle program would keep it */
+#ifndef DEFAULT_MMAP_CACHE_MAX
+#define DEFAULT_MMAP_CACHE_MAX 0
+#endif
+
 /*
   M_MMAP_THRESHOLD is the request size threshold for using mmap()
   to service a request. Requests of at least this size that cannot
@@ -1041,6 +1048,8 @@ int      __posix_memalign(void **, size_t, size_t);
 /* SRI's  metatdata header */
 #include "metadata.h"
 #include "lookup.h"
+#include "utils.h"
+#include "debug.h"
 
 #include <malloc.h>
 
@@ -1071,6 +1080,19 @@ static chunkinfoptr lookup_chunk (mstate av, mchunkptr p);
 static bool unregister_chunk (mstate av, mchunkptr p, int tag);
 static chunkinfoptr register_chunk(mstate av, mchunkptr p, bool is_mmapped, int tag);
 
+/*
+  The coalescing loops (malloc_consolidate, heap_trim) queue the chunks
+  they absorb, and remove their metadata with metadata_delete_batch once
+  the queue fills up, or the loop is done.
+*/
+typedef struct unregister_batch_s {
+  size_t count;
+  const void* chunks[METADATA_BATCH_LENGTH];
+} unregister_batch_t;
+
+static void unregister_chunk_deferred (mstate av, unregister_batch_t* batch, mchunkptr p, int tag);
+static void unregister_chunk_flush (mstate av, unregister_batch_t* batch);
+
 static chunkinfoptr split_chunk(mstate av, chunkinfoptr _md_victim, mchunkptr victim, INTERNAL_SIZE_T victim_size, INTERNAL_SIZE_T desiderata);
 
 static mchunkptr chunkinfo2chunk(chunkinfoptr _md_victim);
@@ -1165,11 +1187,15 @@ static inline mchunkptr mem2chunk(void* mem)
   return ((mchunkptr)((char*)mem - HEADER_SIZE));
 }
 
-/* The smallest possible chunk */
+/* 
+   The smallest possible chunk. (SRI: without in-band headers nothing
+   but the user's data lives in a chunk, so the smallest chunk is a
+   single alignment granule.)
+*/
 #if SRI_DEBUG_HEADERS
 #define MIN_CHUNK_SIZE       2 * sizeof(struct malloc_chunk)
 #else
-#define MIN_CHUNK_SIZE       4 * sizeof(INTERNAL_SIZE_T)
+#define MIN_CHUNK_SIZE       2 * sizeof(INTERNAL_SIZE_T)
 #endif
 
 /* The smallest size we can malloc is an aligned minimal chunk */
@@ -1177,6 +1203,27 @@ static inline mchunkptr mem2chunk(void* mem)
 #define MINSIZE                                                         \
   (unsigned long)(((MIN_CHUNK_SIZE+MALLOC_ALIGN_MASK) & ~MALLOC_ALIGN_MASK))
 
+/* 
+   The heap space taken up by the outermost fencepost at the end of a
+   heap or of a non-contiguous sbrk region.  (SRI: the fencepost only
+   needs an address of its own in the metadata; it occupies heap bytes
+   only when it has an in-band header.)
+*/
+#if SRI_DEBUG_HEADERS
+#define FENCEPOST_SIZE       (MINSIZE - 2 * SIZE_SZ)
+#else
+#define FENCEPOST_SIZE       0
+#endif
+
+/*
+   SRI: the fencepost at the end of a non-contiguous sbrk region always
+   takes bytes of its own.  An empty one would have the address of the
+   region's end, where the new top, or the mmapped chunk that made
+   MORECORE fail, may well start, and the two would share a key in the
+   metadata table.
+*/
+#define SBRK_FENCEPOST_SIZE  (MINSIZE - 2 * SIZE_SZ)
+
 /* Check if m has acceptable alignment */
 
 static inline bool aligned_OK(unsigned long m)
@@ -1684,34 +1731,139 @@ static INTERNAL_SIZE_T get_max_fast(void);
 */
 #define METADATA_CACHE_SIZE 8
 
+#if SRI_SLAB
+/*
+  SRI: the slab runs (see SRI_SLAB in sri.h). A run is a SLAB_RUN_SIZE
+  aligned chunk of SLAB_RUN_SIZE bytes; its header sits at the start, and
+  the slots follow. Requests of 1 to SLAB_MAX_SIZE bytes fall into
+  SLAB_NCLASSES classes, one per MALLOC_ALIGNMENT of slot size.
+*/
+#define SLAB_RUN_SIZE      (32 * 1024)
+#define SLAB_MAX_SIZE      128
+#define DEFAULT_SLAB_MAX   64
+#define SLAB_NCLASSES      (SLAB_MAX_SIZE / MALLOC_ALIGNMENT)
+#define SLAB_BITMAP_WORDS  (SLAB_RUN_SIZE / MALLOC_ALIGNMENT / 64)
+
+typedef struct slab_run_s {
+  struct slab_run_s *next;     /* the arena's runs of this class with a free slot */
+  struct slab_run_s *prev;
+  struct malloc_state *av;     /* owner */
+  char *slots;                 /* the first slot */
+  uint32_t slot_size;
+  uint32_t nslots;
+  uint32_t nfree;
+  uint32_t hint;               /* no free slot in the bitmap words before this */
+  uint64_t bitmap[SLAB_BITMAP_WORDS];  /* a set bit is a slot in use */
+} slab_run_t;
+#endif
+
+/*
+  SRI: struct malloc_state is split into groups that each start on their
+  own cache line, so that threads spinning on (or handing off) an arena's
+  lock, threads freeing into the arena from elsewhere, and threads walking
+  the arena list do not keep stealing the lines the lock holder is
+  writing. The groups are, in order:
+
+  - the lock;
+  - what the lock holder writes: the lock statistics it updates on every
+    acquisition (other threads only glance at contention when picking an
+    arena), then the fast paths: flags, fastbins, top, bins, the metadata
+    cache;
+  - the header of the metadata table and its pool;
+  - what other threads read (or bump) without holding the lock: the
+    arena list, attached threads, migrations;
+  - cold statistics.
+
+  check_malloc_state_layout below asserts, at compile time, that the
+  fields are in their groups.
+*/
+#define CACHE_ALIGNED __attribute__ ((aligned (SRI_CACHE_LINE)))
+
+#if SRI_ADAPTIVE_LOCK
+/* SRI: the futex word of the adaptive arena lock (see locking.h) */
+typedef struct arena_mutex_s {
+  int futex;
+} CACHE_ALIGNED arena_mutex_t;
+#define ARENA_MUTEX_INITIALIZER { 0 }
+#else
+typedef mutex_t arena_mutex_t;
+#define ARENA_MUTEX_INITIALIZER _LIBC_LOCK_INITIALIZER
+#endif
+
+/* SRI: what LOCK_ARENA saw at one lock_site_t (see locking.h) */
+typedef struct lock_site_stats_s {
+  size_t acquired;
+  size_t contended;
+  size_t futex_waits;
+  uint64_t wait;
+} lock_site_stats_t;
+
+/* SRI: the background purger wakes PURGE_STEPS times per decay period */
+#define PURGE_STEPS  8
+
 struct malloc_state
 {
   /* Serialize access.  */
-  mutex_t mutex;
+  arena_mutex_t mutex CACHE_ALIGNED;
+
+  /* SRI: lock contention (see locking.h), written by the lock holder */
+  unsigned int contention CACHE_ALIGNED;
+  bool lock_last_contended;
+  lock_site_stats_t lock_sites[LOCK_SITE_COUNT];
 
   /* Flags (formerly in max_fast).  */
   int flags;
 
+  /* SRI: the fastbin malloc_consolidate_bounded resumes at */
+  int consolidate_cursor;
+
+  /* SRI: bytes freed into this arena, for the purger */
+  size_t freed_bytes;
+
   /* Fastbins */
   mfastbinptr fastbinsY[NFASTBINS];
 
   /* Metadata of the base of the topmost chunk -- not otherwise kept in a bin */
   chunkinfoptr _md_top;
 
-  /* temporary value of initial top while we are in transition. */
-  struct malloc_chunk  initial_top;        
-
   /* Metadata of the remainder from the most recent split of a small request */
   chunkinfoptr last_remainder;
 
+  /* Bitmap of bins */
+  unsigned int binmap[BINMAPSIZE];
+
+  /* SRI: metadata cache; pool of metadata big enough so 
+     that we don't get caught halfway through an allocation routine 
+     and not be able to create the necessary metadata. If we can't 
+     fill the cache at the start of malloc, realloc, or calloc we
+     can return 0 and know that the current state is still
+     consistent.
+  */
+  int           metadata_cache_count;
+  chunkinfoptr  metadata_cache[METADATA_CACHE_SIZE];
+
+#if SRI_SLAB
+  /* SRI: for each slab class, the runs with a free slot */
+  slab_run_t *slab_runs[SLAB_NCLASSES];
+#endif
+
   /* Normal bins packed as described above */
   struct chunkinfo bins[NBINS];
 
-  /* Bitmap of bins */
-  unsigned int binmap[BINMAPSIZE];
+  /* temporary value of initial top while we are in transition. */
+  struct malloc_chunk  initial_top;        
+
+  /* SRI: flag indicating arena is initialized */
+  bool metadata_pool_ready CACHE_ALIGNED;
+
+  /* SRI: pool memory for the metadata */
+  memcxt_t memcxt;
+
+  /* SRI: metadata */
+  metadata_t htbl;      
 
   /* Linked list */
-  struct malloc_state *next;
+  struct malloc_state *next CACHE_ALIGNED;
 
   /* Linked list for free arenas.  Access to this field is serialized
      by list_lock in arena.c.  */
@@ -1722,34 +1874,53 @@ struct malloc_state
      in arena.c.  */
   INTERNAL_SIZE_T attached_threads;
 
-  /* Memory allocated from the system in this arena.  */
-  INTERNAL_SIZE_T system_mem;
-  INTERNAL_SIZE_T max_system_mem;
-
   /* SRI: this arena's index. main arena = 1, non-main arena's 2, 3, .... */
   size_t arena_index;
 
-  /* SRI: flag indicating arena is initialized */
-  bool metadata_pool_ready;
-
-  /* SRI: pool memory for the metadata */
-  memcxt_t memcxt;
-
-  /* SRI: metadata */
-  metadata_t htbl;      
+  /* SRI: the threads arena.c moved off and onto this arena because of
+     lock contention */
+  size_t migrations_out;
+  size_t migrations_in;
 
-  /* SRI: metadata cache; pool of metadata big enough so 
-     that we don't get caught halfway through an allocation routine 
-     and not be able to create the necessary metadata. If we can't 
-     fill the cache at the start of malloc, realloc, or calloc we
-     can return 0 and know that the current state is still
-     consistent.
-  */
-  chunkinfoptr  metadata_cache[METADATA_CACHE_SIZE];
-  int           metadata_cache_count;
+  /* Memory allocated from the system in this arena.  */
+  INTERNAL_SIZE_T system_mem CACHE_ALIGNED;
+  INTERNAL_SIZE_T max_system_mem;
 
+  /* SRI: the background purger's view of this arena (see purge_arena) */
+  size_t purge_freed;
+  size_t purge_history[PURGE_STEPS];
+  size_t purge_dirty;          /* freed bytes not purged since: at least the bins' dirty pages */
+  size_t purge_sweep_freed;    /* freed bytes since the current sweep of the bins started */
+  int purge_bin;               /* where the sweep is: the bin, and its chunks already visited */
+  size_t purge_position;
+  bool purge_idle;
+  size_t purged;
+  size_t purged_metadata;
 };
 
+/* SRI: the layout described above; a negative array size means it broke.
+   A field is in the group that starts at first when it lies wholly
+   between first and the start of the next group.  */
+#define MALLOC_STATE_IN(field, first, next_group)			      \
+  (offsetof (struct malloc_state, field) >= offsetof (struct malloc_state, first) \
+   && offsetof (struct malloc_state, field)				      \
+      + sizeof (((struct malloc_state *) 0)->field)			      \
+      <= offsetof (struct malloc_state, next_group))
+
+extern int check_malloc_state_layout
+  [(MALLOC_STATE_IN (mutex, mutex, contention)
+    && MALLOC_STATE_IN (lock_last_contended, contention, metadata_pool_ready)
+    && MALLOC_STATE_IN (lock_sites, contention, metadata_pool_ready)
+    && MALLOC_STATE_IN (flags, contention, metadata_pool_ready)
+    && MALLOC_STATE_IN (fastbinsY, contention, metadata_pool_ready)
+    && MALLOC_STATE_IN (_md_top, contention, metadata_pool_ready)
+    && MALLOC_STATE_IN (bins, contention, metadata_pool_ready)
+    && MALLOC_STATE_IN (metadata_cache, contention, metadata_pool_ready)
+    && MALLOC_STATE_IN (htbl, metadata_pool_ready, next)
+    && MALLOC_STATE_IN (attached_threads, next, system_mem)
+    && MALLOC_STATE_IN (migrations_in, next, system_mem))
+   ? 1 : -1];
+
 
 
 struct malloc_par
@@ -1761,6 +1932,26 @@ struct malloc_par
   INTERNAL_SIZE_T arena_test;
   INTERNAL_SIZE_T arena_max;
 
+  /* SRI: the most fastbin chunks consolidated per malloc or free; 0 is no limit */
+  INTERNAL_SIZE_T consolidate_limit;
+
+#if SRI_SLAB
+  /* SRI: the largest request served from a slab run; 0 is none */
+  INTERNAL_SIZE_T slab_max;
+#endif
+
+  /* SRI: choose arenas by the CPU rather than by the thread */
+  int percpu_arenas;
+
+  /* SRI: the background purger's decay time in milliseconds; 0 is no purger */
+  int purge_decay;
+
+  /* SRI: grow, shrink and purge heaps in huge pages (see heap_granule) */
+  int thp_heaps;
+
+  /* SRI: the most bytes of freed mmapped chunks kept for reuse; 0 is no cache */
+  INTERNAL_SIZE_T mmap_cache_max;
+
   /* Memory map support */
   int n_mmaps;
   int n_mmaps_max;
@@ -1789,7 +1980,7 @@ struct malloc_par
 
 static struct malloc_state main_arena =
   {
-    .mutex = _LIBC_LOCK_INITIALIZER,
+    .mutex = ARENA_MUTEX_INITIALIZER,
     .next = &main_arena,
     .attached_threads = 1
   };
@@ -1802,11 +1993,43 @@ static struct malloc_par mp_ =
     .n_mmaps_max = DEFAULT_MMAP_MAX,
     .mmap_threshold = DEFAULT_MMAP_THRESHOLD,
     .trim_threshold = DEFAULT_TRIM_THRESHOLD,
+    .mmap_cache_max = DEFAULT_MMAP_CACHE_MAX,
 #define NARENAS_FROM_NCORES(n) ((n) * (sizeof (long) == 4 ? 2 : 8))
-    .arena_test = NARENAS_FROM_NCORES (1)
+    .arena_test = NARENAS_FROM_NCORES (1),
+#if SRI_SLAB
+    .slab_max = DEFAULT_SLAB_MAX,
+#endif
   };
 
 
+/* SRI: the background purger (see purger_main) */
+#define PURGER_NONE     0
+#define PURGER_RUNNING  1
+#define PURGER_FAILED   2
+
+static int purger_started = PURGER_NONE;
+
+static void purger_start (void);
+
+/* SRI: while the purger runs, free leaves trimming to it */
+static inline bool purger_active (void)
+{
+  return purger_started == PURGER_RUNNING && mp_.purge_decay != 0;
+}
+
+/* 
+   SRI: heaps (and the main arena's brk region) grow and shrink in these
+   units. With M_THP_HEAPS they are huge pages, so that transparent huge
+   pages can back whole heaps and trimming or purging never splits one;
+   only when a heap holds several of them, though.
+*/
+static inline size_t heap_granule (void)
+{
+  if (mp_.thp_heaps && HEAP_MAX_SIZE >= 2 * HUGE_PAGE_SIZE)
+    return HUGE_PAGE_SIZE;
+  return GLRO (dl_pagesize);
+}
+
 /* procedural abstraction */
 static inline int arena_index(mstate av)
 {
@@ -1817,6 +2040,13 @@ static inline int arena_index(mstate av)
 /*  Non public mallopt parameters.  */
 #define M_ARENA_TEST -7
 #define M_ARENA_MAX  -8
+#define M_METADATA_HUGEPAGES  -9
+#define M_CONSOLIDATE_LIMIT   -10
+#define M_SLAB_MAX            -11
+#define M_PERCPU_ARENAS       -12
+#define M_PURGE_DECAY         -13
+#define M_THP_HEAPS           -14
+#define M_MMAP_CACHE_MAX      -15
 
 
 /* ---------------- Error behavior ------------------------------------ */
@@ -2048,8 +2278,6 @@ static inline chunkinfoptr initial_md_top(mstate av)
   return _md_top;
 }
 
-#include "debug.h"
-
 static void
 malloc_init_state (mstate av, bool is_main_arena)
 {
@@ -2077,6 +2305,13 @@ malloc_init_state (mstate av, bool is_main_arena)
     set_max_fast (DEFAULT_MXFAST);
   av->flags |= FASTCHUNKS_BIT;
 
+  av->consolidate_cursor = 0;
+
+#if SRI_SLAB
+  for (i = 0; i < SLAB_NCLASSES; ++i)
+    av->slab_runs[i] = NULL;
+#endif
+
   if(is_main_arena){
     /* the main arena has arena index 1. */
     av->arena_index = MAIN_ARENA_INDEX;
@@ -2141,6 +2376,7 @@ static bool replenish_metadata_cache(mstate av)
 static chunkinfoptr sysmalloc (INTERNAL_SIZE_T, mstate);
 static int   systrim (size_t, mstate);
 static void  malloc_consolidate (mstate);
+static void  malloc_consolidate_bounded (mstate, size_t);
 
 /*
   ----------- SRI: Metadata manipulation and initialization -----------
@@ -2210,6 +2446,33 @@ unregister_chunk (mstate av, mchunkptr p, int tag)
   return metadata_delete(&av->htbl, chunk2mem(p));
 }
 
+static void
+unregister_chunk_deferred (mstate av, unregister_batch_t* batch, mchunkptr p, int tag)
+{
+  assert(av != NULL);
+  assert(p != NULL);
+
+#if SRI_DEBUG_HEADERS
+  if(tag){
+    p->__canary__ = tag;
+  }
+#endif
+
+  batch->chunks[batch->count++] = chunk2mem(p);
+  if(batch->count == METADATA_BATCH_LENGTH){
+    unregister_chunk_flush(av, batch);
+  }
+}
+
+static void
+unregister_chunk_flush (mstate av, unregister_batch_t* batch)
+{
+  if(batch->count > 0){
+    metadata_delete_batch(&av->htbl, batch->chunks, batch->count);
+    batch->count = 0;
+  }
+}
+
 static mchunkptr chunkinfo2chunk(chunkinfoptr _md_victim)
 {
   assert(_md_victim != NULL);
@@ -3026,6 +3289,225 @@ static chunkinfoptr split_chunk(mstate av,
   return _md_remainder;
 }
 
+/*
+  ------------------------- SRI: the mmap cache -------------------------
+
+  When mp_.mmap_cache_max is set (it is 0 by default), free does not
+  unmap mmapped chunks right away: up to that many bytes of them are
+  kept, still registered with main_arena's metadata and with lookup.c,
+  so that a program that keeps allocating and freeing
+  multi-megabyte buffers pays neither the mmap and munmap, nor the page
+  faults, nor the four table updates of each round.
+
+  There is a row of MMAP_CACHE_WAYS entries for each power of two of the
+  mappings' lengths, from 2^MMAP_CACHE_MIN_SHIFT up. A request takes the
+  smallest entry of its row, or of the next, that fits it while wasting
+  at most a quarter of the request; a free replaces the oldest entry of
+  its row. Entries age by the cache's clock, which ticks at each mmapped
+  malloc and free. They are unmapped once they are MMAP_CACHE_AGE ticks
+  old, oldest first when the cache would go over mp_.mmap_cache_max
+  bytes, when they have sat through a whole period of the purger, and
+  by malloc_trim.
+
+  All of it is done holding main_arena's lock. Cached chunks are not
+  counted in n_mmaps and mmapped_mem.
+*/
+
+#define MMAP_CACHE_MIN_SHIFT  17
+#define MMAP_CACHE_CLASSES    16
+#define MMAP_CACHE_WAYS       4
+#define MMAP_CACHE_AGE        1024
+
+typedef struct mmap_cache_entry {
+  chunkinfoptr md;          /* the cached chunk, or NULL */
+  size_t length;            /* of its mapping */
+  size_t stamp;             /* the clock when it was freed */
+} mmap_cache_entry_t;
+
+static struct mmap_cache {
+  mmap_cache_entry_t entries[MMAP_CACHE_CLASSES][MMAP_CACHE_WAYS];
+  size_t bytes;
+  size_t count;
+  size_t clock;
+  size_t purge_clock;       /* the clock at the purger's last visit */
+  size_t hits;
+  size_t misses;
+  size_t evicted;
+} mmap_cache;
+
+/* set when sysmalloc's chunk came from the cache, so calloc clears it */
+static __thread bool mmap_cache_hit attribute_tls_model_ie;
+
+/* the row for a mapping of length bytes; -1 if it is too large to cache */
+static inline int
+mmap_cache_class (size_t length)
+{
+  int shift = (int) (8 * sizeof (unsigned long) - 1) - __builtin_clzl (length);
+
+  if (shift < MMAP_CACHE_MIN_SHIFT)
+    return 0;
+  if (shift - MMAP_CACHE_MIN_SHIFT >= MMAP_CACHE_CLASSES)
+    return -1;
+  return shift - MMAP_CACHE_MIN_SHIFT;
+}
+
+/* unmaps the entry's chunk and drops it from the tables */
+static void
+mmap_cache_evict (mmap_cache_entry_t *e)
+{
+  chunkinfoptr _md_p = e->md;
+  mchunkptr p = chunkinfo2chunk (_md_p);
+  char *block = (char *) p - _md_p->prev_size;
+
+  lookup_delete_mmap (p);
+  __munmap (block, e->length);
+  unregister_chunk (&main_arena, p, false);
+
+  mmap_cache.bytes -= e->length;
+  mmap_cache.count--;
+  mmap_cache.evicted++;
+  e->md = NULL;
+}
+
+/* unmaps the entries freed at or before stamp, then the oldest ones until at most max bytes are left */
+static void
+mmap_cache_shrink (size_t stamp, size_t max)
+{
+  mmap_cache_entry_t *e, *oldest;
+  int cls, way;
+
+  while (mmap_cache.count > 0)
+    {
+      oldest = NULL;
+      for (cls = 0; cls < MMAP_CACHE_CLASSES; cls++)
+        for (way = 0; way < MMAP_CACHE_WAYS; way++)
+          {
+            e = &mmap_cache.entries[cls][way];
+            if (e->md == NULL)
+              continue;
+            if (e->stamp <= stamp)
+              mmap_cache_evict (e);
+            else if (oldest == NULL || e->stamp < oldest->stamp)
+              oldest = e;
+          }
+      if (oldest == NULL || mmap_cache.bytes <= max)
+        break;
+      mmap_cache_evict (oldest);
+    }
+}
+
+static inline size_t
+mmap_cache_aged (void)
+{
+  return mmap_cache.clock > MMAP_CACHE_AGE ? mmap_cache.clock - MMAP_CACHE_AGE : 0;
+}
+
+/* keeps the freed mmapped chunk _md_p for reuse; false if it should be unmapped */
+static bool
+mmap_cache_put (chunkinfoptr _md_p)
+{
+  mchunkptr p = chunkinfo2chunk (_md_p);
+  size_t length = _md_p->prev_size + chunksize (_md_p);
+  uintptr_t block = (uintptr_t) p - _md_p->prev_size;
+  mmap_cache_entry_t *e, *slot;
+  int cls, way;
+
+  mmap_cache.clock++;
+
+  /* munmap_chunk complains about misaligned ones */
+  cls = mmap_cache_class (length);
+  if (cls < 0 || length > mp_.mmap_cache_max
+      || ((block | length) & (GLRO (dl_pagesize) - 1)) != 0)
+    return false;
+
+  slot = NULL;
+  for (way = 0; way < MMAP_CACHE_WAYS; way++)
+    {
+      e = &mmap_cache.entries[cls][way];
+      if (e->md == _md_p)
+        {
+          malloc_printerr (check_action, "free(): double free of a cached mmapped chunk",
+                           chunk2mem (p), NULL);
+          return true;
+        }
+      if (slot == NULL || (slot->md != NULL && (e->md == NULL || e->stamp < slot->stamp)))
+        slot = e;
+    }
+  if (slot->md != NULL)
+    mmap_cache_evict (slot);
+  mmap_cache_shrink (mmap_cache_aged (), mp_.mmap_cache_max - length);
+
+  slot->md = _md_p;
+  slot->length = length;
+  slot->stamp = mmap_cache.clock;
+  mmap_cache.bytes += length;
+  mmap_cache.count++;
+
+  atomic_decrement (&mp_.n_mmaps);
+  atomic_add (&mp_.mmapped_mem, -length);
+  return true;
+}
+
+/* a cached chunk for an mmapped request of nb bytes, size once rounded to pages; or NULL */
+static chunkinfoptr
+mmap_cache_take (INTERNAL_SIZE_T nb, size_t size)
+{
+  mmap_cache_entry_t *e, *best;
+  chunkinfoptr _md_p;
+  int cls, last, way;
+
+  mmap_cache.clock++;
+  mmap_cache_hit = false;
+
+  mmap_cache_shrink (mmap_cache_aged (), mp_.mmap_cache_max);
+
+  best = NULL;
+  cls = mmap_cache_class (size);
+  if (mmap_cache.count > 0 && cls >= 0)
+    for (last = MIN (cls + 1, MMAP_CACHE_CLASSES - 1); cls <= last; cls++)
+      for (way = 0; way < MMAP_CACHE_WAYS; way++)
+        {
+          e = &mmap_cache.entries[cls][way];
+          if (e->md != NULL && chunksize (e->md) >= nb + SIZE_SZ
+              && e->length >= size && e->length <= size + size / 4
+              && (best == NULL || e->length < best->length))
+            best = e;
+        }
+  if (best == NULL)
+    {
+      mmap_cache.misses++;
+      return NULL;
+    }
+
+  _md_p = best->md;
+  best->md = NULL;
+  mmap_cache.bytes -= best->length;
+  mmap_cache.count--;
+  mmap_cache.hits++;
+  mmap_cache_hit = true;
+
+  int new = atomic_exchange_and_add (&mp_.n_mmaps, 1) + 1;
+  atomic_max (&mp_.max_n_mmaps, new);
+
+  unsigned long sum;
+  sum = atomic_exchange_and_add (&mp_.mmapped_mem, best->length) + best->length;
+  atomic_max (&mp_.max_mmapped_mem, sum);
+
+  return _md_p;
+}
+
+/* SRI: frees the mmapped chunk _md_p, holding main_arena's lock */
+static void
+free_mmapped_chunk (chunkinfoptr _md_p)
+{
+  mchunkptr p = chunkinfo2chunk (_md_p);
+
+  if (mmap_cache_put (_md_p))
+    return;
+  munmap_chunk (_md_p);
+  unregister_chunk (&main_arena, p, false);
+}
+
 /*
   sysmalloc handles malloc cases requiring more memory from the system.
   On entry, it is assumed that av->_md_top does not have enough
@@ -3130,6 +3612,23 @@ sysmalloc (INTERNAL_SIZE_T nb, mstate av)
         size = ALIGN_UP (nb + SIZE_SZ + MALLOC_ALIGN_MASK, pagesize);
       tried_mmap = true;
 
+      /* SRI: a recently freed chunk of about this size saves the mmap */
+      _md_p = mmap_cache_take (nb, size);
+      if (_md_p != NULL)
+        {
+          check_chunk (av, chunkinfo2chunk (_md_p), _md_p);
+
+          /* restore the state of the locks */
+          UNLOCK_ARENA(&main_arena, SYSMALLOC_SITE);
+
+          have_switched_lock = false;
+
+          if(av != NULL){
+            LOCK_ARENA(av, SYSMALLOC_SITE);
+          }
+          return _md_p;
+        }
+
       /* Don't try if size wraps around 0 */
       if ((unsigned long) (size) > (unsigned long) (nb))
         {
@@ -3295,10 +3794,13 @@ sysmalloc (INTERNAL_SIZE_T nb, mstate av)
 
           /* Setup fencepost and free the old top chunk with a multiple of
              MALLOC_ALIGNMENT in size. */
-          /* The fencepost takes at least MINSIZE bytes, because it might
-             become the top chunk again later.  Note that a footer is set
-             up, too, although the chunk is marked in use. */
-          old_size = (old_size - MINSIZE) & ~MALLOC_ALIGN_MASK;
+          /* The fenceposts take at least MINSIZE bytes, because fencepost_1
+             might become the top chunk again later.  Note that a footer is set
+             up, too, although the chunk is marked in use. 
+             SRI: fencepost_0 takes FENCEPOST_SIZE bytes, which is none at all
+             without in-band headers; it then sits at the very end of the heap.
+          */
+          old_size = (old_size - (2 * SIZE_SZ + FENCEPOST_SIZE)) & ~MALLOC_ALIGN_MASK;
 
           fencepost_0 = chunk_at_offset (old_top, old_size + 2 * SIZE_SZ);
           _md_fencepost_0 = register_chunk(av,  fencepost_0, false, 4);
@@ -3373,6 +3875,13 @@ sysmalloc (INTERNAL_SIZE_T nb, mstate av)
 
       size = ALIGN_UP (size, pagesize);
 
+      /* SRI: with M_THP_HEAPS end on a huge page boundary */
+      if (heap_granule () != pagesize && contiguous (av) && old_size != 0)
+        {
+          uintptr_t end = (uintptr_t) old_top + old_size;
+          size = ALIGN_UP (end + size, heap_granule ()) - end;
+        }
+
       /*
         Don't try to call MORECORE if argument is so big as to appear
         negative. Note that since mmap takes size_t arg, it may succeed
@@ -3391,6 +3900,13 @@ sysmalloc (INTERNAL_SIZE_T nb, mstate av)
           void (*hook) (void) = atomic_forced_read (__after_morecore_hook);
           if (__builtin_expect (hook != NULL, 0))
             (*hook)();
+
+          if (heap_granule () != pagesize)
+            {
+              char *advised = (char *) ALIGN_UP ((uintptr_t) brk, pagesize);
+              if (advised < brk + size)
+                sri_madvise_hugepages (advised, brk + size - advised);
+            }
         }
       else
         {
@@ -3615,7 +4131,8 @@ sysmalloc (INTERNAL_SIZE_T nb, mstate av)
                     double fencepost at old_top to prevent consolidation with space
                     we don't own. These fenceposts are artificial chunks that are
                     marked as inuse and are in any case too small to use.  We need
-                    two to make sizes and alignments work out.
+                    two to make sizes and alignments work out.  SRI: and because
+                    the inuse bit of fencepost_0 is kept in fencepost_1's metadata.
                   */
 
                   if (old_size != 0)
@@ -3624,8 +4141,10 @@ sysmalloc (INTERNAL_SIZE_T nb, mstate av)
                         Shrink old_top to insert fenceposts, keeping size a
                         multiple of MALLOC_ALIGNMENT. We know there is at least
                         enough space in old_top to do this.
+                        SRI: fencepost_1 takes SBRK_FENCEPOST_SIZE bytes, so that
+                        it starts before the end of the old space.
                       */
-                      old_size = (old_size - 4 * SIZE_SZ) & ~MALLOC_ALIGN_MASK;
+                      old_size = (old_size - (2 * SIZE_SZ + SBRK_FENCEPOST_SIZE)) & ~MALLOC_ALIGN_MASK;
                       set_head (_md_old_top, old_size | PREV_INUSE);
                       /*
                         Note that the following assignments completely overwrite
@@ -3664,7 +4183,8 @@ sysmalloc (INTERNAL_SIZE_T nb, mstate av)
                       set_head(_md_fencepost_0, (2 * SIZE_SZ) | PREV_INUSE); 
                                             
                       fencepost_1 = chunk_at_offset (old_top, old_size + 2 * SIZE_SZ);
-                      _md_fencepost_1 = register_chunk(av, fencepost_1, false, 8);
+
+		      _md_fencepost_1 = register_chunk(av, fencepost_1, false, 8);
 
 		      _md_fencepost_1->md_next = av->_md_top;
 		      _md_fencepost_1->md_prev = _md_fencepost_0;
@@ -3672,10 +4192,12 @@ sysmalloc (INTERNAL_SIZE_T nb, mstate av)
 
 		      av->_md_top->md_prev = _md_fencepost_1;
 
-                      set_head(_md_fencepost_1, (2 * SIZE_SZ) | PREV_INUSE);
-                      
-		      check_metadata_chunk(av, fencepost_0, _md_fencepost_0);
+		      set_head(_md_fencepost_1, SBRK_FENCEPOST_SIZE | PREV_INUSE);
+
 		      check_metadata_chunk(av, fencepost_1, _md_fencepost_1);
+
+		      assert (fencepost_1 != topchunk);
+		      check_metadata_chunk(av, fencepost_0, _md_fencepost_0);
 		      check_metadata(av, _md_fpost_prev);
 		      check_top(av);
 
@@ -3754,6 +4276,15 @@ systrim (size_t pad, mstate av)
   */
   current_brk = (char *) (MORECORE (0));
   topchunk = chunkinfo2chunk(av->_md_top);
+
+  /* SRI: with M_THP_HEAPS leave the break on a huge page boundary */
+  if (heap_granule () != pagesize)
+    {
+      extra = current_brk - (char *) ALIGN_UP ((uintptr_t) current_brk - extra, heap_granule ());
+      if (extra <= 0)
+        return 0;
+    }
+
   if (current_brk == (char *) (topchunk) + top_size)
     {
       /*
@@ -3899,43 +4430,256 @@ mremap_chunk (mstate av, chunkinfoptr _md_p, size_t new_size)
 }
 #endif /* HAVE_MREMAP */
 
-/*------------------------ Public wrappers. --------------------------------*/
+#if SRI_SLAB
+/*
+  ------------------------- SRI: slab runs -------------------------
 
-void *
-__libc_malloc (size_t bytes)
+  Small requests are served from runs of equal sized slots (see SRI_SLAB
+  in sri.h). A run is one in use chunk of its arena, obtained with
+  _int_memalign, so that the run holding a slot is found by rounding the
+  slot down to SLAB_RUN_SIZE and looking that up in lookup.c's run table.
+  All manipulation of a run happens under its arena's lock.
+*/
+
+static inline size_t slab_class (size_t bytes)
 {
-  mstate ar_ptr;
-  void *mem;
-  chunkinfoptr _md_victim;
-  
-    
-  void *(*hook) (size_t, const void *)
-    = atomic_forced_read (__malloc_hook);
-  if (__builtin_expect (hook != NULL, 0))
-    return (*hook)(bytes, RETURN_ADDRESS (0));
+  return bytes == 0 ? 0 : (bytes - 1) / MALLOC_ALIGNMENT;
+}
 
-  arena_get (ar_ptr, bytes, MALLOC_SITE);
+/* the run mem is a slot of, or NULL if mem did not come from a run */
+static inline slab_run_t *slab_run_for (void *mem)
+{
+  return (slab_run_t *) lookup_run ((void *) ((uintptr_t) mem & ~((uintptr_t) SLAB_RUN_SIZE - 1)));
+}
 
-  _md_victim = _int_malloc (ar_ptr, bytes);
+static inline void slab_push (mstate av, size_t cls, slab_run_t *run)
+{
+  run->prev = NULL;
+  run->next = av->slab_runs[cls];
+  if (run->next != NULL)
+    run->next->prev = run;
+  av->slab_runs[cls] = run;
+}
 
+static inline void slab_unlink (mstate av, size_t cls, slab_run_t *run)
+{
+  if (run->prev != NULL)
+    run->prev->next = run->next;
+  else
+    av->slab_runs[cls] = run->next;
+  if (run->next != NULL)
+    run->next->prev = run->prev;
+  run->next = run->prev = NULL;
+}
 
-  /* Retry with another arena only if we were able to find a usable arena
-     before.  */
-  if (!_md_victim && ar_ptr != NULL)
-    {
-      LIBC_PROBE (memory_malloc_retry, 1, bytes);
-      ar_ptr = arena_get_retry (ar_ptr, bytes, MALLOC_SITE);
-      _md_victim = _int_malloc (ar_ptr, bytes);
-    }
+static slab_run_t *
+slab_new_run (mstate av, size_t cls)
+{
+  chunkinfoptr _md_run;
+  slab_run_t *run;
+  size_t header;
 
-  if (ar_ptr != NULL)
-    UNLOCK_ARENA(ar_ptr, MALLOC_SITE);
+  /* a run must be part of the heap; an mmapped one belongs to the main arena */
+  if ((unsigned long) (2 * SLAB_RUN_SIZE + MINSIZE) >= (unsigned long) mp_.mmap_threshold)
+    return NULL;
 
-  mem = chunkinfo2mem(_md_victim);
+  if (!replenish_metadata_cache (av))
+    return NULL;
 
-  assert (!mem || chunk_is_mmapped (_md_victim, mem2chunk (mem)) || ar_ptr == arena_for_chunk (mem2chunk (mem)));
-  
-  if (ar_ptr != NULL)check_top(ar_ptr);
+  _md_run = _int_memalign (av, SLAB_RUN_SIZE, SLAB_RUN_SIZE);
+  if (_md_run == NULL)
+    return NULL;
+
+  if (chunk_is_mmapped (_md_run, chunkinfo2chunk (_md_run)))
+    {
+      /* sysmalloc fell back on mmap; give it back as __libc_free would */
+      if (av != &main_arena)
+        {
+          UNLOCK_ARENA (av, MALLOC_SITE);
+          LOCK_ARENA (&main_arena, MALLOC_SITE);
+        }
+      free_mmapped_chunk (_md_run);
+      if (av != &main_arena)
+        {
+          UNLOCK_ARENA (&main_arena, MALLOC_SITE);
+          LOCK_ARENA (av, MALLOC_SITE);
+        }
+      return NULL;
+    }
+
+  run = (slab_run_t *) chunkinfo2mem (_md_run);
+  assert (((uintptr_t) run & (SLAB_RUN_SIZE - 1)) == 0);
+
+  header = (sizeof (slab_run_t) + MALLOC_ALIGN_MASK) & ~MALLOC_ALIGN_MASK;
+  memset (run, 0, sizeof (slab_run_t));
+  run->av = av;
+  run->slots = (char *) run + header;
+  run->slot_size = (cls + 1) * MALLOC_ALIGNMENT;
+  run->nslots = (SLAB_RUN_SIZE - header) / run->slot_size;
+  run->nfree = run->nslots;
+
+  lookup_add_run (run, run);
+  slab_push (av, cls, run);
+
+  return run;
+}
+
+static void
+slab_release_run (mstate av, slab_run_t *run)
+{
+  lookup_delete_run (run);
+  _int_free (av, NULL, mem2chunk (run), true, false);
+}
+
+/* returns a slot for bytes, or NULL if _int_malloc should serve it */
+static void *
+slab_malloc (mstate av, size_t bytes)
+{
+  size_t cls, word, slot;
+  slab_run_t *run;
+
+  cls = slab_class (bytes);
+  run = av->slab_runs[cls];
+  if (run == NULL)
+    {
+      run = slab_new_run (av, cls);
+      if (run == NULL)
+        return NULL;
+    }
+
+  assert (run->nfree > 0);
+  for (word = run->hint; run->bitmap[word] == ~(uint64_t) 0; word++)
+    assert (word < SLAB_BITMAP_WORDS);
+  run->hint = word;
+
+  slot = 64 * word + __builtin_ctzll (~run->bitmap[word]);
+  assert (slot < run->nslots);
+  run->bitmap[word] |= (uint64_t) 1 << (slot % 64);
+
+  if (--run->nfree == 0)
+    slab_unlink (av, cls, run);
+
+  return run->slots + slot * run->slot_size;
+}
+
+static void
+slab_free_slot (mstate av, slab_run_t *run, void *mem)
+{
+  size_t cls, offset, slot, word;
+  uint64_t bit;
+
+  offset = (char *) mem - run->slots;
+  slot = offset / run->slot_size;
+  word = slot / 64;
+  bit = (uint64_t) 1 << (slot % 64);
+
+  if (__builtin_expect ((char *) mem < run->slots, 0)
+      || __builtin_expect (offset % run->slot_size != 0, 0)
+      || __builtin_expect (slot >= run->nslots, 0)
+      || __builtin_expect ((run->bitmap[word] & bit) == 0, 0))
+    {
+      malloc_printerr (check_action, "free(): invalid pointer", mem, av);
+      return;
+    }
+
+  cls = slab_class (run->slot_size);
+  run->bitmap[word] &= ~bit;
+  if (word < run->hint)
+    run->hint = word;
+
+  /* a full run is on no list */
+  if (run->nfree++ == 0)
+    slab_push (av, cls, run);
+
+  /* keep the last run of a class with room, even when it is empty */
+  if (run->nfree == run->nslots && (run->next != NULL || run->prev != NULL))
+    {
+      slab_unlink (av, cls, run);
+      slab_release_run (av, run);
+    }
+}
+
+/* frees mem if it is a slot, returning false if it is not */
+static bool
+slab_free (void *mem)
+{
+  slab_run_t *run;
+  mstate av;
+
+  run = slab_run_for (mem);
+  if (run == NULL)
+    return false;
+
+  /* the run cannot go away under us while mem is in use */
+  av = run->av;
+  LOCK_ARENA (av, FREE_SITE);
+  slab_free_slot (av, run, mem);
+  UNLOCK_ARENA (av, FREE_SITE);
+  return true;
+}
+
+/* the usable size of mem if it is a slot, 0 if it is not */
+static size_t
+slab_usable_size (void *mem)
+{
+  slab_run_t *run = slab_run_for (mem);
+  return run == NULL ? 0 : run->slot_size;
+}
+#endif
+
+
+/*------------------------ Public wrappers. --------------------------------*/
+
+void *
+__libc_malloc (size_t bytes)
+{
+  mstate ar_ptr;
+  void *mem;
+  chunkinfoptr _md_victim;
+  
+    
+  void *(*hook) (size_t, const void *)
+    = atomic_forced_read (__malloc_hook);
+  if (__builtin_expect (hook != NULL, 0))
+    return (*hook)(bytes, RETURN_ADDRESS (0));
+
+  if (__glibc_unlikely (mp_.purge_decay != 0 && purger_started == PURGER_NONE))
+    purger_start ();
+
+  arena_get (ar_ptr, bytes, MALLOC_SITE);
+
+#if SRI_SLAB
+  if (bytes <= mp_.slab_max && ar_ptr != NULL)
+    {
+      mem = slab_malloc (ar_ptr, bytes);
+      if (mem != NULL)
+        {
+          UNLOCK_ARENA(ar_ptr, MALLOC_SITE);
+          return mem;
+        }
+    }
+#endif
+
+  _md_victim = _int_malloc (ar_ptr, bytes);
+
+
+  /* Retry with another arena only if we were able to find a usable arena
+     before.  */
+  if (!_md_victim && ar_ptr != NULL)
+    {
+      LIBC_PROBE (memory_malloc_retry, 1, bytes);
+      ar_ptr = arena_get_retry (ar_ptr, bytes, MALLOC_SITE);
+      _md_victim = _int_malloc (ar_ptr, bytes);
+    }
+
+  if (ar_ptr != NULL)
+    UNLOCK_ARENA(ar_ptr, MALLOC_SITE);
+
+  mem = chunkinfo2mem(_md_victim);
+
+  assert (!mem || chunk_is_mmapped (_md_victim, mem2chunk (mem)) || ar_ptr == arena_for_chunk (mem2chunk (mem)));
+  
+  if (ar_ptr != NULL)check_top(ar_ptr);
 
   return mem;
 }
@@ -3959,6 +4703,11 @@ __libc_free (void *mem)
   if (mem == 0)                              /* free(0) has no effect */
     return;
 
+#if SRI_SLAB
+  if (slab_free (mem))
+    return;
+#endif
+
   p = mem2chunk (mem);
 
   size_t index = 0;
@@ -3999,9 +4748,7 @@ __libc_free (void *mem)
         }
       
 
-      munmap_chunk (_md_p); 
-
-      unregister_chunk(ar_ptr, p, false);
+      free_mmapped_chunk (_md_p);
       
       UNLOCK_ARENA(ar_ptr, FREE_SITE);
       return;
@@ -4042,6 +4789,28 @@ __libc_realloc (void *oldmem, size_t bytes)
   if (oldmem == 0)
     return __libc_malloc (bytes);
 
+#if SRI_SLAB
+  /* a slot does not grow in place */
+  size_t slot_size = slab_usable_size (oldmem);
+  if (slot_size != 0)
+    {
+      /* as glibc does, whatever REALLOC_ZERO_BYTES_FREES says */
+      if (bytes == 0)
+        {
+          slab_free (oldmem);
+          return 0;
+        }
+      if (bytes <= slot_size)
+        return oldmem;
+      mem = __libc_malloc (bytes);
+      if (mem == 0)
+        return 0;
+      memcpy (mem, oldmem, slot_size);
+      slab_free (oldmem);
+      return mem;
+    }
+#endif
+
   /* chunk corresponding to oldmem */
   const mchunkptr oldp = mem2chunk (oldmem);
 
@@ -4130,9 +4899,8 @@ __libc_realloc (void *oldmem, size_t bytes)
         return 0;              /* propagate failure */
       }
       memcpy (newmem, oldmem, oldsize - 2 * SIZE_SZ);
-      munmap_chunk (_md_oldp);
       LOCK_ARENA(&main_arena, REALLOC_SITE);
-      unregister_chunk(&main_arena, oldp, false);
+      free_mmapped_chunk (_md_oldp);
       UNLOCK_ARENA(&main_arena, REALLOC_SITE);
       return newmem;
     }
@@ -4387,7 +5155,8 @@ __libc_calloc (size_t n, size_t elem_size)
   /* Two optional cases in which clearing not necessary */
   if (chunk_is_mmapped (_md_victim, victim))
     {
-      if (__builtin_expect (perturb_byte, 0))
+      /* SRI: unless it was recycled by the mmap cache */
+      if (__builtin_expect (perturb_byte, 0) || mmap_cache_hit)
         return memset (mem, 0, sz);
 
       return mem;
@@ -4606,8 +5375,10 @@ _int_malloc (mstate av, size_t bytes)
   else
     {
       idx = largebin_index (nb);
+      /* SRI: the full consolidation is left for when we would otherwise
+         have to go to the system (see use_top below).  */
       if (have_fastchunks (av))
-        malloc_consolidate (av);
+        malloc_consolidate_bounded (av, mp_.consolidate_limit);
     }
 
   /*
@@ -5146,6 +5917,8 @@ _int_free (mstate av, chunkinfoptr _md_p, mchunkptr p, bool have_lock, bool fres
 
   assert(md_next_sanity_check(av, _md_p, p));
 
+  av->freed_bytes += size;
+
   _md_nextchunk = _md_p->md_next;
   nextchunk = chunkinfo2chunk(_md_nextchunk);
   nextsize = chunksize (_md_nextchunk);
@@ -5359,9 +6132,9 @@ _int_free (mstate av, chunkinfoptr _md_p, mchunkptr p, bool have_lock, bool fres
       is reached.
     */
 
-    if ((unsigned long)(size) >= FASTBIN_CONSOLIDATION_THRESHOLD) {
+    if ((unsigned long)(size) >= FASTBIN_CONSOLIDATION_THRESHOLD && !purger_active ()) {
       if (have_fastchunks(av))
-        malloc_consolidate(av);
+        malloc_consolidate_bounded(av, mp_.consolidate_limit);
 
       if (av == &main_arena) {
 #ifndef MORECORE_CANNOT_TRIM
@@ -5406,14 +6179,12 @@ _int_free (mstate av, chunkinfoptr _md_p, mchunkptr p, bool have_lock, bool fres
       }
       LOCK_ARENA(&main_arena, FREE_SITE);
     
-      munmap_chunk (_md_p);
-      unregister_chunk(&main_arena, p, false);
+      free_mmapped_chunk (_md_p);
       //Done:  md_next = md_prev = NULL 
       UNLOCK_ARENA(&main_arena, FREE_SITE);
     } else {
 
-      munmap_chunk (_md_p);
-      unregister_chunk(&main_arena, p, false);
+      free_mmapped_chunk (_md_p);
       //Done: md_next = md_prev = NULL 
       if(!have_lock){
 	UNLOCK_ARENA(&main_arena, FREE_SITE);
@@ -5438,16 +6209,18 @@ _int_free (mstate av, chunkinfoptr _md_p, mchunkptr p, bool have_lock, bool fres
   initialization code.
 */
 
-static void malloc_consolidate(mstate av)
+/*
+  consolidate_chunk coalesces one chunk taken off a fastbin with its free
+  neighbours, and puts the result in the unsorted bin (or top). The
+  metadata of the chunks it absorbs is queued on the batch.
+*/
+
+static void consolidate_chunk(mstate av, chunkinfoptr _md_p, unregister_batch_t* batch)
 {
-  mfastbinptr*    fb;                 /* current fastbin being consolidated */
-  mfastbinptr*    maxfb;              /* last fastbin (for loop control) */
   mchunkptr       p;                  /* current chunk being consolidated */
   mchunkptr       temp;               /* temporary handle on current chunk being consolidated */
   chunkinfoptr    _md_temp;           /* temporary handle on the metatdata of the chunk being coalesced */
-  chunkinfoptr    _md_p;              /* metatdata of current chunk being consolidated */
-  chunkinfoptr    _md_nextp;          /* metadata of next chunk to consolidate */
-  
+
   chunkinfoptr    unsorted_bin;       /* bin header */
   chunkinfoptr    first_unsorted;     /* chunk to link to */
 
@@ -5463,6 +6236,113 @@ static void malloc_consolidate(mstate av)
 
   mchunkptr topchunk;
 
+  unsorted_bin = unsorted_chunks(av);
+
+  p = chunkinfo2chunk(_md_p);
+  check_inuse_chunk(av, p, _md_p);
+
+  /* Slightly streamlined version of consolidation code in free() */
+  size = chunksize(_md_p);
+
+  assert(md_next_sanity_check(av, _md_p, p));
+	  
+  _md_nextchunk = _md_p->md_next;
+  nextchunk = chunkinfo2chunk(_md_nextchunk );
+  nextsize = chunksize(_md_nextchunk);
+
+  if (!prev_inuse(_md_p, p)) {
+    prevsize = _md_p->prev_size;
+    size += prevsize;
+    temp = p;
+    _md_temp = _md_p;
+
+    assert(md_prev_sanity_check(av, _md_p, p));
+
+    _md_p = _md_p->md_prev;
+    p = chunkinfo2chunk(_md_p);
+	    
+    bin_unlink(av, _md_p, &bck, &fwd);
+
+    /* correct the md_next and md_prev pointers */
+    _md_p->md_next = _md_temp->md_next;
+    _md_temp->md_next->md_prev = _md_p;
+	    
+    assert(_md_nextchunk == _md_temp->md_next);
+
+    check_metadata_chunk(av, p, _md_p);
+    check_metadata(av, _md_temp->md_next);
+    check_metadata_chunk(av, nextchunk,  _md_nextchunk);
+
+    /* do not leak the coalesced chunk's metadata */
+    unregister_chunk_deferred(av, batch, temp, 7);
+  }
+
+  topchunk = chunkinfo2chunk(av->_md_top);
+
+
+  if (nextchunk != topchunk) {
+    nextinuse = inuse_bit(av, _md_nextchunk);
+
+    if (!nextinuse) {
+      size += nextsize;
+      bin_unlink(av, _md_nextchunk, &bck, &fwd);
+
+      /* correct the md_next & md_prev pointers */
+      _md_temp = _md_nextchunk->md_next;
+      _md_p->md_next = _md_temp;
+      _md_temp->md_prev = _md_p;
+      if(_md_temp != NULL){
+	_md_temp->md_prev = _md_p;
+	check_metadata(av, _md_temp);
+      }
+
+      check_metadata_chunk(av, p, _md_p);
+	      
+
+      /* do not leak the coalesced chunk's metadata */
+      unregister_chunk_deferred(av, batch, nextchunk, 8);
+    } else
+      clear_inuse_bit(av, _md_nextchunk);
+
+    first_unsorted = unsorted_bin->fd;
+    unsorted_bin->fd = _md_p;
+    first_unsorted->bk = _md_p;
+
+    if (!in_smallbin_range (size)) {
+      _md_p->fd_nextsize = NULL;
+      _md_p->bk_nextsize = NULL;
+    }
+
+    set_head(_md_p, size | PREV_INUSE);
+    _md_p->bk = unsorted_bin;
+    _md_p->fd = first_unsorted;
+    set_foot(av, _md_p);
+          
+  }
+
+  else { /* nextchunk == topchunk */
+	    
+    size += nextsize;
+    set_head(_md_p, size | PREV_INUSE);
+    av->_md_top = _md_p;
+    /* fix the md_next pointer */
+    _md_p->md_next = NULL;
+
+    /* do not leak the old top's chunk's metadata */
+    unregister_chunk_deferred(av, batch, topchunk, 9);
+    check_top(av);
+  }
+}
+
+static void malloc_consolidate(mstate av)
+{
+  mfastbinptr*    fb;                 /* current fastbin being consolidated */
+  mfastbinptr*    maxfb;              /* last fastbin (for loop control) */
+  chunkinfoptr    _md_p;              /* metatdata of current chunk being consolidated */
+  chunkinfoptr    _md_nextp;          /* metadata of next chunk to consolidate */
+
+  unregister_batch_t unregister_batch;
+
 
   /*
     If max_fast is 0, we know that av hasn't
@@ -5473,7 +6353,7 @@ static void malloc_consolidate(mstate av)
 
     clear_fastchunks(av);
 
-    unsorted_bin = unsorted_chunks(av);
+    unregister_batch.count = 0;
 
     /*
       Remove each chunk from fast bin and consolidate it, placing it
@@ -5489,116 +6369,92 @@ static void malloc_consolidate(mstate av)
       _md_p = atomic_exchange_acq (fb, 0);
       if (_md_p != 0) {
         do {
-	  p = chunkinfo2chunk(_md_p);
-          check_inuse_chunk(av, p, _md_p);
           _md_nextp = _md_p->fd;
+	  consolidate_chunk(av, _md_p, &unregister_batch);
+        } while ( (_md_p = _md_nextp) != 0);
+	
+      }
+    } while (fb++ != maxfb);
 
-          /* Slightly streamlined version of consolidation code in free() */
-          size = chunksize(_md_p);
-
-	  assert(md_next_sanity_check(av, _md_p, p));
-	  
-	  _md_nextchunk = _md_p->md_next;
-          nextchunk = chunkinfo2chunk(_md_nextchunk );
-          nextsize = chunksize(_md_nextchunk);
-
-          if (!prev_inuse(_md_p, p)) {
-            prevsize = _md_p->prev_size;
-            size += prevsize;
-	    temp = p;
-	    _md_temp = _md_p;
-
-	    assert(md_prev_sanity_check(av, _md_p, p));
-
-	    _md_p = _md_p->md_prev;
-	    p = chunkinfo2chunk(_md_p);
-	    
-            bin_unlink(av, _md_p, &bck, &fwd);
-
-	    /* correct the md_next and md_prev pointers */
-	    _md_p->md_next = _md_temp->md_next;
-	    _md_temp->md_next->md_prev = _md_p;
-	    
-	    assert(_md_nextchunk == _md_temp->md_next);
-
-	    check_metadata_chunk(av, p, _md_p);
-	    check_metadata(av, _md_temp->md_next);
-	    check_metadata_chunk(av, nextchunk,  _md_nextchunk);
+    unregister_chunk_flush(av, &unregister_batch);
 
-	    /* do not leak the coalesced chunk's metadata */
-	    unregister_chunk(av, temp, 7); 
-          }
+    /* every fastbin is empty, so a bounded consolidation can start anywhere */
+    av->consolidate_cursor = 0;
+  }
+  else {
+    malloc_init_state(av, true);
+    
+#ifndef NDEBUG
+    check_bins(av);
+#endif
 
-	  topchunk = chunkinfo2chunk(av->_md_top);
+    check_malloc_state(av);
+  }
+}
 
+/*
+  malloc_consolidate_bounded is malloc_consolidate, but it stops after
+  consolidating limit chunks. Chunks are popped off the fastbins one at
+  a time (as in _int_malloc, so it is safe against concurrent frees),
+  starting at the fastbin where the previous call left off. A limit of
+  0 means no limit, i.e. malloc_consolidate.
+
+  The fastchunks bit is cleared up front, as in malloc_consolidate, so
+  any chunk freed while we are at it sets it again; if we stop early
+  we set it ourselves.
+*/
 
-          if (nextchunk != topchunk) {
-            nextinuse = inuse_bit(av, _md_nextchunk);
+static void malloc_consolidate_bounded(mstate av, size_t limit)
+{
+  mfastbinptr*    fb;
+  chunkinfoptr    _md_p;
+  chunkinfoptr    pp;
+  size_t          consolidated;
+  int             empty_bins;
 
-            if (!nextinuse) {
-              size += nextsize;
-              bin_unlink(av, _md_nextchunk, &bck, &fwd);
+  unregister_batch_t unregister_batch;
 
-	      /* correct the md_next & md_prev pointers */
-	      _md_temp = _md_nextchunk->md_next;
-	      _md_p->md_next = _md_temp;
-	      _md_temp->md_prev = _md_p;
-	      if(_md_temp != NULL){
-		_md_temp->md_prev = _md_p;
-		check_metadata(av, _md_temp);
-	      }
+  if (limit == 0 || get_max_fast () == 0) {
+    malloc_consolidate(av);
+    return;
+  }
 
-	      check_metadata_chunk(av, p, _md_p);
-	      
+  clear_fastchunks(av);
 
-	      /* do not leak the coalesced chunk's metadata */
-	      unregister_chunk(av, nextchunk, 8); 
-            } else
-              clear_inuse_bit(av, _md_nextchunk);
+  unregister_batch.count = 0;
+  consolidated = 0;
+  empty_bins = 0;
 
-            first_unsorted = unsorted_bin->fd;
-            unsorted_bin->fd = _md_p;
-            first_unsorted->bk = _md_p;
+  while (empty_bins < NFASTBINS) {
 
-            if (!in_smallbin_range (size)) {
-              _md_p->fd_nextsize = NULL;
-              _md_p->bk_nextsize = NULL;
-            }
+    if (consolidated == limit) {
+      set_fastchunks(av);
+      break;
+    }
 
-            set_head(_md_p, size | PREV_INUSE);
-            _md_p->bk = unsorted_bin;
-            _md_p->fd = first_unsorted;
-            set_foot(av, _md_p);
-          
-	  }
+    fb = &fastbin (av, av->consolidate_cursor);
+    pp = *fb;
+    do
+      {
+	_md_p = pp;
+	if (_md_p == NULL)
+	  break;
+      }
+    while ((pp = catomic_compare_and_exchange_val_acq (fb, _md_p->fd, _md_p))
+	   != _md_p);
 
-          else { /* nextchunk == topchunk */
-	    
-            size += nextsize;
-            set_head(_md_p, size | PREV_INUSE);
-            av->_md_top = _md_p;
-	    /* fix the md_next pointer */
-	    _md_p->md_next = NULL;
-
-	    /* do not leak the old top's chunk's metadata */
-	    unregister_chunk(av, topchunk, 9); 
-            check_top(av);
-          }
+    if (_md_p == NULL) {
+      av->consolidate_cursor = (av->consolidate_cursor + 1) % NFASTBINS;
+      empty_bins++;
+      continue;
+    }
 
-        } while ( (_md_p = _md_nextp) != 0);
-	
-      }
-    } while (fb++ != maxfb);
+    empty_bins = 0;
+    consolidate_chunk(av, _md_p, &unregister_batch);
+    consolidated++;
   }
-  else {
-    malloc_init_state(av, true);
-    
-#ifndef NDEBUG
-    check_bins(av);
-#endif
 
-    check_malloc_state(av);
-  }
+  unregister_chunk_flush(av, &unregister_batch);
 }
 
 /*
@@ -6062,6 +6918,53 @@ _int_memalign (mstate av, size_t alignment, size_t bytes)
   ------------------------------ malloc_trim ------------------------------
 */
 
+/* SRI: the whole pages (huge pages with M_THP_HEAPS) inside the free chunk p; returns their length */
+static size_t
+chunk_pages (mchunkptr p, INTERNAL_SIZE_T size, char **pages)
+{
+  const size_t psm1 = heap_granule () - 1;
+
+  if (size > psm1 + sizeof (struct malloc_chunk))
+    {
+      /* See whether the chunk contains at least one unused page.  */
+      char *paligned_mem = (char *) (((uintptr_t) p
+                                      + sizeof (struct malloc_chunk)
+                                      + psm1) & ~psm1);
+
+      assert ((char *) chunk2mem (p) + 4 * SIZE_SZ <= paligned_mem);
+      assert ((char *) p + size > paligned_mem);
+
+      /* This is the size we could potentially free.  */
+      size -= paligned_mem - (char *) p;
+
+      if (size > psm1)
+        {
+          *pages = paligned_mem;
+          return size & ~psm1;
+        }
+    }
+  return 0;
+}
+
+/* SRI: gives the whole pages inside the free chunk p back to the kernel */
+static size_t
+purge_chunk (mchunkptr p, INTERNAL_SIZE_T size)
+{
+  char *pages;
+  size_t length = chunk_pages (p, size, &pages);
+
+  if (length != 0)
+    {
+#if MALLOC_DEBUG
+      /* When debugging we simulate destroying the memory
+         content.  */
+      memset (pages, 0x89, length);
+#endif
+      __madvise (pages, length, MADV_DONTNEED);
+    }
+  return length;
+}
+
 static int
 mtrim (mstate av, size_t pad)
 {
@@ -6074,7 +6977,6 @@ mtrim (mstate av, size_t pad)
 
   const size_t ps = GLRO (dl_pagesize);
   int psindex = bin_index (ps);
-  const size_t psm1 = ps - 1;
 
   int result = 0;
   for (int i = 1; i < NBINS; ++i)
@@ -6083,38 +6985,17 @@ mtrim (mstate av, size_t pad)
         mbinptr bin = bin_at (av, i);
 
         for (chunkinfoptr _md_p = last (bin); _md_p != bin; _md_p = _md_p->bk)
-          {
-            INTERNAL_SIZE_T size = chunksize (_md_p);
-	    mchunkptr p = chunkinfo2chunk(_md_p);
-
-            if (size > psm1 + sizeof (struct malloc_chunk))
-              {
-                /* See whether the chunk contains at least one unused page.  */
-                char *paligned_mem = (char *) (((uintptr_t) p
-                                                + sizeof (struct malloc_chunk)
-                                                + psm1) & ~psm1);
-
-                assert ((char *) chunk2mem (p) + 4 * SIZE_SZ <= paligned_mem);
-                assert ((char *) p + size > paligned_mem);
-
-                /* This is the size we could potentially free.  */
-                size -= paligned_mem - (char *) p;
-
-                if (size > psm1)
-                  {
-#if MALLOC_DEBUG
-                    /* When debugging we simulate destroying the memory
-                       content.  */
-                    memset (paligned_mem, 0x89, size & ~psm1);
-#endif
-                    __madvise (paligned_mem, size & ~psm1, MADV_DONTNEED);
-
-                    result = 1;
-                  }
-              }
-          }
+          if (purge_chunk (chunkinfo2chunk (_md_p), chunksize (_md_p)) != 0)
+            result = 1;
       }
 
+  /* SRI: the main arena has jurisdiction over the mmap cache */
+  if (av == &main_arena && mmap_cache.count > 0)
+    {
+      mmap_cache_shrink (mmap_cache.clock, 0);
+      result = 1;
+    }
+
 #ifndef MORECORE_CANNOT_TRIM
   return result | (av == &main_arena ? systrim (pad, av) : 0);
 
@@ -6147,6 +7028,229 @@ __malloc_trim (size_t s)
 }
 
 
+/*
+  ------------------------- SRI: background purging -------------------------
+
+  With MALLOC_PURGE_DECAY=<ms> (or mallopt (M_PURGE_DECAY, ms)) the first
+  malloc starts a thread that gives free memory back to the kernel, so
+  that free itself no longer trims. Every decay/PURGE_STEPS milliseconds
+  it visits each arena and
+
+  - madvises away the free pages of the arena's bins, largest bins first,
+    down to a budget: the bytes freed into the arena over the last
+    PURGE_STEPS steps, each step's weight falling linearly to nothing over
+    the decay time (like jemalloc's dirty page decay, so memory that is
+    reused soon is not given back, and memory that is not is given back
+    within the decay time);
+  - trims the top of the heap (systrim or heap_trim, which also unmaps
+    heaps that have become empty) down to the budget;
+  - unmaps the arena's metadata pools that have become empty;
+  - for the main arena, unmaps the chunks in the mmap cache that have
+    not been reused since the previous visit.
+
+  The bins are swept, a visit resuming where the last one stopped, so
+  each free chunk is madvised once a sweep. The dirty bytes are those
+  freed and not purged since; once a sweep is over, no more than were
+  freed while it went on. An arena that has seen no frees since it was
+  last purged down to nothing is skipped. Each visit madvises at most
+  PURGE_BATCH chunks, and besides walks no more than the part of a bin
+  the last visit had already done, so the arena lock is never held for
+  long.
+
+  The purger needs pthread_create, so it is only started in programs
+  linked with libpthread. A forked child starts its own, again on its
+  first malloc.
+*/
+
+#include <pthread.h>
+#include <signal.h>
+
+#pragma weak pthread_create
+
+/* SRI: the most chunks purge_arena madvises per visit */
+#define PURGE_BATCH  64
+
+static size_t
+purge_budget (mstate av)
+{
+  size_t budget = 0;
+  int step;
+
+  for (step = 0; step < PURGE_STEPS; step++)
+    budget += av->purge_history[step] / PURGE_STEPS * (PURGE_STEPS - step);
+  return budget;
+}
+
+/* SRI: the sweep's order: the large bins from the largest, then unsorted */
+static int
+purge_next_bin (int i, int psindex)
+{
+  if (i == 1)
+    return NBINS - 1;
+  return i - 1 >= psindex ? i - 1 : 1;
+}
+
+static void
+purge_arena (mstate av)
+{
+  const size_t ps = GLRO (dl_pagesize);
+  int psindex = bin_index (ps);
+  size_t freed, budget, length, top, position;
+  int i, step, batch;
+  chunkinfoptr _md_p;
+  mbinptr bin;
+
+  if (arena_is_corrupt (av))
+    return;
+
+  LOCK_ARENA (av, PURGE_SITE);
+
+  freed = av->freed_bytes - av->purge_freed;
+  av->purge_freed = av->freed_bytes;
+  for (step = PURGE_STEPS - 1; step > 0; step--)
+    av->purge_history[step] = av->purge_history[step - 1];
+  av->purge_history[0] = freed;
+  av->purge_dirty += freed;
+  av->purge_sweep_freed += freed;
+
+  if (freed == 0 && av->purge_idle && (av != &main_arena || mmap_cache.count == 0))
+    {
+      UNLOCK_ARENA (av, PURGE_SITE);
+      return;
+    }
+
+  if (have_fastchunks (av))
+    malloc_consolidate_bounded (av, mp_.consolidate_limit);
+
+  budget = purge_budget (av);
+
+  if (av->purge_bin == 0)
+    av->purge_bin = NBINS - 1;
+
+  batch = 0;
+  while (av->purge_dirty > budget && batch < PURGE_BATCH)
+    {
+      bin = bin_at (av, av->purge_bin);
+      position = 0;
+      for (_md_p = last (bin);
+           _md_p != bin && av->purge_dirty > budget && batch < PURGE_BATCH;
+           _md_p = _md_p->bk, position++)
+        {
+          if (position < av->purge_position)
+            continue;
+          length = purge_chunk (chunkinfo2chunk (_md_p), chunksize (_md_p));
+          if (length != 0)
+            {
+              av->purged += length;
+              av->purge_dirty -= MIN (length, av->purge_dirty);
+              batch++;
+            }
+          av->purge_position = position + 1;
+        }
+      if (_md_p != bin)
+        break;
+
+      /* the end of the bin, and perhaps of the sweep, which is as far
+         as a visit goes */
+      i = av->purge_bin;
+      av->purge_bin = purge_next_bin (i, psindex);
+      av->purge_position = 0;
+      if (i == 1)
+        {
+          av->purge_dirty = MIN (av->purge_dirty, av->purge_sweep_freed);
+          av->purge_sweep_freed = 0;
+          break;
+        }
+    }
+
+  top = chunksize (av->_md_top);
+  if (top > budget + mp_.top_pad)
+    {
+      if (av == &main_arena)
+        {
+#ifndef MORECORE_CANNOT_TRIM
+          if (systrim (budget + mp_.top_pad, av))
+            av->purged += top - chunksize (av->_md_top);
+#endif
+        }
+      else
+        {
+          check_top (av);
+          if (heap_trim (heap_for_ptr (chunkinfo2chunk (av->_md_top)), budget + mp_.top_pad))
+            av->purged += top > chunksize (av->_md_top) ? top - chunksize (av->_md_top) : 0;
+          check_top (av);
+        }
+    }
+
+  /* the mmap cache entries that were not reused since the last visit */
+  if (av == &main_arena)
+    {
+      size_t cached = mmap_cache.bytes;
+
+      mmap_cache_shrink (mmap_cache.purge_clock, mp_.mmap_cache_max);
+      mmap_cache.purge_clock = mmap_cache.clock;
+      av->purged += cached - mmap_cache.bytes;
+    }
+
+  /* purged down to nothing: skip this arena until it sees a free again */
+  av->purge_idle = (budget == 0 && av->purge_dirty == 0);
+
+  UNLOCK_ARENA (av, PURGE_SITE);
+
+  /* the pools have their own lock */
+  av->purged_metadata += memcxt_trim (&av->memcxt);
+}
+
+static void *
+purger_main (void *arg)
+{
+  struct timespec tick;
+  sigset_t all;
+  mstate av;
+  int decay;
+
+  /* the application's signals are not for us */
+  sigfillset (&all);
+  sigprocmask (SIG_BLOCK, &all, NULL);
+
+  for (;;)
+    {
+      decay = mp_.purge_decay;
+      if (decay == 0)
+        decay = 1000 * PURGE_STEPS;      /* switched off: look again in a second */
+      else
+        for (av = &main_arena;; )
+          {
+            purge_arena (av);
+            av = av->next;
+            if (av == &main_arena)
+              break;
+          }
+      tick.tv_sec = decay / PURGE_STEPS / 1000;
+      tick.tv_nsec = (long) (decay / PURGE_STEPS % 1000) * 1000000;
+      if (tick.tv_sec == 0 && tick.tv_nsec == 0)
+        tick.tv_nsec = 1000000;
+      __nanosleep (&tick, NULL);
+    }
+  return NULL;
+}
+
+static void
+purger_start (void)
+{
+  pthread_t thread;
+
+  /* whoever wins the race starts it */
+  if (catomic_compare_and_exchange_bool_acq (&purger_started, PURGER_RUNNING,
+                                             PURGER_NONE))
+    return;
+
+  if (pthread_create == NULL
+      || pthread_create (&thread, NULL, purger_main, NULL) != 0)
+    purger_started = PURGER_FAILED;
+}
+
+
 /*
   ------------------------- malloc_usable_size -------------------------
 */
@@ -6161,6 +7265,11 @@ musable (void *mem)
 
   retval = 0;
 
+#if SRI_SLAB
+  if (mem != 0 && (retval = slab_usable_size (mem)) != 0)
+    return retval;
+#endif
+
   if (mem != 0)
     {
       p = mem2chunk (mem);
@@ -6191,7 +7300,7 @@ musable (void *mem)
 	retval = chunksize(_md_p) - 2*SIZE_SZ; 
       }
       else if (inuse(ar_ptr, _md_p, p)){
-	retval = chunksize(_md_p) - SIZE_SZ; 
+	retval = chunksize(_md_p) - HEADER_SIZE; 
       }
       
       UNLOCK_ARENA(ar_ptr, MUSABLE_SITE);
@@ -6306,12 +7415,48 @@ __libc_mallinfo (void)
   ------------------------------ malloc_stats ------------------------------
 */
 
+/* SRI: indexed by lock_site_t */
+static const char *lock_site_names[LOCK_SITE_COUNT] = {
+  "malloc", "realloc", "calloc", "free", "memalign", "sysmalloc", "trim",
+  "musable", "mallinfo", "mallopt", "malloc_stats", "malloc_info", "arena",
+  "purge"
+};
+
+/* SRI: the lock statistics of av, over all sites */
+static void
+lock_sites_total (mstate av, lock_site_stats_t *total)
+{
+  int site;
+
+  memset (total, 0, sizeof (*total));
+  for (site = 0; site < LOCK_SITE_COUNT; site++)
+    {
+      total->acquired += av->lock_sites[site].acquired;
+      total->contended += av->lock_sites[site].contended;
+      total->futex_waits += av->lock_sites[site].futex_waits;
+      total->wait += av->lock_sites[site].wait;
+    }
+}
+
+/* SRI: the bytes mapped for av's metadata (its pools and its table's directory), and those in use */
+static void
+metadata_usage (mstate av, size_t *mapped, size_t *used)
+{
+  memcxt_usage (&av->memcxt, mapped, used);
+  *mapped += av->htbl.directory_length * sizeof (segment_t *);
+  *used += av->htbl.directory_current * sizeof (segment_t *);
+}
+
 void
 __malloc_stats (void)
 {
-  int i;
+  int i, site;
   mstate ar_ptr;
   unsigned int in_use_b = mp_.mmapped_mem, system_b = in_use_b;
+  lock_site_stats_t total, sites[LOCK_SITE_COUNT];
+  size_t md_mapped, md_used;
+
+  memset (sites, 0, sizeof (sites));
 
   if (__malloc_initialized < 0)
     ptmalloc_init ();
@@ -6328,6 +7473,24 @@ __malloc_stats (void)
       fprintf (stderr, "Arena %zu:\n", ar_ptr->arena_index);
       fprintf (stderr, "system bytes     = %10u\n", (unsigned int) mi.arena);
       fprintf (stderr, "in use bytes     = %10u\n", (unsigned int) mi.uordblks);
+      metadata_usage (ar_ptr, &md_mapped, &md_used);
+      fprintf (stderr, "metadata bytes   = %10zu of %zu\n", md_used, md_mapped);
+      lock_sites_total (ar_ptr, &total);
+      fprintf (stderr, "locks contended  = %10zu of %zu (%zu ticks waiting)\n",
+               total.contended, total.acquired, (size_t) total.wait);
+      for (site = 0; site < LOCK_SITE_COUNT; site++)
+        {
+          sites[site].acquired += ar_ptr->lock_sites[site].acquired;
+          sites[site].contended += ar_ptr->lock_sites[site].contended;
+          sites[site].futex_waits += ar_ptr->lock_sites[site].futex_waits;
+          sites[site].wait += ar_ptr->lock_sites[site].wait;
+        }
+      fprintf (stderr, "contention       = %10u of %u\n", ar_ptr->contention, CONTENTION_SCALE);
+      fprintf (stderr, "threads migrated = %10zu in %zu out\n",
+               ar_ptr->migrations_in, ar_ptr->migrations_out);
+      if (mp_.purge_decay != 0)
+        fprintf (stderr, "purged bytes     = %10zu (and %zu of metadata)\n",
+                 ar_ptr->purged, ar_ptr->purged_metadata);
       dump_metadata(stderr, &(ar_ptr->htbl), false);
 #if MALLOC_DEBUG > 1
       if (i > 0)
@@ -6346,6 +7509,18 @@ __malloc_stats (void)
   fprintf (stderr, "max mmap regions = %10u\n", (unsigned int) mp_.max_n_mmaps);
   fprintf (stderr, "max mmap bytes   = %10lu\n",
            (unsigned long) mp_.max_mmapped_mem);
+  fprintf (stderr, "mmap cache bytes = %10zu in %zu (%zu hits, %zu misses, %zu unmapped)\n",
+           mmap_cache.bytes, mmap_cache.count, mmap_cache.hits,
+           mmap_cache.misses, mmap_cache.evicted);
+  fprintf (stderr, "%-12s %12s %12s %12s %12s\n",
+           "lock site", "acquired", "contended", "futex waits", "ticks/wait");
+  for (site = 0; site < LOCK_SITE_COUNT; site++)
+    if (sites[site].acquired != 0)
+      fprintf (stderr, "%-12s %12zu %12zu %12zu %12zu\n",
+               lock_site_names[site], sites[site].acquired,
+               sites[site].contended, sites[site].futex_waits,
+               sites[site].contended == 0 ? 0 :
+               (size_t) (sites[site].wait / sites[site].contended));
   lookup_dump(stderr, false);
   ((_IO_FILE *) stderr)->_flags2 |= old_flags2;
   _IO_funlockfile (stderr);
@@ -6441,6 +7616,57 @@ __libc_mallopt (int param_number, int value)
           mp_.arena_max = value;
         }
       break;
+
+    case M_CONSOLIDATE_LIMIT:
+      if (value >= 0)
+        mp_.consolidate_limit = value;
+      else
+        res = 0;
+      break;
+
+    case M_SLAB_MAX:
+#if SRI_SLAB
+      if (value >= 0 && value <= SLAB_MAX_SIZE)
+        mp_.slab_max = value;
+      else
+#endif
+        res = 0;
+      break;
+
+    case M_PERCPU_ARENAS:
+      mp_.percpu_arenas = (value != 0);
+      break;
+
+    case M_MMAP_CACHE_MAX:
+      if (value >= 0)
+        {
+          mp_.mmap_cache_max = value;
+          mmap_cache_shrink (0, mp_.mmap_cache_max);
+        }
+      else
+        res = 0;
+      break;
+
+    case M_THP_HEAPS:
+      /* heaps grown from now on */
+      mp_.thp_heaps = (value != 0);
+      break;
+
+    case M_PURGE_DECAY:
+      /* the purger itself is started by the next malloc */
+      if (value >= 0)
+        mp_.purge_decay = value;
+      else
+        res = 0;
+      break;
+
+    case M_METADATA_HUGEPAGES:
+      /* pools created from now on are 2MB aligned and use huge pages;
+         the main arena's existing pools just get the advice.  */
+      sri_hugepages = (value != 0);
+      if (sri_hugepages)
+        memcxt_hugepages (&av->memcxt);
+      break;
     }
   UNLOCK_ARENA(av, MALLOPT_SITE);
   return res;
@@ -6666,6 +7892,8 @@ __malloc_info (int options, FILE *fp)
   size_t total_max_system = 0;
   size_t total_aspace = 0;
   size_t total_aspace_mprotect = 0;
+  size_t total_md_mapped = 0;
+  size_t total_md_used = 0;
 
 
 
@@ -6684,6 +7912,9 @@ __malloc_info (int options, FILE *fp)
       size_t nfastblocks = 0;
       size_t avail = 0;
       size_t fastavail = 0;
+      lock_site_stats_t locks;
+      size_t md_mapped, md_used;
+      int site;
       struct
       {
         size_t from;
@@ -6752,6 +7983,8 @@ __malloc_info (int options, FILE *fp)
           avail += sizes[NFASTBINS - 1 + i].total;
         }
 
+      metadata_usage (ar_ptr, &md_mapped, &md_used);
+
       UNLOCK_ARENA(ar_ptr, MALLOC_INFO_SITE);
 
       total_nfastblocks += nfastblocks;
@@ -6774,14 +8007,37 @@ __malloc_info (int options, FILE *fp)
 
       total_system += ar_ptr->system_mem;
       total_max_system += ar_ptr->max_system_mem;
+      total_md_mapped += md_mapped;
+      total_md_used += md_used;
 
       fprintf (fp,
                "</sizes>\n<total type=\"fast\" count=\"%zu\" size=\"%zu\"/>\n"
                "<total type=\"rest\" count=\"%zu\" size=\"%zu\"/>\n"
                "<system type=\"current\" size=\"%zu\"/>\n"
-               "<system type=\"max\" size=\"%zu\"/>\n",
+               "<system type=\"max\" size=\"%zu\"/>\n"
+               "<metadata type=\"mapped\" size=\"%zu\"/>\n"
+               "<metadata type=\"used\" size=\"%zu\"/>\n",
                nfastblocks, fastavail, nblocks, avail,
-               ar_ptr->system_mem, ar_ptr->max_system_mem);
+               ar_ptr->system_mem, ar_ptr->max_system_mem,
+               md_mapped, md_used);
+
+      lock_sites_total (ar_ptr, &locks);
+      fprintf (fp,
+               "<locks acquired=\"%zu\" contended=\"%zu\" futex_waits=\"%zu\" wait=\"%zu\" contention=\"%u\">\n",
+               locks.acquired, locks.contended, locks.futex_waits, (size_t) locks.wait,
+               ar_ptr->contention);
+      for (site = 0; site < LOCK_SITE_COUNT; site++)
+        if (ar_ptr->lock_sites[site].acquired != 0)
+          fprintf (fp,
+                   "<site name=\"%s\" acquired=\"%zu\" contended=\"%zu\" futex_waits=\"%zu\" wait=\"%zu\"/>\n",
+                   lock_site_names[site], ar_ptr->lock_sites[site].acquired,
+                   ar_ptr->lock_sites[site].contended,
+                   ar_ptr->lock_sites[site].futex_waits,
+                   (size_t) ar_ptr->lock_sites[site].wait);
+      fprintf (fp,
+               "</locks>\n"
+               "<migrations in=\"%zu\" out=\"%zu\"/>\n",
+               ar_ptr->migrations_in, ar_ptr->migrations_out);
 
       if (ar_ptr != &main_arena)
         {
@@ -6817,11 +8073,14 @@ __malloc_info (int options, FILE *fp)
            "<system type=\"max\" size=\"%zu\"/>\n"
            "<aspace type=\"total\" size=\"%zu\"/>\n"
            "<aspace type=\"mprotect\" size=\"%zu\"/>\n"
+           "<metadata type=\"mapped\" size=\"%zu\"/>\n"
+           "<metadata type=\"used\" size=\"%zu\"/>\n"
            "</malloc>\n",
            total_nfastblocks, total_fastavail, total_nblocks, total_avail,
            mp_.n_mmaps, mp_.mmapped_mem,
            total_system, total_max_system,
-           total_aspace, total_aspace_mprotect);
+           total_aspace, total_aspace_mprotect,
+           total_md_mapped, total_md_used);
 
   return 0;
 }
@@ -116,6 +116,13 @@ extern struct mallinfo mallinfo (void) __THROW;
 #define M_PERTURB           -6
 #define M_ARENA_TEST        -7
 #define M_ARENA_MAX         -8
+#define M_METADATA_HUGEPAGES -9
+#define M_CONSOLIDATE_LIMIT -10
+#define M_SLAB_MAX          -11
+#define M_PERCPU_ARENAS     -12
+#define M_PURGE_DECAY       -13
+#define M_THP_HEAPS         -14
+#define M_MMAP_CACHE_MAX    -15
 
 /* General SVID/XPG interface to tunable parameters. */
 extern int mallopt (int __param, int __val) __THROW;
@@ -36,6 +36,16 @@
 /* one thing for every bit in the bitmask */
 #define SP_LENGTH SP_SCALE * BITS_IN_MASK  
 
+/* the per-thread magazine of buckets (see memcxt_refill in memcxt.h) */
+#define MAGAZINE_SIZE  64
+/* memcxt_refill tops a magazine that is below MAGAZINE_LOW up to MAGAZINE_FILL */
+#define MAGAZINE_FILL  (MAGAZINE_SIZE / 2)
+#define MAGAZINE_LOW   (MAGAZINE_SIZE / 8)
+
+/* the next pool is mapped ahead of time once fewer than this many are free */
+#define BP_LOW  (BP_LENGTH / 4)
+#define SP_LOW  (SP_LENGTH / 4)
+
 struct bucket_pool_s {
   bucket_t pool[BP_LENGTH];       /* the pool of buckets; one for each bit in the bitmask array */
   uint64_t bitmasks[BP_SCALE];    /* the array of bitmasks; zero means: free; one means: in use */
@@ -65,12 +75,42 @@ static segment_t* alloc_segment(memcxt_t* memcxt);
 
 static bool free_segment(memcxt_t* memcxt, segment_t* segp);
 
+typedef struct magazine_s {
+  memcxt_t* memcxt;               /* the memcxt the rounds belong to */
+  size_t count;
+  bucket_t* rounds[MAGAZINE_SIZE];
+  bool listed;                    /* on the magazines list          */
+  struct magazine_s* next;
+} magazine_t;
+
+static __thread magazine_t magazine;
+
+/* the threads' magazines, so that a fork child can take back those of the threads it lost */
+static magazine_t* magazines = NULL;
+static int magazines_lock = 0;
+
+static bool add_spare_buckets(memcxt_t* memcxt);
+
+static bool add_spare_segments(memcxt_t* memcxt);
+
+static void return_rounds(void);
+
+static void spin_lock(int* lock);
+
+static void spin_unlock(int* lock);
+
 bool init_memcxt(memcxt_t* memcxt){
 
   assert(memcxt != NULL);
   if(memcxt == NULL){
     return false;
   }
+  memcxt->lock = 0;
+  memcxt->mapping = 0;
+  memcxt->spare_segments = NULL;
+  memcxt->spare_buckets = NULL;
+  memcxt->free_segments = SP_LENGTH;
+  memcxt->free_buckets = BP_LENGTH;
   memcxt->segments = new_segments();
   memcxt->buckets = new_buckets();
 
@@ -84,6 +124,20 @@ void delete_memcxt(memcxt_t* memcxt){
   bucket_pool_t* buckets;
   bucket_pool_t* currbuck;
 
+  if(magazine.memcxt == memcxt){
+    magazine.memcxt = NULL;
+    magazine.count = 0;
+  }
+
+  if(memcxt->spare_segments != NULL){
+    sri_munmap(memcxt->spare_segments, sizeof(segment_pool_t));
+    memcxt->spare_segments = NULL;
+  }
+  if(memcxt->spare_buckets != NULL){
+    sri_munmap(memcxt->spare_buckets, sizeof(bucket_pool_t));
+    memcxt->spare_buckets = NULL;
+  }
+
   segments = memcxt->segments;
   memcxt->segments = NULL;
   if(segments != NULL){
@@ -121,12 +175,24 @@ void* memcxt_allocate(memcxt_t* memcxt, memtype_t type, void* oldptr, size_t sz)
     }
     case SEGMENT: {
       assert(oldptr == NULL);
-      memory = alloc_segment(memcxt);
+      do {
+	memcxt_lock(memcxt);
+	memory = alloc_segment(memcxt);
+	memcxt_unlock(memcxt);
+      } while(memory == NULL && add_spare_segments(memcxt));
       break;
     }
     case BUCKET: {
       assert(oldptr == NULL);
-      memory = alloc_bucket(memcxt);
+      if(magazine.memcxt == memcxt && magazine.count > 0){
+	memory = magazine.rounds[--magazine.count];
+	break;
+      }
+      do {
+	memcxt_lock(memcxt);
+	memory = alloc_bucket(memcxt);
+	memcxt_unlock(memcxt);
+      } while(memory == NULL && add_spare_buckets(memcxt));
       break;
     }
     default: assert(false);
@@ -148,11 +214,26 @@ void memcxt_release(memcxt_t* memcxt, memtype_t type,  void* ptr, size_t sz){
       break;
     }
     case SEGMENT: {
+      memcxt_lock(memcxt);
       free_segment(memcxt, ptr);
+      memcxt_unlock(memcxt);
       break;
     }
     case BUCKET: {
+      if(magazine.memcxt == memcxt){
+	if(magazine.count == MAGAZINE_SIZE){
+	  memcxt_lock(memcxt);
+	  while(magazine.count > MAGAZINE_FILL){
+	    free_bucket(memcxt, magazine.rounds[--magazine.count]);
+	  }
+	  memcxt_unlock(memcxt);
+	}
+	magazine.rounds[magazine.count++] = ptr;
+	break;
+      }
+      memcxt_lock(memcxt);
       free_bucket(memcxt, ptr);
+      memcxt_unlock(memcxt);
       break;
     }
     default: assert(false);
@@ -175,6 +256,294 @@ void dump_memcxt(FILE* fp, memcxt_t* memcxt){
 }
 
 
+void memcxt_usage(memcxt_t* memcxt, size_t* mapped, size_t* used){
+  segment_pool_t* segments;
+  bucket_pool_t* buckets;
+  size_t nsegments, nbuckets;
+
+  nsegments = nbuckets = 0;
+  memcxt_lock(memcxt);
+  for(segments = memcxt->segments; segments != NULL; segments = segments->next_segment_pool){
+    nsegments++;
+  }
+  for(buckets = memcxt->buckets; buckets != NULL; buckets = buckets->next_bucket_pool){
+    nbuckets++;
+  }
+  *used = (nsegments * SP_LENGTH - memcxt->free_segments) * sizeof(segment_t) +
+    (nbuckets * BP_LENGTH - memcxt->free_buckets) * sizeof(bucket_t);
+  if(memcxt->spare_segments != NULL){
+    nsegments++;
+  }
+  if(memcxt->spare_buckets != NULL){
+    nbuckets++;
+  }
+  memcxt_unlock(memcxt);
+  *mapped = nsegments * sizeof(segment_pool_t) + nbuckets * sizeof(bucket_pool_t);
+}
+
+
+void memcxt_hugepages(memcxt_t* memcxt){
+  segment_pool_t* segments;
+  bucket_pool_t* buckets;
+
+  memcxt_lock(memcxt);
+  for(segments = memcxt->segments; segments != NULL; segments = segments->next_segment_pool){
+    sri_madvise_hugepages(segments, sizeof(segment_pool_t));
+  }
+  for(buckets = memcxt->buckets; buckets != NULL; buckets = buckets->next_bucket_pool){
+    sri_madvise_hugepages(buckets, sizeof(bucket_pool_t));
+  }
+  if(memcxt->spare_segments != NULL){
+    sri_madvise_hugepages(memcxt->spare_segments, sizeof(segment_pool_t));
+  }
+  if(memcxt->spare_buckets != NULL){
+    sri_madvise_hugepages(memcxt->spare_buckets, sizeof(bucket_pool_t));
+  }
+  memcxt_unlock(memcxt);
+}
+
+
+size_t memcxt_trim(memcxt_t* memcxt){
+  segment_pool_t* segments;
+  segment_pool_t* sprev;
+  segment_pool_t* sfree;
+  bucket_pool_t* buckets;
+  bucket_pool_t* bprev;
+  bucket_pool_t* bfree;
+  size_t trimmed;
+
+  sfree = NULL;
+  bfree = NULL;
+
+  memcxt_lock(memcxt);
+  for(sprev = memcxt->segments; sprev != NULL && (segments = sprev->next_segment_pool) != NULL; ){
+    if(segments->free_count == SP_LENGTH && memcxt->free_segments >= SP_LENGTH + SP_LOW){
+      sprev->next_segment_pool = segments->next_segment_pool;
+      memcxt->free_segments -= SP_LENGTH;
+      segments->next_segment_pool = sfree;
+      sfree = segments;
+    } else {
+      sprev = segments;
+    }
+  }
+  for(bprev = memcxt->buckets; bprev != NULL && (buckets = bprev->next_bucket_pool) != NULL; ){
+    if(buckets->free_count == BP_LENGTH && memcxt->free_buckets >= BP_LENGTH + BP_LOW){
+      bprev->next_bucket_pool = buckets->next_bucket_pool;
+      memcxt->free_buckets -= BP_LENGTH;
+      buckets->next_bucket_pool = bfree;
+      bfree = buckets;
+    } else {
+      bprev = buckets;
+    }
+  }
+  memcxt_unlock(memcxt);
+
+  /* the unmapping is done without the lock */
+  trimmed = 0;
+  while(sfree != NULL){
+    segments = sfree;
+    sfree = sfree->next_segment_pool;
+    sri_munmap(segments, sizeof(segment_pool_t));
+    trimmed += sizeof(segment_pool_t);
+  }
+  while(bfree != NULL){
+    buckets = bfree;
+    bfree = bfree->next_bucket_pool;
+    sri_munmap(buckets, sizeof(bucket_pool_t));
+    trimmed += sizeof(bucket_pool_t);
+  }
+  return trimmed;
+}
+
+/*
+ * The pools are only ever held for a bitmask search (pools are mapped
+ * without the lock, see add_spare_buckets), so a spin lock will do.
+ * The arena lock, when it is held, is always taken first.
+ */
+static void spin_lock(int* lock){
+  while(__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)){
+    while(__atomic_load_n(lock, __ATOMIC_RELAXED)){
+      __builtin_ia32_pause();
+    }
+  }
+}
+
+static void spin_unlock(int* lock){
+  __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+void memcxt_lock(memcxt_t* memcxt){
+  spin_lock(&memcxt->lock);
+}
+
+void memcxt_unlock(memcxt_t* memcxt){
+  spin_unlock(&memcxt->lock);
+}
+
+/* the other threads are gone, and with them whatever they were doing with the memcxt */
+void memcxt_reset(memcxt_t* memcxt){
+  memcxt->lock = 0;
+  memcxt->mapping = 0;
+}
+
+void memcxt_reset_magazines(void){
+  magazine_t* m;
+  memcxt_t* memcxt;
+
+  magazines_lock = 0;
+  for(m = magazines; m != NULL; m = m->next){
+    memcxt = m->memcxt;
+    if(m != &magazine && memcxt != NULL){
+      while(m->count > 0){
+	free_bucket(memcxt, m->rounds[--m->count]);
+      }
+    }
+  }
+  magazines = NULL;
+  if(magazine.listed){
+    magazine.next = NULL;
+    magazines = &magazine;
+  }
+}
+
+void memcxt_refill(memcxt_t* memcxt){
+  bucket_pool_t* bpool;
+  segment_pool_t* spool;
+  bucket_t* buckp;
+
+  /* not initialized yet */
+  if(memcxt->buckets == NULL){
+    return;
+  }
+
+  if(magazine.memcxt != memcxt){
+    return_rounds();
+    magazine.memcxt = memcxt;
+  }
+  if(!magazine.listed){
+    spin_lock(&magazines_lock);
+    magazine.next = magazines;
+    magazines = &magazine;
+    magazine.listed = true;
+    spin_unlock(&magazines_lock);
+  }
+
+  /* 
+   * The counts are read without the lock, they only decide whether to
+   * map a pool; mapping is what we want to keep out of everybody's way,
+   * so only one thread at a time does it.
+   */
+  bpool = NULL;
+  spool = NULL;
+  if((__atomic_load_n(&memcxt->free_buckets, __ATOMIC_RELAXED) < BP_LOW && 
+      __atomic_load_n(&memcxt->spare_buckets, __ATOMIC_RELAXED) == NULL) ||
+     (__atomic_load_n(&memcxt->free_segments, __ATOMIC_RELAXED) < SP_LOW &&
+      __atomic_load_n(&memcxt->spare_segments, __ATOMIC_RELAXED) == NULL)){
+
+    if(__atomic_exchange_n(&memcxt->mapping, 1, __ATOMIC_ACQUIRE) == 0){
+      if(memcxt->free_buckets < BP_LOW && memcxt->spare_buckets == NULL){
+	bpool = new_buckets();
+      }
+      if(memcxt->free_segments < SP_LOW && memcxt->spare_segments == NULL){
+	spool = new_segments();
+      }
+      memcxt_lock(memcxt);
+      if(bpool != NULL){
+	memcxt->spare_buckets = bpool;
+      }
+      if(spool != NULL){
+	memcxt->spare_segments = spool;
+      }
+      memcxt_unlock(memcxt);
+      __atomic_store_n(&memcxt->mapping, 0, __ATOMIC_RELEASE);
+    }
+  }
+
+  if(magazine.count < MAGAZINE_LOW){
+    memcxt_lock(memcxt);
+    while(magazine.count < MAGAZINE_FILL){
+      buckp = alloc_bucket(memcxt);
+      if(buckp == NULL){
+	break;
+      }
+      magazine.rounds[magazine.count++] = buckp;
+    }
+    memcxt_unlock(memcxt);
+  }
+}
+
+static void return_rounds(void){
+  memcxt_t* memcxt;
+
+  memcxt = magazine.memcxt;
+  if(memcxt != NULL && magazine.count > 0){
+    memcxt_lock(memcxt);
+    while(magazine.count > 0){
+      free_bucket(memcxt, magazine.rounds[--magazine.count]);
+    }
+    memcxt_unlock(memcxt);
+  }
+  magazine.memcxt = NULL;
+}
+
+void memcxt_flush(void){
+  magazine_t** mp;
+
+  return_rounds();
+  if(magazine.listed){
+    spin_lock(&magazines_lock);
+    for(mp = &magazines; *mp != NULL; mp = &(*mp)->next){
+      if(*mp == &magazine){
+	*mp = magazine.next;
+	break;
+      }
+    }
+    magazine.listed = false;
+    spin_unlock(&magazines_lock);
+  }
+}
+
+/* maps a spare pool, without the lock, for an alloc_bucket that found the pools full; false if mmap failed */
+static bool add_spare_buckets(memcxt_t* memcxt){
+  bucket_pool_t* bpool;
+
+  bpool = new_buckets();
+  if(bpool == NULL){
+    return false;
+  }
+  memcxt_lock(memcxt);
+  if(memcxt->spare_buckets == NULL){
+    memcxt->spare_buckets = bpool;
+    bpool = NULL;
+  }
+  memcxt_unlock(memcxt);
+  /* another thread beat us to it */
+  if(bpool != NULL){
+    sri_munmap(bpool, sizeof(bucket_pool_t));
+  }
+  return true;
+}
+
+static bool add_spare_segments(memcxt_t* memcxt){
+  segment_pool_t* spool;
+
+  spool = new_segments();
+  if(spool == NULL){
+    return false;
+  }
+  memcxt_lock(memcxt);
+  if(memcxt->spare_segments == NULL){
+    memcxt->spare_segments = spool;
+    spool = NULL;
+  }
+  memcxt_unlock(memcxt);
+  if(spool != NULL){
+    sri_munmap(spool, sizeof(segment_pool_t));
+  }
+  return true;
+}
+
+
 #ifndef NDEBUG
 static bool sane_bucket_pool(bucket_pool_t* bpool);
 #endif
@@ -346,6 +715,7 @@ static bucket_t* alloc_bucket(memcxt_t* memcxt){
 	  buckp = &bpool_current->pool[(scale * BITS_IN_MASK) + index];
 	  bpool_current->bitmasks[scale] = set_bit(bpool_current->bitmasks[scale], index);
 	  bpool_current->free_count --;
+	  memcxt->free_buckets --;
 	  assert(sane_bucket_pool(bpool_current));
 
 	  assert(buckp != NULL);
@@ -359,9 +729,12 @@ static bucket_t* alloc_bucket(memcxt_t* memcxt){
   assert(buckp == NULL);
   assert(bpool_current  == NULL);
   
-  /* need to allocate another bpool */
-  bpool_current = new_buckets();
+  /* need another bpool; memcxt_refill has usually mapped it already, otherwise the caller maps one without the lock */
+  bpool_current = memcxt->spare_buckets;
   if (bpool_current != NULL) {
+    memcxt->spare_buckets = NULL;
+    memcxt->free_buckets += BP_LENGTH - 1;
+
     /* put the new bucket up front */
     bpool_current->next_bucket_pool = memcxt->buckets;
     memcxt->buckets = bpool_current;
@@ -405,6 +778,7 @@ static bool free_bucket(memcxt_t* memcxt, bucket_t* buckp){
   bpool->bitmasks[pmask_index] = clear_bit(bpool->bitmasks[pmask_index], pmask_bit); 
 
   bpool->free_count ++;
+  memcxt->free_buckets ++;
   
   /* sanity check */
   assert((bpool->free_count > 0) && (bpool->free_count <= BP_LENGTH));
@@ -440,6 +814,7 @@ static segment_t* alloc_segment(memcxt_t* memcxt){
 	  segp = &spool_current->pool[(scale * BITS_IN_MASK) + index];
 	  spool_current->bitmasks[scale] = set_bit(spool_current->bitmasks[scale], index);
 	  spool_current->free_count --;
+	  memcxt->free_segments --;
 
 	  assert(segp != NULL);
 	  
@@ -454,9 +829,11 @@ static segment_t* alloc_segment(memcxt_t* memcxt){
   assert(spool_current  == NULL);
 
     
-  spool_current = new_segments();
-  
+  /* need another spool; memcxt_refill has usually mapped it already, otherwise the caller maps one without the lock */
+  spool_current = memcxt->spare_segments;
   if(spool_current != NULL){
+    memcxt->spare_segments = NULL;
+    memcxt->free_segments += SP_LENGTH - 1;
     
     /* put the new segment up front */
     spool_current->next_segment_pool = memcxt->segments;
@@ -497,6 +874,7 @@ static bool free_segment(memcxt_t* memcxt, segment_t* segp){
 
   spool->bitmasks[pmask_index] = clear_bit(spool->bitmasks[pmask_index], pmask_bit); 
   spool->free_count ++ ;
+  memcxt->free_segments ++;
 
   assert((spool->free_count > 0) && (spool->free_count <= SP_LENGTH));
   
@@ -36,6 +36,13 @@
 typedef struct memcxt_s {
   segment_pool_t* segments;
   bucket_pool_t* buckets;
+  /* SRI: the pools may be used by a thread that does not hold the arena lock (see memcxt_refill) */
+  int lock;
+  int mapping;                      /* a thread is mapping the spare pools              */
+  size_t free_buckets;              /* free buckets over all pools                      */
+  size_t free_segments;             /* free segments over all pools                     */
+  bucket_pool_t* spare_buckets;     /* mapped ahead of time, used when the pools fill   */
+  segment_pool_t* spare_segments;   /* mapped ahead of time, used when the pools fill   */
 } memcxt_t;
 
 
@@ -62,4 +69,47 @@ extern void delete_memcxt(memcxt_t* memcxt);
 
 extern void dump_memcxt(FILE* fp, memcxt_t* memcxt);
 
+/* the bytes mapped for the pools (spares included), and those of the buckets and segments in use */
+extern void memcxt_usage(memcxt_t* memcxt, size_t* mapped, size_t* used);
+
+/* advises huge pages for the pools already in the memcxt (new ones follow sri_hugepages) */
+extern void memcxt_hugepages(memcxt_t* memcxt);
+
+/* 
+ * unmaps the pools, other than the first, that are entirely free, as long as
+ * that does not make memcxt_refill map another; returns the bytes unmapped 
+ */
+extern size_t memcxt_trim(memcxt_t* memcxt);
+
+/*
+ * Each thread keeps a magazine of free buckets from one memcxt;
+ * allocating and releasing a bucket of that memcxt use the magazine
+ * before the pools.
+ *
+ * memcxt_refill is meant to be called before the lock that serializes
+ * the memcxt's other uses (the arena lock) is taken. It tops up the
+ * calling thread's magazine from memcxt, and maps and initializes the
+ * next bucket or segment pool when the current ones run low, so that
+ * neither the bitmask search nor the mmap happens with that lock held.
+ *
+ * memcxt_flush returns the calling thread's magazine to its memcxt, as
+ * the thread exits.
+ *
+ * memcxt_lock and memcxt_unlock are for fork. In the child memcxt_reset
+ * takes the place of memcxt_unlock, and memcxt_reset_magazines, once
+ * every memcxt is reset, returns the buckets in the magazines of the
+ * threads that did not come along.
+ */
+extern void memcxt_refill(memcxt_t* memcxt);
+
+extern void memcxt_flush(void);
+
+extern void memcxt_lock(memcxt_t* memcxt);
+
+extern void memcxt_unlock(memcxt_t* memcxt);
+
+extern void memcxt_reset(memcxt_t* memcxt);
+
+extern void memcxt_reset_magazines(void);
+
 #endif
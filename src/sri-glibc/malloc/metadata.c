@@ -22,6 +22,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <string.h>
 
 #include "metadata.h"
 #include "utils.h"
@@ -39,6 +40,9 @@ const uint16_t  metadata_max_load                 = 3;
 /* toggle for enabling table contraction */
 #define CONTRACTION_ENABLED  1
 
+/* how many chunks ahead the batch routines prefetch */
+#define METADATA_PREFETCH_DISTANCE  4
+
 /* static routines */
 static void metadata_cfg_init(metadata_cfg_t* cfg, memcxt_t* memcxt);
 
@@ -75,6 +79,72 @@ static size_t bucket_length(bucket_t* bucket);
 static void bucket_dump(int fd, bucket_t* bucket);
 #endif
 
+/* https://github.com/google/farmhash/blob/master/src/farmhash.h */
+
+// This is intended to be a good fingerprinting primitive.
+static inline uint64_t Fingerprint(uint64_t x) {
+  // Murmur-inspired hashing.
+  const uint64_t kMul = 0x9ddfea08eb382d69ULL;
+  uint64_t b = x * kMul;
+  b ^= (b >> 44);
+  b *= kMul;
+  b ^= (b >> 41);
+  b *= kMul;
+  return b;
+}
+
+/*
+ * The candidate hashes for metadata_bindex; see SRI_METADATA_HASH in sri.h.
+ * Each is a  uint32_t metadata_hash_<name>(const void *p)  and the linear
+ * hashing only ever uses the low order bits of the result, so those are the
+ * ones that need to be good.
+ *
+ * The chunks are (at least) 16 byte aligned, so the specialized versions
+ * discard the four low bits that carry no information.
+ */
+
+static inline uint32_t metadata_hash_farmhash(const void *p){
+  return (uint32_t)Fingerprint((uintptr_t)p);
+}
+
+static inline uint32_t metadata_hash_jenkins(const void *p){
+  return jenkins_hash_ptr(p);
+}
+
+/* Knuth's multiplicative hash; the high half of the product is the well mixed half */
+static inline uint32_t metadata_hash_mulshift(const void *p){
+  return (uint32_t)((((uintptr_t)p >> 4) * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+#if SRI_METADATA_HASH == SRI_HASH_CRC32C
+#if !defined(__x86_64__)
+#error "SRI_HASH_CRC32C needs the SSE4.2 crc32 instruction"
+#endif
+__attribute__((target("sse4.2")))
+static inline uint32_t metadata_hash_crc32c(const void *p){
+  return (uint32_t)__builtin_ia32_crc32di(0xFFFFFFFF, (uintptr_t)p >> 4);
+}
+#endif
+
+/* instantiates metadata_hash (and its name for the stats) as metadata_hash_<name> */
+#define METADATA_HASH_IMPL(name)				\
+  static const char metadata_hash_name[] = #name;		\
+  static inline uint32_t metadata_hash(const void *p){		\
+    return metadata_hash_##name(p);				\
+  }
+
+#if SRI_METADATA_HASH == SRI_HASH_FARMHASH
+METADATA_HASH_IMPL(farmhash)
+#elif SRI_METADATA_HASH == SRI_HASH_JENKINS
+METADATA_HASH_IMPL(jenkins)
+#elif SRI_METADATA_HASH == SRI_HASH_MULSHIFT
+METADATA_HASH_IMPL(mulshift)
+#elif SRI_METADATA_HASH == SRI_HASH_CRC32C
+METADATA_HASH_IMPL(crc32c)
+#else
+#error "Unknown SRI_METADATA_HASH"
+#endif
+
 /* Fast modulo arithmetic, assuming that y is a power of 2 */
 static inline size_t mod_power_of_two(size_t x, size_t y){
   assert(is_power_of_two(y));
@@ -167,24 +237,12 @@ bool init_metadata(metadata_t* lhtbl, memcxt_t* memcxt){
   assert(is_power_of_two(lhtbl->maxp));
 
 #if SRI_METADATA_CACHE
-  /* set up the cache */
-  /*
-  bool nextUpdateIsZero;
-  void* cacheKeys0;
-  void* cacheKeys1;
-  chunkinfoptr cacheValues0;
-  chunkinfoptr cacheValues1;
-                                                                                  
-  uint64_t cacheHits;                                                             
-  uint64_t cacheMisses;  
-  */
-  lhtbl->nextUpdateIsZero = true;
-  lhtbl->cacheKeys0 = NULL;
-  lhtbl->cacheKeys1 = NULL;
-  lhtbl->cacheValues0 = NULL;
-  lhtbl->cacheValues1 = NULL;
-  lhtbl->cacheHits = 0;
-  lhtbl->cacheMisses = 0;
+  /* generation 0 is never valid; a zeroed cache entry has no owner */
+  for(index = 0; index < METADATA_CACHE_LENGTH; index++){
+    lhtbl->cache_generation[index] = 1;
+  }
+  lhtbl->cache_hits = 0;
+  lhtbl->cache_misses = 0;
 #endif
 
   /* create the segments needed by the current directory */
@@ -244,8 +302,13 @@ extern void dump_metadata(FILE* fp, metadata_t* lhtbl, bool showloads){
   fprintf(fp, "maxp = %" PRIuPTR "\n", lhtbl->maxp);
   fprintf(fp, "bincount = %" PRIuPTR "\n", lhtbl->bincount);
   fprintf(fp, "load = %" PRIuPTR "\n", metadata_load(lhtbl));
+  fprintf(fp, "hash = %s\n", metadata_hash_name);
 #if SRI_METADATA_CACHE
-  fprintf(fp, "cache hitrate = %.3f%% (two element cache)\n", 100.0 * lhtbl->cacheHits / (lhtbl->cacheHits + lhtbl->cacheMisses));
+  fprintf(fp, "cache hits = %" PRIu64 " misses = %" PRIu64 "\n", lhtbl->cache_hits, lhtbl->cache_misses);
+  if(lhtbl->cache_hits + lhtbl->cache_misses > 0){
+    fprintf(fp, "cache hitrate = %.3f%% (%lu entry per-thread cache)\n",
+	    100.0 * lhtbl->cache_hits / (lhtbl->cache_hits + lhtbl->cache_misses), METADATA_CACHE_LENGTH);
+  }
 #endif
   
   maxlength = 0;
@@ -286,13 +349,7 @@ extern void dump_metadata(FILE* fp, metadata_t* lhtbl, bool showloads){
 
 #if SRI_HISTOGRAM 
 
-#if SRI_JENKINS_HASH
-  const char hashname[] = "jenkins";
-#else
-  const char hashname[] = "google";
-#endif
-
-  snprintf(dumpfile, 1024, "/tmp/bin_%d_%zu_%s.txt", dumpcount++, maxindex, hashname);
+  snprintf(dumpfile, 1024, "/tmp/bin_%d_%zu_%s.txt", dumpcount++, maxindex, metadata_hash_name);
   
   int fd = open(dumpfile, O_WRONLY | O_CREAT, 00777);
   
@@ -355,67 +412,53 @@ void delete_metadata(metadata_t* lhtbl){
   }
 }
 
-/* https://github.com/google/farmhash/blob/master/src/farmhash.h */
+#if SRI_METADATA_CACHE
 
-// This is intended to be a good fingerprinting primitive.
-inline uint64_t Fingerprint(uint64_t x) {
-  // Murmur-inspired hashing.
-  const uint64_t kMul = 0x9ddfea08eb382d69ULL;
-  uint64_t b = x * kMul;
-  b ^= (b >> 44);
-  b *= kMul;
-  b ^= (b >> 41);
-  b *= kMul;
-  return b;
-}
+#if SRI_METADATA_CACHE_BITS < 1 || SRI_METADATA_CACHE_BITS > 16
+#error "SRI_METADATA_CACHE_BITS should be between 1 and 16"
+#endif
+
+#ifndef attribute_tls_model_ie
+#define attribute_tls_model_ie
+#endif
 
-#if SRI_METADATA_CACHE
 /*
- * Below are three functions that implement a cache in front of the hashtable.
+ * Below are three functions that implement a per-thread cache in front of the hashtable.
+ * The cache is direct mapped, so the slot for a key is fixed; the chunks are 16 byte
+ * aligned so we throw away the low bits before the (Fibonacci) multiplicative hash.
  */
-static void cache_insert(metadata_t* lhtbl, const void* key, chunkinfoptr value){
-  if(lhtbl->nextUpdateIsZero) {
-    lhtbl->cacheKeys0 = (void*) key;
-    lhtbl->cacheValues0 = value;
-    lhtbl->nextUpdateIsZero = false;
-  } else {
-    lhtbl->cacheKeys1 = (void*) key;
-    lhtbl->cacheValues1 = value;
-    lhtbl->nextUpdateIsZero = true;
-  }
+static __thread metadata_cache_entry_t metadata_cache[METADATA_CACHE_LENGTH] attribute_tls_model_ie;
+
+static inline size_t cache_index(const void* key){
+  return (size_t)((((uintptr_t)key >> 4) * 0x9E3779B97F4A7C15ULL) >> (64 - SRI_METADATA_CACHE_BITS));
 }
 
-static void cache_delete(metadata_t* lhtbl, const void* key){
-  if(lhtbl->cacheKeys0 == key) {
-    lhtbl->cacheKeys0 = NULL;
-    lhtbl->cacheValues0 = NULL;
-    lhtbl->nextUpdateIsZero = true;
-  } else if(lhtbl->cacheKeys1 == key) {
-    lhtbl->cacheKeys1 = NULL;
-    lhtbl->cacheValues1 = NULL;
-    lhtbl->nextUpdateIsZero = false;
-  }
+static inline void cache_insert(metadata_t* lhtbl, const void* key, chunkinfoptr value){
+  size_t index = cache_index(key);
+  metadata_cache_entry_t* entry = &metadata_cache[index];
+  entry->key = key;
+  entry->value = value;
+  entry->owner = lhtbl;
+  entry->generation = lhtbl->cache_generation[index];
+}
+
+/* invalidates the slot of key in every thread's cache, not just ours */
+static inline void cache_delete(metadata_t* lhtbl, const void* key){
+  lhtbl->cache_generation[cache_index(key)]++;
 }
 
 /**
  * Check if the chunkinfoptr for a given heap pointer is in the cache.
  * If present, the chunkinfoptr is returned. If absent, NULL is returned.
  */
-static chunkinfoptr cache_lookup(metadata_t* lhtbl, const void* key){
-  if(lhtbl->cacheKeys0 == key) {
-    lhtbl->nextUpdateIsZero = false; // this entry is "hot", so update the other
-    lhtbl->cacheHits++;
-    return lhtbl->cacheValues0;
-  } else if(lhtbl->cacheKeys1 == key) {
-    lhtbl->nextUpdateIsZero = true; // this entry is "hot", so update the other
-    lhtbl->cacheHits++;
-    return lhtbl->cacheValues1;
+static inline chunkinfoptr cache_lookup(metadata_t* lhtbl, const void* key){
+  size_t index = cache_index(key);
+  metadata_cache_entry_t* entry = &metadata_cache[index];
+  if(entry->key == key && entry->owner == lhtbl && entry->generation == lhtbl->cache_generation[index]){
+    lhtbl->cache_hits++;
+    return entry->value;
   }
-
-  /*
-   * If we got here, then our key isn't in the table, so we missed!
-   */
-  lhtbl->cacheMisses++;
+  lhtbl->cache_misses++;
   return NULL;
 }
 #endif
@@ -427,11 +470,7 @@ static uint32_t metadata_bindex(metadata_t* lhtbl, const void *p){
   uint32_t l;
   size_t next_maxp;
 
-#if SRI_JENKINS_HASH
-  jhash  = jenkins_hash_ptr(p);
-#else
-  jhash  = (uint32_t)Fingerprint((uintptr_t)p);
-#endif
+  jhash  = metadata_hash(p);
 
   l = mod_power_of_two(jhash, lhtbl->maxp);
 
@@ -723,7 +762,10 @@ bucket_t* metadata_lookup(metadata_t* lhtbl, const void *chunk){
   }
 
 #if SRI_METADATA_CACHE
-  cache_insert(lhtbl, chunk, value);
+  /* we don't cache misses; a later add by another thread would not invalidate them */
+  if(value != NULL){
+    cache_insert(lhtbl, chunk, value);
+  }
 #endif
   return value;
 }
@@ -779,6 +821,10 @@ size_t metadata_delete_all(metadata_t* lhtbl, const void *chunk){
   bucket_t* previous_bucketp;
   bucket_t* temp_bucketp;
 
+#if SRI_METADATA_CACHE
+  cache_delete(lhtbl, chunk);
+#endif
+
   count = 0;
   previous_bucketp = NULL;
   binp = metadata_fetch_bucket(lhtbl, chunk);
@@ -817,6 +863,138 @@ size_t metadata_delete_all(metadata_t* lhtbl, const void *chunk){
 }
 
 
+/* hashes the chunks and prefetches their bins */
+static void batch_bins(metadata_t* lhtbl, const void *chunks[], uint32_t bindices[], size_t count){
+  size_t index;
+
+  for(index = 0; index < count; index++){
+    bindices[index] = metadata_bindex(lhtbl, chunks[index]);
+    __builtin_prefetch(bindex2bin(lhtbl, bindices[index]), 0, 3);
+  }
+}
+
+/* insertion sort on the bindex, so that chunks in the same bin are adjacent */
+static void batch_group(const void *chunks[], uint32_t bindices[], size_t count){
+  size_t i;
+  size_t j;
+  uint32_t bindex;
+  const void *chunk;
+
+  for(i = 1; i < count; i++){
+    bindex = bindices[i];
+    chunk = chunks[i];
+    for(j = i; j > 0 && bindices[j - 1] > bindex; j--){
+      bindices[j] = bindices[j - 1];
+      chunks[j] = chunks[j - 1];
+    }
+    bindices[j] = bindex;
+    chunks[j] = chunk;
+  }
+}
+
+size_t metadata_lookup_batch(metadata_t* lhtbl, const void *chunks[], chunkinfoptr values[], size_t count){
+  uint32_t bindices[METADATA_BATCH_LENGTH];
+  size_t found;
+  size_t base;
+  size_t length;
+  size_t index;
+  bucket_t* bucketp;
+
+  found = 0;
+
+  for(base = 0; base < count; base += length){
+    length = count - base < METADATA_BATCH_LENGTH ? count - base : METADATA_BATCH_LENGTH;
+
+    batch_bins(lhtbl, &chunks[base], bindices, length);
+    
+    for(index = 0; index < length; index++){
+
+      if(index + METADATA_PREFETCH_DISTANCE < length){
+	__builtin_prefetch(*bindex2bin(lhtbl, bindices[index + METADATA_PREFETCH_DISTANCE]), 0, 3);
+      }
+
+      bucketp = *bindex2bin(lhtbl, bindices[index]);
+      while(bucketp != NULL && bucketp->chunk != chunks[base + index]){
+	bucketp = bucketp->next_bucket;
+      }
+
+      values[base + index] = bucketp;
+      if(bucketp != NULL){
+	found++;
+      }
+    }
+  }
+  
+  return found;
+}
+
+size_t metadata_delete_batch(metadata_t* lhtbl, const void *chunks[], size_t count){
+  uint32_t bindices[METADATA_BATCH_LENGTH];
+  size_t deleted;
+  size_t block_deleted;
+  size_t base;
+  size_t length;
+  size_t index;
+  bucket_t** binp;
+  bucket_t* current_bucketp;
+  bucket_t* previous_bucketp;
+
+  deleted = 0;
+
+  for(base = 0; base < count; base += length){
+    length = count - base < METADATA_BATCH_LENGTH ? count - base : METADATA_BATCH_LENGTH;
+
+    batch_bins(lhtbl, &chunks[base], bindices, length);
+
+    batch_group(&chunks[base], bindices, length);
+
+    block_deleted = 0;
+
+    for(index = 0; index < length; index++){
+
+#if SRI_METADATA_CACHE
+      cache_delete(lhtbl, chunks[base + index]);
+#endif
+
+      if(index + METADATA_PREFETCH_DISTANCE < length){
+	__builtin_prefetch(*bindex2bin(lhtbl, bindices[index + METADATA_PREFETCH_DISTANCE]), 1, 3);
+      }
+
+      /* as in metadata_delete, but the table can't change shape under us until the end of the batch */
+      binp = bindex2bin(lhtbl, bindices[index]);
+      previous_bucketp = NULL;
+      current_bucketp = *binp;
+
+      while(current_bucketp != NULL){
+	if(chunks[base + index] == current_bucketp->chunk){
+	  if(previous_bucketp == NULL){
+	    *binp = current_bucketp->next_bucket;
+	  } else {
+	    previous_bucketp->next_bucket = current_bucketp->next_bucket;
+	  }
+	  memcxt_release(lhtbl->cfg.memcxt, BUCKET, current_bucketp, sizeof(bucket_t));
+	  lhtbl->count--;
+	  block_deleted++;
+	  break;
+	}
+	previous_bucketp = current_bucketp;
+	current_bucketp = current_bucketp->next_bucket;
+      }
+    }
+
+#if CONTRACTION_ENABLED
+    /* one contraction check per delete, as metadata_delete would have done */
+    for(index = 0; index < block_deleted; index++){
+      metadata_contract_check(lhtbl);
+    }
+#endif
+
+    deleted += block_deleted;
+  }
+
+  return deleted;
+}
+
 #if SRI_HISTOGRAM 
 void bucket_dump(int fd, bucket_t* bucket){
   bucket_t* current;
@@ -54,6 +54,24 @@
  */
 
 
+#if SRI_METADATA_CACHE
+
+#define METADATA_CACHE_LENGTH  (1UL << SRI_METADATA_CACHE_BITS)
+
+/*
+ * An entry in a thread's lookup cache. It is only valid if it belongs to the
+ * table doing the lookup, and its generation is that table's current
+ * generation for the slot.
+ */
+typedef struct metadata_cache_entry_s {
+  const void* key;
+  chunkinfoptr value;
+  struct metadata_s* owner;
+  uint64_t generation;
+} metadata_cache_entry_t;
+
+#endif
+
 typedef struct metadata_cfg_s {
   memcxt_t *memcxt;                 /* Where we get our memory from                                            */
   size_t segment_length;            /* segment length; larsen uses 256; we could use  4096 or 2^18 = 262144    */
@@ -95,14 +113,9 @@ typedef struct metadata_s {
   size_t maxp;                   /* the current limit on the bin count  [{ maxp = N * 2^L }]               */
   size_t bincount;               /* the current number of bins                                             */
 #if SRI_METADATA_CACHE
-  bool nextUpdateIsZero; /* we'll alternate which key we replace */
-  void* cacheKeys0;
-  void* cacheKeys1;
-  chunkinfoptr cacheValues0;
-  chunkinfoptr cacheValues1;
-                                                                                  
-  uint64_t cacheHits;                                                             
-  uint64_t cacheMisses;  
+  uint64_t cache_generation[METADATA_CACHE_LENGTH]; /* bumped by a delete from the corresponding cache slot     */
+  uint64_t cache_hits;                              /* lookups answered by a thread's cache                     */
+  uint64_t cache_misses;                            /* lookups that had to search the table                     */
 #endif
   
 } metadata_t;
@@ -145,6 +158,26 @@ extern bool metadata_delete(metadata_t* htbl, const void *chunk);
 /* deletes all buckets keyed by chunk; returns the number of buckets deleted */
 extern size_t metadata_delete_all(metadata_t* htbl, const void *chunk);
 
+/*
+ * The batched versions of metadata_lookup and metadata_delete. The chunks are 
+ * hashed up front, and the bins (and their first buckets) are prefetched a few 
+ * chunks ahead of the ones being searched, so the cache misses of consecutive
+ * chunks overlap rather than happen one after another.
+ *
+ * metadata_lookup_batch stores the result for chunks[i] in values[i] (NULL if
+ * not found) and returns the number found; it does no move-to-front.
+ *
+ * metadata_delete_batch also groups the chunks by bin, and only considers
+ * contracting the table at the end of each METADATA_BATCH_LENGTH chunks. It returns the
+ * number of buckets deleted. The order of chunks is not preserved.
+ */
+
+#define METADATA_BATCH_LENGTH  64
+
+extern size_t metadata_lookup_batch(metadata_t* htbl, const void *chunks[], chunkinfoptr values[], size_t count);
+
+extern size_t metadata_delete_batch(metadata_t* htbl, const void *chunks[], size_t count);
+
 extern void dump_metadata(FILE* fp, metadata_t* lhash, bool showloads);
 
 static inline chunkinfoptr allocate_chunkinfoptr(metadata_t* htbl){
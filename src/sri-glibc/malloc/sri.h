@@ -53,19 +53,31 @@ struct malloc_chunk {
 
 /* 
    SRI_METADATA_CACHE in {0, 1}, DEFAULT is 0: This deal with caching
-   in the dynamic hashtable (see metadata.[c,h]). If truned on the we
-   cache the last *two* queries against the metadata
-   hashtable. Simulations indicated that we were hitting diminishing
-   returns with a fully associative cache of size 16 (roughly 50% hit
-   rate on malloc-heavy benchmarks), but the cost of searching the cache
-   when we missed was unacceptably high. Simulations showed a non-trivial
-   benefit for very, very small caches, so we'll try that.
+   in front of the dynamic hashtable (see metadata.[c,h]). If turned on
+   each thread keeps a small direct mapped cache of chunk -> chunkinfoptr
+   lookups. The slot is chosen by hashing the chunk, so a miss costs a
+   single key comparison (the old two entry, per table, cache needed a
+   search of the whole cache to miss). Entries are tagged with the
+   generation of their slot in the owning table; metadata_delete bumps
+   that generation, so a delete by any thread invalidates stale entries
+   in every other thread's cache.
+
+   SRI_METADATA_CACHE_BITS is the log2 of the number of entries in each
+   thread's cache. See src/mdbench (make cache_sweep) for the sweep used
+   to choose the default: on a compiler trace the hit rate goes 37%, 59%,
+   73%, 83% for 2, 16, 64, 256 entries, while programs whose frees are
+   far from their mallocs (a perl trace) see almost no hits at any size.
+   64 entries is 2K of TLS per thread.
 */
 
 #ifndef SRI_METADATA_CACHE
 #define SRI_METADATA_CACHE  0
 #endif
 
+#ifndef SRI_METADATA_CACHE_BITS
+#define SRI_METADATA_CACHE_BITS  6
+#endif
+
 
 /*
   SRI_HISTOGRAM in {0, 1}, DEFAULT is 0: This a diagnostic tool when
@@ -89,14 +101,66 @@ struct malloc_chunk {
 
 
 
-/* SRI_JENKINS_HASH in {0, 1}, DEFAULT is 0: This determines the 
-hashing function used in each arena's hash table. If 1 then we use the
-Jenkin's hash. If 0 we use the google hash. Both are defined in 
-metadata.c.
+/* SRI_METADATA_HASH in {SRI_HASH_FARMHASH, SRI_HASH_JENKINS,
+SRI_HASH_MULSHIFT, SRI_HASH_CRC32C}, DEFAULT is SRI_HASH_FARMHASH: This
+determines the hashing function used in each arena's hash table. The
+first two are general purpose 64 bit mixers (the google farmhash
+Fingerprint, and Jenkin's hash). The last two exploit the fact that the
+keys are 16 byte aligned addresses: SRI_HASH_MULSHIFT is a single
+multiply-shift of addr >> 4, SRI_HASH_CRC32C uses the SSE4.2 crc32
+instruction (so only on x86_64 machines that have it). They are
+defined in metadata.c; src/mdbench (make hash_sweep) compares them.
+
+The old SRI_JENKINS_HASH=1 is still understood to mean SRI_HASH_JENKINS.
+*/
+
+#define SRI_HASH_FARMHASH  0
+#define SRI_HASH_JENKINS   1
+#define SRI_HASH_MULSHIFT  2
+#define SRI_HASH_CRC32C    3
+
+#ifndef SRI_METADATA_HASH
+#if defined(SRI_JENKINS_HASH) && SRI_JENKINS_HASH
+#define SRI_METADATA_HASH  SRI_HASH_JENKINS
+#else
+#define SRI_METADATA_HASH  SRI_HASH_FARMHASH
+#endif
+#endif
+
+/* SRI_SLAB in {0, 1}, DEFAULT is 0: This puts a slab allocator in front
+of _int_malloc for requests of at most mp_.slab_max bytes (mallopt
+M_SLAB_MAX, or MALLOC_SLAB_MAX in the environment; 0 turns it off). Such
+requests are carved out of 32K runs of equal sized slots; a run is a
+single chunk of the arena's heap, so it has one bucket in the metadata,
+and the slots are tracked by a bitmap in the run's header. The runs are
+found by address using the lock free tables in lookup.c, so neither
+malloc nor free of a small object inserts into or deletes from the
+metadata.
+*/
+
+#ifndef SRI_SLAB
+#define SRI_SLAB 0
+#endif
+
+/* SRI_ADAPTIVE_LOCK in {0, 1}, DEFAULT is 0: This replaces the arena's
+glibc mutex with a lock that spins for a while, pausing an exponentially
+growing number of times between attempts, before it sleeps on a futex.
+The lock word gets a cache line of its own. Either way LOCK_ARENA keeps,
+per arena and per lock_site_t, the number of acquisitions, those that had
+to wait, the futex waits, and the time spent waiting; malloc_stats prints
+them. (With the glibc mutex every wait is counted as a futex wait.)
+*/
+
+#ifndef SRI_ADAPTIVE_LOCK
+#define SRI_ADAPTIVE_LOCK 0
+#endif
+
+/* SRI_CACHE_LINE, DEFAULT is 64: the cache line size that struct
+malloc_state is laid out for (see its comment in malloc.c).
 */
 
-#ifndef SRI_JENKINS_HASH
-#define SRI_JENKINS_HASH  0
+#ifndef SRI_CACHE_LINE
+#define SRI_CACHE_LINE 64
 #endif
 
 /* SRI_POOL_DEBUG in {0, 1}, DEFAULT is 0: This truns on some serious
@@ -108,12 +108,66 @@ bool mul_size(size_t s1, size_t s2, size_t* prod){
 }
 
 
+bool sri_hugepages = false;
+
+/* the size we actually map for a request of size bytes */
+static inline size_t mapped_size(size_t size){
+  if(size < HUGE_PAGE_SIZE){
+    return size;
+  }
+  return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+bool sri_madvise_hugepages(void* memory, size_t size){
+#ifdef MADV_HUGEPAGE
+  return madvise(memory, size, MADV_HUGEPAGE) == 0;
+#else
+  return false;
+#endif
+}
+
+/* over map by HUGE_PAGE_SIZE and then trim both ends to get an aligned region */
+static void* mmap_hugepages(size_t size){
+  char* memory;
+  char* aligned;
+  size_t head;
+  size_t tail;
+
+  memory = mmap(0, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if(memory == MAP_FAILED){
+    return NULL;
+  }
+
+  aligned = (char*)(((uintptr_t)memory + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+  head = aligned - memory;
+  tail = HUGE_PAGE_SIZE - head;
+
+  if(head > 0){
+    munmap(memory, head);
+  }
+  if(tail > 0){
+    munmap(aligned + size, tail);
+  }
+
+  /* no huge pages is not a failure; we just don't get the TLB benefit */
+  sri_madvise_hugepages(aligned, size);
+
+  return aligned;
+}
+
 void* sri_mmap(void* oldaddr, size_t size){
   void* memory;
   int flags;
   int protection;
 
-  /* beef this up later  */
+  size = mapped_size(size);
+
+  if(sri_hugepages && size >= HUGE_PAGE_SIZE){
+    memory = mmap_hugepages(size);
+    if(memory != NULL){
+      return memory;
+    }
+  }
 
   protection = PROT_READ | PROT_WRITE;
   flags = MAP_PRIVATE | MAP_ANON;
@@ -136,7 +190,7 @@ void* sri_mmap(void* oldaddr, size_t size){
 bool sri_munmap(void* memory, size_t size){
   int rcode;
 
-  rcode = munmap(memory, size);
+  rcode = munmap(memory, mapped_size(size));
   
   return rcode != -1;
 }
@@ -78,9 +78,26 @@ static inline uint32_t ctz64(uint64_t x) {
 
 #endif
 
+/*
+ * Regions of at least HUGE_PAGE_SIZE (the metadata pools, and very large
+ * directories) are mapped in multiples of HUGE_PAGE_SIZE. When sri_hugepages
+ * is set they are also HUGE_PAGE_SIZE aligned and madvise'd MADV_HUGEPAGE, so
+ * that transparent huge pages can back them. If THP is not available the
+ * advice fails and we just carry on with normal pages.
+ *
+ * sri_munmap must be given the same size that was given to sri_mmap.
+ */
+
+#define HUGE_PAGE_SIZE  (2UL * 1024 * 1024)
+
+extern bool sri_hugepages;
+
 extern void* sri_mmap(void* oldaddr, size_t size);
 
 
 extern bool sri_munmap(void* memory, size_t size);
 
+/* asks for huge pages on the (page aligned) region; returns false if the advice was refused */
+extern bool sri_madvise_hugepages(void* memory, size_t size);
+
 #endif